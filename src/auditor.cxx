@@ -0,0 +1,366 @@
+#include "auditor.h"
+#include "instrument.h"
+
+#include <algorithm>
+
+namespace pbpdp
+{
+
+unsigned int local_prover::add_file(verification_metadata &vm, file &f)
+{
+	std::lock_guard<std::mutex> lock(_lock);
+	stored_file sf = { &vm, &f };
+	_files.push_back(sf);
+	return _files.size() - 1;
+}
+
+void local_prover::respond(unsigned int file_id, challenge &c, response_proof &rp)
+{
+	stored_file sf;
+	{
+		std::lock_guard<std::mutex> lock(_lock);
+		sf = _files.at(file_id);
+	}
+	gen_proof(rp,c,*sf.vm,_p,_scheme,*sf.f);
+}
+
+auditor::auditor(scheme_parameters &scheme, const auditor_options &options) :
+	_scheme(scheme),
+	_options(options),
+	_running(false),
+	_stopping(false),
+	_audits(0),
+	_failures(0),
+	_batches(0),
+	_queue_full(0),
+	_dropped(0),
+	_latency_total(0),
+	_latency_max(0),
+	_latency_next(0)
+{
+	if (_options.workers == 0)
+	{
+		_options.workers = 1;
+	}
+	if (_options.provers == 0)
+	{
+		_options.provers = 1;
+	}
+	if (_options.queue_capacity == 0)
+	{
+		_options.queue_capacity = 1;
+	}
+	if (_options.max_batch == 0)
+	{
+		_options.max_batch = 1;
+	}
+}
+
+unsigned int auditor::register_file(verification_metadata &vm, public_parameters &p, prover &pr, unsigned int prover_file_id)
+{
+	std::lock_guard<std::mutex> lock(_lock);
+	registered_file rf = { &vm, &p, &pr, prover_file_id, clock::now(), false, false };
+	_files.push_back(rf);
+	_scheduler_wake.notify_one();
+	return _files.size() - 1;
+}
+
+void auditor::start()
+{
+	std::lock_guard<std::mutex> lock(_lock);
+	if (_running)
+	{
+		return;
+	}
+	_running = true;
+	_stopping = false;
+	_started = clock::now();
+	
+	_scheduler = std::thread(&auditor::schedule,this);
+	for (int i=0;i<_options.provers;i++)
+	{
+		_provers.push_back(std::thread(&auditor::call,this));
+	}
+	for (int i=0;i<_options.workers;i++)
+	{
+		_workers.push_back(std::thread(&auditor::work,this));
+	}
+}
+
+void auditor::stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(_lock);
+		if (!_running)
+		{
+			return;
+		}
+		_stopping = true;
+		_scheduler_wake.notify_all();
+		_due_not_empty.notify_all();
+		_queue_not_full.notify_all();
+		_queue_not_empty.notify_all();
+	}
+	
+	_scheduler.join();
+	for (int i=0;i<_provers.size();i++)
+	{
+		_provers[i].join();
+	}
+	_provers.clear();
+	for (int i=0;i<_workers.size();i++)
+	{
+		_workers[i].join();
+	}
+	_workers.clear();
+	
+	// the workers only leave once the queue is empty, this is in case that changes
+	std::lock_guard<std::mutex> lock(_lock);
+	while (!_due.empty())
+	{
+		_files[_due.front()].in_flight = false;
+		_due.pop_front();
+	}
+	while (!_queue.empty())
+	{
+		release(_queue.front());
+		_queue.pop_front();
+		_dropped++;
+	}
+	_running = false;
+}
+
+void auditor::schedule()
+{
+	std::unique_lock<std::mutex> lock(_lock);
+	while (!_stopping)
+	{
+		// hand every due file to the prover callers, then sleep until the next one is due
+		clock::time_point now = clock::now();
+		clock::time_point next = now + std::chrono::hours(1);
+		bool dispatched = false;
+		for (int i=0;i<_files.size();i++)
+		{
+			registered_file &rf = _files[i];
+			if (rf.in_flight)
+			{
+				continue;
+			}
+			if (rf.next_audit <= now)
+			{
+				rf.in_flight = true;
+				rf.next_audit = now + std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(_options.interval));
+				_due.push_back(i);
+				dispatched = true;
+			}
+			next = std::min(next,rf.next_audit);
+		}
+		if (dispatched)
+		{
+			_due_not_empty.notify_all();
+		}
+		
+		// woken early by new files and by answered challenges
+		_scheduler_wake.wait_until(lock,next);
+	}
+}
+
+void auditor::call()
+{
+	std::unique_lock<std::mutex> lock(_lock);
+	while (true)
+	{
+		_due_not_empty.wait(lock,[this]() { return !_due.empty() || _stopping; });
+		if (_stopping)
+		{
+			return;
+		}
+		unsigned int file = _due.front();
+		_due.pop_front();
+		registered_file copy = _files[file];
+		
+		// the prover can be slow, so don't hold the lock while it works
+		lock.unlock();
+		audit(copy,file);
+		lock.lock();
+		
+		_files[file].in_flight = false;
+		_scheduler_wake.notify_one();
+	}
+}
+
+void auditor::audit(registered_file &rf, unsigned int file)
+{
+	job j;
+	j.file = file;
+	j.c = new challenge;
+	j.rp = new response_proof;
+	j.issued = clock::now();
+	
+	try
+	{
+		unsigned int chunks = rf.vm->get_count();
+		gen_seeded_challenge(*j.c,_scheme,std::min(_options.challenge_size,chunks),chunks);
+		rf.pr->respond(rf.prover_file_id,*j.c,*j.rp);
+	}
+	catch (const std::exception &e)
+	{
+		// no response is a failed audit
+		PBPDP_TRACE("Prover failed to respond for file " << file << ": " << e.what());
+		record(j,false,clock::now());
+		release(j);
+		return;
+	}
+	
+	std::unique_lock<std::mutex> lock(_lock);
+	if (_queue.size() >= _options.queue_capacity && !_stopping)
+	{
+		_queue_full++;
+		_queue_not_full.wait(lock,[this]() { return _queue.size() < _options.queue_capacity || _stopping; });
+	}
+	// the workers may already have left, nobody would verify it
+	if (_stopping)
+	{
+		_dropped++;
+		release(j);
+		return;
+	}
+	_queue.push_back(j);
+	_queue_not_empty.notify_one();
+}
+
+void auditor::work()
+{
+	std::unique_lock<std::mutex> lock(_lock);
+	while (true)
+	{
+		_queue_not_empty.wait(lock,[this]() { return !_queue.empty() || _stopping; });
+		if (_queue.empty())
+		{
+			return;
+		}
+		
+		// verify one response, or a batch of them when responses are piling up
+		unsigned int n = 1;
+		if (_queue.size() >= _options.batch_threshold)
+		{
+			n = std::min<unsigned int>(_queue.size(),_options.max_batch);
+		}
+		std::vector<job> jobs(_queue.begin(),_queue.begin()+n);
+		_queue.erase(_queue.begin(),_queue.begin()+n);
+		_queue_not_full.notify_all();
+		
+		lock.unlock();
+		verify(jobs);
+		lock.lock();
+	}
+}
+
+void auditor::verify(std::vector<job> &jobs)
+{
+	std::vector<bool> valid(jobs.size());
+	
+	if (jobs.size() == 1)
+	{
+		registered_file rf;
+		{
+			std::lock_guard<std::mutex> lock(_lock);
+			rf = _files[jobs[0].file];
+		}
+		valid[0] = verify_proof(*jobs[0].rp,*jobs[0].c,*rf.vm,*rf.p,_scheme);
+	}
+	else
+	{
+		std::vector<batch_entry> entries(jobs.size());
+		{
+			std::lock_guard<std::mutex> lock(_lock);
+			for (int i=0;i<jobs.size();i++)
+			{
+				registered_file &rf = _files[jobs[i].file];
+				batch_entry entry = { jobs[i].rp, jobs[i].c, rf.vm, rf.p };
+				entries[i] = entry;
+			}
+			_batches++;
+		}
+		verify_proof_batch(entries,_scheme,&valid);
+	}
+	
+	clock::time_point done = clock::now();
+	for (int i=0;i<jobs.size();i++)
+	{
+		record(jobs[i],valid[i],done);
+		release(jobs[i]);
+	}
+}
+
+void auditor::release(job &j)
+{
+	delete j.rp;
+	delete j.c;
+	j.rp = 0;
+	j.c = 0;
+}
+
+void auditor::record(const job &j, bool valid, clock::time_point done)
+{
+	double latency = std::chrono::duration<double>(done - j.issued).count();
+	
+	std::lock_guard<std::mutex> lock(_lock);
+	_audits++;
+	if (!valid)
+	{
+		_failures++;
+	}
+	_files[j.file].failed = !valid;
+	
+	_latency_total += latency;
+	_latency_max = std::max(_latency_max,latency);
+	if (_latencies.size() < _options.latency_samples)
+	{
+		_latencies.push_back(latency);
+	}
+	else if (!_latencies.empty())
+	{
+		_latencies[_latency_next] = latency;
+		_latency_next = (_latency_next + 1) % _latencies.size();
+	}
+}
+
+auditor_stats auditor::get_stats()
+{
+	std::lock_guard<std::mutex> lock(_lock);
+	auditor_stats stats;
+	stats.audits = _audits;
+	stats.failures = _failures;
+	stats.batches = _batches;
+	stats.queue_full = _queue_full;
+	stats.dropped = _dropped;
+	
+	double elapsed = _running || _audits ? std::chrono::duration<double>(clock::now() - _started).count() : 0;
+	stats.throughput = elapsed > 0 ? _audits / elapsed : 0;
+	stats.latency_mean = _audits ? _latency_total / _audits : 0;
+	stats.latency_max = _latency_max;
+	
+	std::vector<double> sorted(_latencies);
+	std::sort(sorted.begin(),sorted.end());
+	stats.latency_p50 = sorted.empty() ? 0 : sorted[sorted.size()/2];
+	stats.latency_p99 = sorted.empty() ? 0 : sorted[std::min<size_t>(sorted.size()-1,sorted.size()*99/100)];
+	
+	return stats;
+}
+
+std::vector<unsigned int> auditor::get_failed_files()
+{
+	std::lock_guard<std::mutex> lock(_lock);
+	std::vector<unsigned int> failed;
+	for (int i=0;i<_files.size();i++)
+	{
+		if (_files[i].failed)
+		{
+			failed.push_back(i);
+		}
+	}
+	return failed;
+}
+
+};
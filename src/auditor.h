@@ -0,0 +1,163 @@
+#ifndef PBPDP_AUDITOR_H
+#define PBPDP_AUDITOR_H
+
+#include <stdint.h>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+#include "core.h"
+
+// a long running third party auditor.  files are registered with the prover that
+// stores them, a scheduler thread hands each due file to a pool of prover callers, so
+// many responses are outstanding at once and a slow prover only holds up its own files,
+// and a pool of workers verifies the responses.  the queue between them is bounded, so when the
+// workers fall behind the scheduler blocks instead of piling up proofs, and when many
+// responses are waiting the workers verify them together with verify_proof_batch.
+
+namespace pbpdp
+{
+	// the storage side as seen by the auditor
+	class prover
+	{
+	public:
+		virtual ~prover() {}
+		
+		// called from several threads at once, but never for the same file at once
+		virtual void respond(unsigned int file_id, challenge &c, response_proof &rp) = 0;
+	};
+	
+	// a prover in the same process, for tests and for auditing local storage
+	class local_prover : public prover
+	{
+	public:
+		local_prover(public_parameters &p, scheme_parameters &scheme) : _p(p), _scheme(scheme) {}
+		
+		// file_id is the position in the order files are added
+		unsigned int add_file(verification_metadata &vm, file &f);
+		void respond(unsigned int file_id, challenge &c, response_proof &rp);
+		
+	private:
+		struct stored_file
+		{
+			verification_metadata *	vm;
+			file *					f;
+		};
+	
+		public_parameters &			_p;
+		scheme_parameters &			_scheme;
+		std::vector<stored_file>	_files;
+		std::mutex					_lock;				// guards _files, the proofs run outside it
+	};
+	
+	struct auditor_options
+	{
+		auditor_options() : workers(2), provers(8), queue_capacity(64), interval(60.0), challenge_size(460), batch_threshold(4), max_batch(64), latency_samples(10000) {}
+		
+		unsigned int	workers;			// verification threads
+		unsigned int	provers;			// challenges waiting on a response at once
+		unsigned int	queue_capacity;		// responses waiting for verification before the scheduler blocks
+		double			interval;			// seconds between audits of the same file
+		unsigned int	challenge_size;		// chunks per challenge, capped at the file's chunk count
+		unsigned int	batch_threshold;	// waiting responses that switch the workers to batch verification
+		unsigned int	max_batch;			// most responses verified in one batch
+		unsigned int	latency_samples;	// recent latencies kept for the percentiles
+	};
+	
+	struct auditor_stats
+	{
+		uint64_t		audits;				// responses verified
+		uint64_t		failures;			// responses that didn't verify
+		uint64_t		batches;			// batch verifications run
+		uint64_t		queue_full;			// times the scheduler had to wait for the workers
+		uint64_t		dropped;			// responses that arrived after stop() and weren't verified
+		double			throughput;			// audits per second since start
+		double			latency_mean;		// challenge issued to verification done, in seconds
+		double			latency_p50;
+		double			latency_p99;
+		double			latency_max;
+	};
+	
+	class auditor
+	{
+	public:
+		auditor(scheme_parameters &scheme, const auditor_options &options = auditor_options());
+		~auditor() { stop(); }
+		
+		// files registered while running are picked up on the next pass
+		unsigned int register_file(verification_metadata &vm, public_parameters &p, prover &pr, unsigned int prover_file_id);
+		
+		void start();
+		void stop(); // finishes verifying what is queued
+		
+		auditor_stats get_stats();
+		std::vector<unsigned int> get_failed_files(); // files whose last audit failed
+		
+	private:
+		typedef std::chrono::steady_clock clock;
+	
+		struct registered_file
+		{
+			verification_metadata *	vm;
+			public_parameters *		p;
+			prover *				pr;
+			unsigned int			prover_file_id;
+			clock::time_point		next_audit;
+			bool					failed;
+			bool					in_flight;			// challenged and not yet answered
+		};
+		
+		struct job
+		{
+			unsigned int			file;
+			challenge *				c;
+			response_proof *		rp;
+			clock::time_point		issued;
+		};
+	
+		auditor(const auditor&);
+		auditor& operator=(const auditor&);
+		
+		void schedule();
+		void call();
+		void work();
+		void audit(registered_file &rf, unsigned int file);
+		void verify(std::vector<job> &jobs);
+		void record(const job &j, bool valid, clock::time_point done);
+		static void release(job &j);
+		
+		scheme_parameters &				_scheme;
+		auditor_options					_options;
+		
+		std::mutex						_lock;
+		std::condition_variable			_scheduler_wake;
+		std::condition_variable			_due_not_empty;
+		std::condition_variable			_queue_not_empty;
+		std::condition_variable			_queue_not_full;
+		std::vector<registered_file>	_files;
+		std::deque<unsigned int>		_due;			// files waiting for a prover caller
+		std::deque<job>					_queue;
+		bool							_running;
+		bool							_stopping;
+		
+		std::thread						_scheduler;
+		std::vector<std::thread>		_provers;
+		std::vector<std::thread>		_workers;
+		
+		clock::time_point				_started;
+		uint64_t						_audits;
+		uint64_t						_failures;
+		uint64_t						_batches;
+		uint64_t						_queue_full;
+		uint64_t						_dropped;
+		double							_latency_total;
+		double							_latency_max;
+		std::vector<double>				_latencies;		// ring buffer of recent latencies
+		unsigned int					_latency_next;
+	};
+};
+
+#endif
@@ -0,0 +1,575 @@
+#include <config.h>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <random>
+#include <functional>
+#include "core.h"
+#include "multiexp.h"
+#include "sha256.h"
+#include "fq.h"
+
+using namespace pbpdp;
+
+// benchmarks for the building blocks of the scheme and for each protocol step across
+// file sizes, block sizes, challenge sizes and thread counts.  every measurement is
+// repeated and reported as percentiles, and all randomness (pbc and file contents)
+// comes from one seed, so the output of two builds can be diffed row by row.
+
+static char *read_params(const char *param_file_name)
+{
+	FILE * f = fopen(param_file_name,"rb");
+	if (f == NULL)
+	{
+		throw std::runtime_error("Unable to open parameter file.");
+	}
+	fseek(f,0,SEEK_END);
+	int sz = ftell(f);
+	rewind(f);
+
+	char *params = new char[sz+1];
+	int read = fread(params,1,sz,f);
+	fclose(f);
+	if (read != sz)
+	{
+		delete[] params;
+		throw std::runtime_error("Failed to read parameter file.");
+	}
+	params[sz] = 0;
+	return params;
+}
+
+static double seconds_since(std::chrono::steady_clock::time_point start)
+{
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	return elapsed.count();
+}
+
+static std::vector<unsigned int> parse_list(const char *s)
+{
+	std::vector<unsigned int> values;
+	std::stringstream ss(s);
+	std::string item;
+	while (std::getline(ss,item,','))
+	{
+		values.push_back(atoi(item.c_str()));
+	}
+	return values;
+}
+
+// a file held in memory, filled from a seeded generator
+class seeded_file : public file
+{
+public:
+	seeded_file(unsigned int size, unsigned int chunk_size, unsigned int seed) : _data(size), _chunk_size(chunk_size)
+	{
+		std::mt19937_64 rng(seed);
+		for (int i=0;i<size;i++)
+		{
+			_data[i] = rng();
+		}
+		_chunk_count = (size + chunk_size - 1) / chunk_size;
+		// pad the last chunk so every chunk can be read in place
+		_data.resize((uint64_t)_chunk_count * chunk_size);
+	}
+
+	void get_chunk(mpz_t e,unsigned int i)
+	{
+		mpz_import(e,_chunk_size,1,sizeof(unsigned char),0,0,&_data[(uint64_t)i*_chunk_size]);
+	}
+
+	void get_chunk(element_t e,unsigned int i)
+	{
+		element_from_bytes(e,&_data[(uint64_t)i*_chunk_size]);
+	}
+
+	unsigned int get_chunk_count()
+	{
+		return _chunk_count;
+	}
+
+private:
+	std::vector<unsigned char> _data;
+	unsigned int _chunk_size;
+	unsigned int _chunk_count;
+};
+
+struct bench_result
+{
+	std::string			name;
+	std::string			config;		// key=value pairs separated by spaces
+	std::vector<double>	samples;	// seconds
+};
+
+static double percentile(const std::vector<double> &sorted, double q)
+{
+	if (sorted.empty())
+	{
+		return 0;
+	}
+	unsigned int k = q * (sorted.size() - 1) + 0.5;
+	return sorted[k];
+}
+
+class bench_report
+{
+public:
+	bench_report(unsigned int reps) : _reps(reps) {}
+
+	// prepended to the config of everything measured after this
+	void set_context(const std::string &context) { _context = context; }
+
+	// runs setup then op reps times, timing only op
+	void measure(const std::string &name, const std::string &config, std::function<void()> op, std::function<void()> setup = std::function<void()>(), unsigned int reps = 0)
+	{
+		bench_result result;
+		result.name = name;
+		result.config = _context.empty() ? config : config.empty() ? _context : _context + " " + config;
+		reps = reps ? reps : _reps;
+		for (int i=0;i<reps;i++)
+		{
+			if (setup)
+			{
+				setup();
+			}
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			op();
+			result.samples.push_back(seconds_since(start));
+		}
+		std::sort(result.samples.begin(),result.samples.end());
+		_results.push_back(result);
+		std::cerr << name << " " << result.config << ": " << percentile(result.samples,0.5)*1e6 << " us" << std::endl;
+	}
+
+	void write_csv(std::ostream &out) const
+	{
+		out << "name,config,reps,mean_us,min_us,p50_us,p90_us,p99_us,max_us" << std::endl;
+		for (int i=0;i<_results.size();i++)
+		{
+			const bench_result &r = _results[i];
+			out << r.name << "," << r.config << "," << r.samples.size() << "," << mean(r)*1e6;
+			double q[] = { 0, 0.5, 0.9, 0.99, 1 };
+			for (int k=0;k<5;k++)
+			{
+				out << "," << percentile(r.samples,q[k])*1e6;
+			}
+			out << std::endl;
+		}
+	}
+
+	void write_json(std::ostream &out, unsigned int seed) const
+	{
+		out << "{\n  \"seed\": " << seed << ",\n  \"results\": [";
+		for (int i=0;i<_results.size();i++)
+		{
+			const bench_result &r = _results[i];
+			out << (i ? ",\n" : "\n") << "    {\"name\": \"" << r.name << "\", \"config\": \"" << r.config << "\", \"reps\": " << r.samples.size();
+			out << ", \"mean_us\": " << mean(r)*1e6;
+			out << ", \"min_us\": " << percentile(r.samples,0)*1e6;
+			out << ", \"p50_us\": " << percentile(r.samples,0.5)*1e6;
+			out << ", \"p90_us\": " << percentile(r.samples,0.9)*1e6;
+			out << ", \"p99_us\": " << percentile(r.samples,0.99)*1e6;
+			out << ", \"max_us\": " << percentile(r.samples,1)*1e6 << "}";
+		}
+		out << "\n  ]\n}" << std::endl;
+	}
+
+private:
+	static double mean(const bench_result &r)
+	{
+		double total = 0;
+		for (int i=0;i<r.samples.size();i++)
+		{
+			total += r.samples[i];
+		}
+		return r.samples.empty() ? 0 : total / r.samples.size();
+	}
+
+	unsigned int				_reps;
+	std::string					_context;
+	std::vector<bench_result>	_results;
+};
+
+// hashing, exponentiation and pairing on their own
+static void bench_primitives(bench_report &report, scheme_parameters &scheme, public_parameters &p)
+{
+	pairing_s *pairing = scheme.get_pairing();
+	element_t g1,g1_out,gt,gt_out,z;
+	element_init_G1(g1,pairing);
+	element_init_G1(g1_out,pairing);
+	element_init_GT(gt,pairing);
+	element_init_GT(gt_out,pairing);
+	element_init_Zr(z,pairing);
+	element_random(g1);
+	element_random(z);
+	p.pair_with_v(gt,g1);
+
+	element_hash hasher;
+	hasher.init(scheme);
+	unsigned char W[64] = {0};
+	unsigned int counter = 0;
+
+	report.measure("hash_to_G1","bytes=36",[&]()
+	{
+		*(unsigned int*)W = counter++;
+		hasher.hash_data_to_element(g1_out,W,36);
+	});
+
+	// 64 W's at a time, through each sha-256 the cpu has
+	const unsigned int hash_count = 64;
+	std::vector<unsigned char> Ws(hash_count*36);
+	std::vector<const unsigned char*> W_ptrs(hash_count);
+	std::vector<element_s> hashed(hash_count);
+	std::vector<element_s*> hashed_ptrs(hash_count);
+	for (int k=0;k<hash_count;k++)
+	{
+		W_ptrs[k] = &Ws[k*36];
+		element_init_G1(&hashed[k],pairing);
+		hashed_ptrs[k] = &hashed[k];
+	}
+	unsigned char digests[hash_count*sha256_digest_size];
+	const char *impl_names[] = { "scalar", "avx2", "shani" };
+	sha256_impl default_impl = sha256_get_impl();
+	for (int i=sha256_scalar;i<=sha256_shani;i++)
+	{
+		if (sha256_supported((sha256_impl)i))
+		{
+			sha256_set_impl((sha256_impl)i);
+			report.measure("sha256_batch",std::string("bytes=36 n=64 impl=") + impl_names[i],[&]() { sha256_batch(digests,&W_ptrs[0],36,hash_count); });
+		}
+	}
+	sha256_set_impl(default_impl);
+	report.measure("hash_to_G1_batch","bytes=36 n=64",[&]()
+	{
+		*(unsigned int*)&Ws[0] = counter++;
+		hasher.hash_data_to_elements(&hashed_ptrs[0],&W_ptrs[0],36,hash_count);
+	});
+	for (int k=0;k<hash_count;k++)
+	{
+		element_clear(&hashed[k]);
+	}
+
+	report.measure("G1_pow_zn","",[&]() { element_pow_zn(g1_out,g1,z); });
+	// the same through the fixed width backend on each field the cpu has, one point and
+	// eight sharing the exponent
+	if (scheme.get_fast_G1())
+	{
+		const unsigned int pow_count = fq_lanes;
+		std::vector<element_s*> g1_ptrs(pow_count,g1);
+		std::vector<element_s> powers(pow_count);
+		std::vector<element_s*> power_ptrs(pow_count);
+		for (int k=0;k<pow_count;k++)
+		{
+			element_init_G1(&powers[k],pairing);
+			power_ptrs[k] = &powers[k];
+		}
+		const char *fq_names[] = { "portable", "mulx", "ifma" };
+		fq_impl default_fq = fq_get_impl();
+		for (int i=fq_portable;i<=fq_ifma;i++)
+		{
+			if (fq_supported((fq_impl)i))
+			{
+				fq_set_impl((fq_impl)i);
+				scheme.set_fast_G1(true);
+				report.measure("G1_pow_fast",std::string("impl=") + fq_names[i],[&]() { scheme.pow_G1(g1_out,g1,z); });
+				report.measure("G1_pow_fast_batch",std::string("n=8 impl=") + fq_names[i],[&]() { scheme.pow_G1_batch(&power_ptrs[0],&g1_ptrs[0],z,pow_count); });
+			}
+		}
+		fq_set_impl(default_fq);
+		scheme.set_fast_G1(true);
+		for (int k=0;k<pow_count;k++)
+		{
+			element_clear(&powers[k]);
+		}
+	}
+	report.measure("GT_pow_zn","",[&]() { element_pow_zn(gt_out,gt,z); });
+
+	element_pp_t g1_pp;
+	element_pp_init(g1_pp,g1);
+	report.measure("G1_pp_pow_zn","",[&]() { element_pp_pow_zn(g1_out,z,g1_pp); });
+	element_pp_clear(g1_pp);
+
+	// the fixed arguments of the scheme, with and without their precomputed miller loops
+	report.measure("pairing","arg=g",[&]() { element_pairing(gt_out,g1,scheme.get_g()); });
+	report.measure("pairing_pp","arg=g",[&]() { scheme.pair_with_g(gt_out,g1); });
+	report.measure("pairing","arg=v",[&]() { element_pairing(gt_out,g1,p.get_v()); });
+	report.measure("pairing_pp","arg=v",[&]() { p.pair_with_v(gt_out,g1); });
+	report.measure("pairing","arg=spk",[&]() { element_pairing(gt_out,g1,p.get_spk()); });
+	report.measure("pairing_pp","arg=spk",[&]() { p.pair_with_spk(gt_out,g1); });
+
+	hasher.cleanup();
+	element_clear(z);
+	element_clear(gt_out);
+	element_clear(gt);
+	element_clear(g1_out);
+	element_clear(g1);
+}
+
+// the product of powers loop that the scheme used to run against multi_pow_zn
+static void bench_multiexp(bench_report &report, scheme_parameters &scheme, unsigned int max_terms)
+{
+	for (unsigned int n=16;n<=max_terms;n*=4)
+	{
+		std::vector<element_s> bases(n);
+		std::vector<element_s> exps(n);
+		std::vector<element_s*> bp(n);
+		std::vector<element_s*> ep(n);
+		for (int i=0;i<n;i++)
+		{
+			element_init_G1(&bases[i],scheme.get_pairing());
+			element_random(&bases[i]);
+			element_init_Zr(&exps[i],scheme.get_pairing());
+			element_random(&exps[i]);
+			bp[i] = &bases[i];
+			ep[i] = &exps[i];
+		}
+
+		element_t loop,multi,t0;
+		element_init_G1(loop,scheme.get_pairing());
+		element_init_G1(multi,scheme.get_pairing());
+		element_init_G1(t0,scheme.get_pairing());
+
+		std::string config = "terms=" + std::to_string(n);
+		report.measure("pow_loop",config,[&]()
+		{
+			element_set1(loop);
+			for (int i=0;i<n;i++)
+			{
+				element_pow_zn(t0,&bases[i],&exps[i]);
+				element_mul(loop,loop,t0);
+			}
+		});
+		report.measure("multi_pow_zn",config,[&]() { multi_pow_zn(multi,&bp[0],&ep[0],n); });
+
+		if (element_cmp(loop,multi))
+		{
+			throw std::runtime_error("multi_pow_zn disagrees with the loop");
+		}
+
+		element_clear(t0);
+		element_clear(multi);
+		element_clear(loop);
+		for (int i=0;i<n;i++)
+		{
+			element_clear(&bases[i]);
+			element_clear(&exps[i]);
+		}
+	}
+}
+
+// each protocol step for one file size and block size
+static void bench_protocol(bench_report &report, scheme_parameters &scheme, secret_parameters &s, unsigned int size, unsigned int block_size,
+	const std::vector<unsigned int> &challenge_sizes, const std::vector<unsigned int> &thread_counts, unsigned int seed, unsigned int reps)
+{
+	public_parameters p;
+	p.init(scheme,s,public_parameters::sectors_for_block(scheme,block_size));
+	seeded_file f(size,block_size,seed);
+	std::string file_config = "size=" + std::to_string(size) + " block=" + std::to_string(block_size);
+
+	verification_metadata vmd;
+	for (int t=0;t<thread_counts.size();t++)
+	{
+		report.measure("sig_gen",file_config + " threads=" + std::to_string(thread_counts[t]) + " tag_bytes=" + std::to_string(scheme.get_sig_len()),
+			[&]() { sig_gen(vmd,s,p,scheme,f,thread_counts[t]); },
+			[&]() { vmd.cleanup(); },reps);
+	}
+
+	for (int k=0;k<challenge_sizes.size();k++)
+	{
+		unsigned int c_size = std::min(challenge_sizes[k],f.get_chunk_count());
+		std::string config = file_config + " c=" + std::to_string(c_size);
+		challenge chal;
+		response_proof rp;
+		bool valid = true;
+
+		report.measure("gen_challenge",config + " mode=explicit",
+			[&]() { gen_challenge(chal,scheme,c_size,f.get_chunk_count()); },
+			[&]() { chal.cleanup(); },reps);
+		report.measure("gen_challenge",config + " mode=seeded",
+			[&]() { gen_seeded_challenge(chal,scheme,c_size,f.get_chunk_count()); },
+			[&]() { chal.cleanup(); },reps);
+		report.measure("gen_proof",config,
+			[&]() { gen_proof(rp,chal,vmd,p,scheme,f); },
+			[&]() { rp.cleanup(); },reps);
+		report.measure("verify_proof",config,
+			[&]() { valid = verify_proof(rp,chal,vmd,p,scheme) && valid; },
+			std::function<void()>(),reps);
+
+		if (!valid)
+		{
+			throw std::runtime_error("Benchmarked proof didn't verify");
+		}
+		rp.cleanup();
+		chal.cleanup();
+	}
+
+	vmd.cleanup();
+	p.cleanup();
+}
+
+int main(int argc,char *argv[])
+{
+	std::streambuf *out_buf = std::cout.rdbuf();
+	try {
+
+	// usage: [-pparam_file | -ycurves] [-rseed] [-kreps] [-ereps_end_to_end] [-nmax_terms]
+	//        [-ssizes] [-bblock_sizes] [-cchallenge_sizes] [-tthread_counts]
+	//        [-fcsv|json] [-ooutput_file] [-xsuites, any of p (primitives), m (multiexp), e (end to end)]
+	// lists are comma separated
+
+	char *params = 0;
+	unsigned int seed = 1;
+	unsigned int reps = 20;
+	unsigned int e2e_reps = 3;
+	unsigned int max_terms = 4096;
+	std::vector<unsigned int> sizes(1,100000);
+	std::vector<unsigned int> block_sizes(1,4000);
+	std::vector<unsigned int> challenge_sizes(1,460);
+	std::vector<unsigned int> thread_counts(1,1);
+	std::string format = "csv";
+	const char *output_file = 0;
+	std::string suites = "pme";
+	std::vector<curve_type> curves(1,curve_a);
+
+	for (int i=1;i<argc;i++)
+	{
+		if (argv[i][0] == '-')
+		{
+			switch (argv[i][1])
+			{
+			case 'p':
+				params = read_params(&argv[i][2]);
+				break;
+			case 'r':
+				seed = atoi(&argv[i][2]);
+				break;
+			case 'k':
+				reps = atoi(&argv[i][2]);
+				break;
+			case 'e':
+				e2e_reps = atoi(&argv[i][2]);
+				break;
+			case 'n':
+				max_terms = atoi(&argv[i][2]);
+				break;
+			case 's':
+				sizes = parse_list(&argv[i][2]);
+				break;
+			case 'b':
+				block_sizes = parse_list(&argv[i][2]);
+				break;
+			case 'c':
+				challenge_sizes = parse_list(&argv[i][2]);
+				break;
+			case 't':
+				thread_counts = parse_list(&argv[i][2]);
+				break;
+			case 'f':
+				format = &argv[i][2];
+				break;
+			case 'o':
+				output_file = &argv[i][2];
+				break;
+			case 'x':
+				suites = &argv[i][2];
+				break;
+			case 'y':
+			{
+				curves.clear();
+				std::stringstream ss(&argv[i][2]);
+				std::string item;
+				while (std::getline(ss,item,','))
+				{
+					curves.push_back(get_curve_type(item.c_str()));
+				}
+				break;
+			}
+			}
+		}
+	}
+
+	// the library logs progress to cout, keep it out of the report
+	std::ofstream null_stream;
+	std::cout.rdbuf(null_stream.rdbuf());
+
+	bench_report report(reps);
+
+	// a parameter file fixes the curve, otherwise each requested curve is generated
+	if (params)
+	{
+		curves.resize(1);
+	}
+	for (int c=0;c<curves.size();c++)
+	{
+		pbc_random_set_deterministic(seed);
+
+		scheme_parameters scheme;
+		scheme.init(params,curves[c]);
+		secret_parameters s;
+		public_parameters p;
+		s.init(scheme);
+		p.init(scheme,s);
+
+		report.set_context(params ? "" : std::string("curve=") + get_curve_name(curves[c]));
+
+		if (suites.find('p') != std::string::npos)
+		{
+			bench_primitives(report,scheme,p);
+		}
+		if (suites.find('m') != std::string::npos)
+		{
+			bench_multiexp(report,scheme,max_terms);
+		}
+		if (suites.find('e') != std::string::npos)
+		{
+			for (int i=0;i<sizes.size();i++)
+			{
+				for (int j=0;j<block_sizes.size();j++)
+				{
+					bench_protocol(report,scheme,s,sizes[i],block_sizes[j],challenge_sizes,thread_counts,seed,e2e_reps);
+				}
+			}
+		}
+
+		p.cleanup();
+		s.cleanup();
+		scheme.cleanup();
+	}
+	delete[] params;
+
+	std::cout.rdbuf(out_buf);
+	std::ofstream file_out;
+	if (output_file)
+	{
+		file_out.open(output_file);
+		if (!file_out)
+		{
+			throw std::runtime_error(std::string("Unable to open ") + output_file);
+		}
+	}
+	std::ostream &out = output_file ? file_out : std::cout;
+	if (format == "json")
+	{
+		report.write_json(out,seed);
+	}
+	else
+	{
+		report.write_csv(out);
+	}
+
+	} catch (const std::exception &e)
+	{
+		std::cout.rdbuf(out_buf);
+		std::cout << "Unhandled std::exception: " << e.what() << std::endl;
+		return 1;
+	}
+	return 0;
+}
@@ -1,31 +1,159 @@
 #include <cryptopp/sha.h>
 
 #include "core.h"
+#include "multiexp.h"
+#include "serial.h"
+#include "tag_store.h"
+#include "hw_cache.h"
+#include "mask_pool.h"
+#include "instrument.h"
+#include "scratch.h"
+#include "sha256.h"
+#include "type_a.h"
 
-#include <iostream>
+#include <algorithm>
+#include <stdexcept>
+#include <stdio.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <cstring>
+#include <cmath>
+#include <chrono>
 
 namespace pbpdp
 {
 
-void scheme_parameters::init(char *params)
+// number of chunks a sig_gen worker claims at a time
+static const unsigned int authenticator_grain = 16;
+// size of the random weights used to combine proofs in verify_proof_batch
+static const unsigned int batch_weight_bits = 64;
+// verification_metadata serialization flags
+static const unsigned char metadata_has_tags = 1;
+static const unsigned char metadata_has_ids = 2;
+// challenge pairs are expanded and multi-exponentiated this many at a time
+static const unsigned int challenge_batch = 4096;
+// the prover works in smaller batches, at least four for a challenge when they can be
+// proof_min_batch long, so its reader overlaps the arithmetic even for a few hundred
+// pairs.  the reader runs up to proof_depth batches ahead
+static const unsigned int proof_batch = 256;
+static const unsigned int proof_min_batch = 64;
+static const unsigned int proof_depth = 3;
+// rounds of the feistel network behind seeded challenge indices
+static const unsigned int feistel_rounds = 4;
+// challenged chunks at most this far apart are prefetched as one range
+static const unsigned int prefetch_gap = 8;
+// messages hashed to G1 together
+static const unsigned int hash_batch = 64;
+// challenge sizes and timing runs calibrate_challenge_costs fits its line through
+static const unsigned int calibrate_small_challenge = 64;
+static const unsigned int calibrate_large_challenge = 512;
+static const unsigned int calibrate_reps = 3;
+
+// what the prover and verifier keep in each slot of the thread's scratch
+enum
+{
+	g1_temp = scratch_first_slot,	// 2 temporaries
+	g1_HW,			// H(W_i), one batch
+	g1_batch_tags	// tags read from a tag store, for each of the prover's batches
+};
+enum
+{
+	zr_r = scratch_first_slot,	// r_j, one per sector
+	zr_gamma,
+	zr_v,			// challenge coefficients for the verifier, one batch
+	zr_batch_v		// and each of the prover's batches
+};
+enum
+{
+	mpz_temp = scratch_first_slot,	// 2 temporaries
+	mpz_mu_prime,	// one per sector
+	mpz_batch_chunk	// chunks for each of the prover's batches
+};
+enum
+{
+	uint_index = scratch_first_slot,	// block positions for the verifier, one batch
+	uint_batch			// index and order for each of the prover's batches
+};
+enum
+{
+	pointers_bases = scratch_first_slot,
+	pointers_exps,
+	pointers_batch_tags	// tag pointers for each of the prover's batches
+};
+enum
+{
+	bytes_W = scratch_first_slot	// W buffers for the verifier, one batch
+};
+
+// scheme_parameters ids, so scratch can tell schemes apart even at a reused address
+static std::atomic<unsigned int> next_scheme_id(1);
+
+// pbc only writes parameters to a FILE, so capture them in memory
+static std::string param_to_string(pbc_param_t params)
+{
+	char *buf = 0;
+	size_t len = 0;
+	FILE *f = open_memstream(&buf,&len);
+	if (!f)
+	{
+		throw std::runtime_error("Unable to write pairing parameters.");
+	}
+	pbc_param_out_str(f,params);
+	fclose(f);
+	std::string str(buf,len);
+	free(buf);
+	return str;
+}
+
+static const char *curve_names[] = { "a", "a1", "d", "e", "f" };
+
+curve_type get_curve_type(const char *name)
+{
+	for (int i=0;i<sizeof(curve_names)/sizeof(curve_names[0]);i++)
+	{
+		if (!strcmp(name,curve_names[i]))
+		{
+			return (curve_type)i;
+		}
+	}
+	throw std::runtime_error(std::string("Unknown curve type ") + name);
+}
+
+const char* get_curve_name(curve_type curve)
+{
+	return curve_names[curve];
+}
+
+// takes the first curve the CM search finds
+static int take_d_curve(pbc_cm_ptr cm, void *data)
+{
+	pbc_param_init_d_gen((pbc_param_ptr)data,cm);
+	return 1;
+}
+
+void scheme_parameters::init(char *params, curve_type curve)
 {	
+	_L_available = false;
 	if (params)
 	{
-		pbc_param_init_set_str(_params,params);
+		if (pbc_param_init_set_str(_params,params))
+		{
+			throw std::runtime_error("Invalid pairing parameters.");
+		}
+		_param_str = params;
 	}
 	else
 	{
-		if (1)
+		PBPDP_TRACE("Generating " << get_curve_name(curve) << " parameters.");
+		switch (curve)
 		{
-			std::cout << "Generating A parameters." << std::endl;
-			_L_available = false;
+		case curve_a:
 			pbc_param_init_a_gen(_params,160,512);
-			
-			std::cout << "Finished generating parameters." << std::endl;
-		}
-		else
+			break;
+		case curve_a1:
 		{
-			std::cout << "Generating A1 parameters." << std::endl;
 			mpz_t p,q,N;
 			mpz_init(p);
 			mpz_init(q);
@@ -41,527 +169,2443 @@ void scheme_parameters::init(char *params)
 			mpz_add_ui(_L,_L,1);
 			
 			pbc_param_init_a1_gen(_params,N);
-			std::cout << "Finished generating parameters." << std::endl;
+			_L_available = true;
+			mpz_clear(N);
+			mpz_clear(q);
+			mpz_clear(p);
+			break;
 		}
+		case curve_d:
+			// discriminant of pbc's standard d159 curve
+			if (!pbc_cm_search_d(take_d_curve,_params,9563,500))
+			{
+				throw std::runtime_error("No D curve found.");
+			}
+			break;
+		case curve_e:
+			pbc_param_init_e_gen(_params,160,1024);
+			break;
+		case curve_f:
+			pbc_param_init_f_gen(_params,160);
+			break;
+		default:
+			throw std::runtime_error("Unknown curve type.");
+		}
+		PBPDP_TRACE("Finished generating parameters.");
+		_param_str = param_to_string(_params);
 	}
 	
-	pairing_init_pbc_param(_pairing,_params);
+	init_pairing();
 	element_init_G2(_g,_pairing);
 	element_random(_g);
-	_name_length = pairing_length_in_bytes_Zr(_pairing);
-	_sig_length = pairing_length_in_bytes_x_only_G1(_pairing);
 	_initialized = true;
+	precompute();
+}
+
+void scheme_parameters::precompute()
+{
+	// pairing_pp preprocesses the first argument, but g is always the second, so this
+	// relies on e(a,g) = e(g,a)
+	if (pairing_is_symmetric(_pairing))
+	{
+		pairing_pp_init(_g_pp,_g,_pairing);
+		_g_pp_ready = true;
+	}
+}
+
+void scheme_parameters::pair_with_g(element_t out, element_t a)
+{
+	PBPDP_COUNT(counter_pairings,1);
+	if (_g_pp_ready)
+	{
+		pairing_pp_apply(out,a,_g_pp);
+	}
+	else
+	{
+		element_pairing(out,a,_g);
+	}
+}
+
+void scheme_parameters::init_pairing()
+{
+	pairing_init_pbc_param(_pairing,_params);
+	_id = next_scheme_id++;
+	_name_length = pairing_length_in_bytes_Zr(_pairing);
+	_sig_length = pairing_length_in_bytes_compressed_G1(_pairing);
+	set_fast_G1(true);
+}
+
+void scheme_parameters::set_fast_G1(bool enabled)
+{
+	delete _fast_G1;
+	_fast_G1 = 0;
+	if (enabled)
+	{
+		_fast_G1 = new type_a_g1();
+		if (!_fast_G1->init(_param_str.c_str(),_pairing))
+		{
+			delete _fast_G1;
+			_fast_G1 = 0;
+		}
+	}
+}
+
+void scheme_parameters::pow_G1(element_t out, element_t in, element_t e)
+{
+	if (!_fast_G1)
+	{
+		element_pow_zn(out,in,e);
+		return;
+	}
+	mpz_t z;
+	mpz_init(z);
+	element_to_mpz(z,e);
+	_fast_G1->pow(out,in,z);
+	mpz_clear(z);
+}
+
+void scheme_parameters::pow_G1_batch(element_s *const *out, element_s *const *in, element_t e, unsigned int n)
+{
+	if (!_fast_G1)
+	{
+		for (int k=0;k<n;k++)
+		{
+			element_pow_zn(out[k],in[k],e);
+		}
+		return;
+	}
+	mpz_t z;
+	mpz_init(z);
+	element_to_mpz(z,e);
+	_fast_G1->pow_batch(out,in,z,n);
+	mpz_clear(z);
 }
 
 void scheme_parameters::cleanup()
 {
-	element_clear(_g);
-	pairing_clear(_pairing);
-	_initialized = false;
+	if (_initialized)
+	{
+		if (_g_pp_ready)
+		{
+			pairing_pp_clear(_g_pp);
+			_g_pp_ready = false;
+		}
+		element_clear(_g);
+		delete _fast_G1;
+		_fast_G1 = 0;
+		if (_L_available)
+		{
+			mpz_clear(_L);
+			_L_available = false;
+		}
+		scratch::release(*this);
+		pairing_clear(_pairing);
+		_id = 0;
+		pbc_param_clear(_params);
+		_initialized = false;
+	}
+}
+
+unsigned int scheme_parameters::get_serialized_size() const
+{
+	return serial_header_size + sizeof(unsigned int) + _param_str.size() + pairing_length_in_bytes_compressed_G2(const_cast<pairing_s*>(_pairing));
+}
+
+void scheme_parameters::serialize(unsigned char *data,unsigned int size) const
+{
+	serial_writer w(data,size);
+	w.put_header(serial_scheme_parameters);
+	w.put_u32(_param_str.size());
+	w.put_bytes((const unsigned char*)_param_str.data(),_param_str.size());
+	w.put_element_compressed(_g);
+}
+
+void scheme_parameters::deserialize(unsigned char *data,unsigned int size)
+{
+	serial_reader r(data,size);
+	r.get_header(serial_scheme_parameters);
+	unsigned int len = r.get_u32();
+	std::string param_str((const char*)r.get_bytes(len),len);
+	
+	cleanup();
+	
+	if (pbc_param_init_set_str(_params,param_str.c_str()))
+	{
+		throw std::runtime_error("Invalid pairing parameters.");
+	}
+	_param_str = param_str;
+	_L_available = false;
+	
+	init_pairing();
+	element_init_G2(_g,_pairing);
+	_initialized = true;
+	r.get_element_compressed(_g);
+	precompute();
 }
 
 void secret_parameters::init(scheme_parameters &scheme)
 {
-	std::cout << "Initializing secret_parameters..." << std::endl;
+	PBPDP_TRACE("Initializing secret_parameters...");
 	// for BLS signature
 	element_init_Zr(_ssk,scheme.get_pairing());
 	element_random(_ssk);
 	// for PDP scheme
 	element_init_Zr(_x,scheme.get_pairing());
 	element_random(_x);
+	_scheme = &scheme;
 	_initialized = true;
 }
 
 void secret_parameters::cleanup()
 {
-	element_clear(_ssk);
-	element_clear(_x);
-	_initialized = false;
+	if (_initialized)
+	{
+		element_clear(_ssk);
+		element_clear(_x);
+		_initialized = false;
+	}
+}
+
+void secret_parameters::swap(secret_parameters &other)
+{
+	std::swap(_initialized,other._initialized);
+	std::swap(_scheme,other._scheme);
+	std::swap(_ssk,other._ssk);
+	std::swap(_x,other._x);
+}
+
+unsigned int secret_parameters::get_serialized_size() const
+{
+	return serial_header_size + 2*pairing_length_in_bytes_Zr(_scheme->get_pairing());
+}
+
+void secret_parameters::serialize(unsigned char *data,unsigned int size) const
+{
+	serial_writer w(data,size);
+	w.put_header(serial_secret_parameters);
+	w.put_element(_ssk);
+	w.put_element(_x);
+}
+
+void secret_parameters::deserialize(unsigned char *data,unsigned int size)
+{
+	if (!_scheme)
+	{
+		throw std::runtime_error("secret_parameters: no scheme to deserialize with");
+	}
+	
+	serial_reader r(data,size);
+	r.get_header(serial_secret_parameters);
+	if (size < get_serialized_size())
+	{
+		throw std::runtime_error("secret_parameters: truncated");
+	}
+	
+	if (!_initialized)
+	{
+		element_init_Zr(_ssk,_scheme->get_pairing());
+		element_init_Zr(_x,_scheme->get_pairing());
+		_initialized = true;
+	}
+	r.get_element(_ssk);
+	r.get_element(_x);
 }
 
-void public_parameters::init(scheme_parameters &scheme,secret_parameters &sp)
+void public_parameters::init(scheme_parameters &scheme,secret_parameters &sp,unsigned int sectors)
 {
-	std::cout << "Initializing public_parameters..." << std::endl;
+	PBPDP_TRACE("Initializing public_parameters...");
+	_scheme = &scheme;
 	// for BLS signature
 	element_init_G2(_spk,scheme.get_pairing());
 	element_pow_zn(_spk,scheme.get_g(),sp.get_ssk());
 	// for PDP scheme
-	element_init_G1(_u,scheme.get_pairing());
-	element_random(_u);
+	allocate_sectors(sectors > 0 ? sectors : 1);
+	for (int j=0;j<_sectors;j++)
+	{
+		element_random(&_u[j]);
+	}
 	element_init_G2(_v,scheme.get_pairing());
 	element_pow_zn(_v,scheme.get_g(),sp.get_x());
 	
-	element_init_GT(_euv,scheme.get_pairing());
-	element_pairing(_euv,_u,_v);
+	precompute();
 	_initialized = true;
 }
 
+void public_parameters::allocate_sectors(unsigned int sectors)
+{
+	_sectors = sectors;
+	_sector_bits = get_sector_bits(*_scheme);
+	_u = new element_s[_sectors];
+	_u_pp = new element_pp_s[_sectors];
+	for (int j=0;j<_sectors;j++)
+	{
+		element_init_G1(&_u[j],_scheme->get_pairing());
+	}
+}
+
+void public_parameters::clear_sectors()
+{
+	for (int j=0;j<_sectors;j++)
+	{
+		element_clear(&_u[j]);
+	}
+	delete[] _u_pp;
+	delete[] _u;
+	_sectors = 0;
+}
+
+void public_parameters::precompute()
+{
+	PBPDP_TRACE("Precomputing " << _sectors << " sector generators...");
+	for (int j=0;j<_sectors;j++)
+	{
+		element_pp_init(&_u_pp[j],&_u[j]);
+	}
+	// as with g, this needs e(a,v) = e(v,a)
+	if (pairing_is_symmetric(_scheme->get_pairing()))
+	{
+		pairing_pp_init(_v_pp,_v,_scheme->get_pairing());
+		pairing_pp_init(_spk_pp,_spk,_scheme->get_pairing());
+		_pairing_pp_ready = true;
+	}
+}
+
+void public_parameters::clear_precomputed()
+{
+	for (int j=0;j<_sectors;j++)
+	{
+		element_pp_clear(&_u_pp[j]);
+	}
+	if (_pairing_pp_ready)
+	{
+		pairing_pp_clear(_v_pp);
+		pairing_pp_clear(_spk_pp);
+		_pairing_pp_ready = false;
+	}
+}
+
+void public_parameters::pair_with_v(element_t out, element_t a)
+{
+	PBPDP_COUNT(counter_pairings,1);
+	if (_pairing_pp_ready)
+	{
+		pairing_pp_apply(out,a,_v_pp);
+	}
+	else
+	{
+		element_pairing(out,a,_v);
+	}
+}
+
+void public_parameters::pair_with_spk(element_t out, element_t a)
+{
+	PBPDP_COUNT(counter_pairings,1);
+	if (_pairing_pp_ready)
+	{
+		pairing_pp_apply(out,a,_spk_pp);
+	}
+	else
+	{
+		element_pairing(out,a,_spk);
+	}
+}
+
 void public_parameters::cleanup()
 {
-	element_clear(_spk);
-	element_clear(_u);
-	element_clear(_v);
-	element_clear(_euv);
-	_initialized = false;
+	if (_initialized)
+	{
+		element_clear(_spk);
+		clear_precomputed();
+		clear_sectors();
+		element_clear(_v);
+		_initialized = false;
+	}
+}
+
+void public_parameters::swap(public_parameters &other)
+{
+	std::swap(_initialized,other._initialized);
+	std::swap(_scheme,other._scheme);
+	std::swap(_spk,other._spk);
+	std::swap(_u,other._u);
+	std::swap(_u_pp,other._u_pp);
+	std::swap(_sectors,other._sectors);
+	std::swap(_sector_bits,other._sector_bits);
+	std::swap(_v,other._v);
+	std::swap(_v_pp,other._v_pp);
+	std::swap(_spk_pp,other._spk_pp);
+	std::swap(_pairing_pp_ready,other._pairing_pp_ready);
 }
 
-void verification_metadata::init(secret_parameters &s, public_parameters &p, scheme_parameters &scheme, file &f)
+unsigned int public_parameters::get_serialized_size() const
 {
-	std::cout << "Initializing verification_metadata..." << std::endl;
+	pairing_s *pairing = _scheme->get_pairing();
+	return serial_header_size + 2*pairing_length_in_bytes_compressed_G2(pairing) + sizeof(unsigned int) + _sectors*pairing_length_in_bytes_compressed_G1(pairing);
+}
+
+void public_parameters::serialize(unsigned char *data,unsigned int size) const
+{
+	serial_writer w(data,size);
+	w.put_header(serial_public_parameters);
+	w.put_u32(_sectors);
+	w.put_element_compressed(_spk);
+	w.put_element_compressed(_v);
+	for (int j=0;j<_sectors;j++)
+	{
+		w.put_element_compressed(&_u[j]);
+	}
+}
+
+void public_parameters::deserialize(unsigned char *data,unsigned int size)
+{
+	if (!_scheme)
+	{
+		throw std::runtime_error("public_parameters: no scheme to deserialize with");
+	}
 	
-	_hasher.init(scheme);
+	serial_reader r(data,size);
+	r.get_header(serial_public_parameters);
+	unsigned int sectors = r.get_u32();
 	
-	unsigned int count = f.get_chunk_count();
-	allocate_authenticators(count,scheme);
-	element_t t0;
-	element_t t1;
-	element_t z0;
-	//mpz_t z0;
-	mpz_t z1;
+	// check everything is there before touching any state
+	pairing_s *pairing = _scheme->get_pairing();
+	unsigned int fixed = serial_header_size + sizeof(unsigned int) + 2*pairing_length_in_bytes_compressed_G2(pairing);
+	if (sectors == 0 || size < fixed || (size - fixed) / pairing_length_in_bytes_compressed_G1(pairing) < sectors)
+	{
+		throw std::runtime_error("public_parameters: truncated or bad sector count");
+	}
 	
-	element_init_G1(t0,scheme.get_pairing());
-	element_init_G1(t1,scheme.get_pairing());
-	element_init_Zr(z0,scheme.get_pairing());
-	//mpz_init(z0);
-	mpz_init(z1);
+	// reuse the elements we already have where we can
+	if (_initialized)
+	{
+		clear_precomputed();
+		if (sectors != _sectors)
+		{
+			clear_sectors();
+			allocate_sectors(sectors);
+		}
+	}
+	else
+	{
+		element_init_G2(_spk,pairing);
+		element_init_G2(_v,pairing);
+		allocate_sectors(sectors);
+		_initialized = true;
+	}
+	
+	r.get_element_compressed(_spk);
+	r.get_element_compressed(_v);
+	for (int j=0;j<_sectors;j++)
+	{
+		r.get_element_compressed(&_u[j]);
+	}
 	
-	bool eulers_theorem_opt = false;
+	precompute();
+}
+
+void public_parameters::get_sector(mpz_t out, mpz_t m, unsigned int j) const
+{
+	// sector j holds bits [j*b,(j+1)*b) of the chunk.  the last sector takes everything
+	// above that too, so a chunk larger than its sectors is still fully bound by the tag
+	mpz_tdiv_q_2exp(out,m,j*_sector_bits);
+	if (j+1 < _sectors)
+	{
+		mpz_tdiv_r_2exp(out,out,_sector_bits);
+	}
+}
+
+void public_parameters::pow_u(g1_element &out, mpz_t m, g1_element &t, mpz_value &z)
+{
+	PBPDP_COUNT(counter_g1_exps,_sectors);
+	element_set1(out.get());
+	for (int j=0;j<_sectors;j++)
+	{
+		get_sector(z.get(),m,j);
+		if (mpz_sizeinbase(z.get(),2) <= _sector_bits)
+		{
+			element_pp_pow(t.get(),z.get(),&_u_pp[j]);
+		}
+		else
+		{
+			// oversized last sector (single sector mode with large chunks)
+			element_pow_mpz(t.get(),&_u[j],z.get());
+		}
+		element_mul(out.get(),out.get(),t.get());
+	}
+}
+
+unsigned int public_parameters::get_sector_bits(scheme_parameters &scheme)
+{
+	// keep every sector strictly below the group order
+	return mpz_sizeinbase(scheme.get_pairing()->r,2) - 1;
+}
+
+unsigned int public_parameters::sectors_for_block(scheme_parameters &scheme, unsigned int block_size)
+{
+	unsigned int bits = get_sector_bits(scheme);
+	unsigned int sectors = (block_size*8 + bits - 1) / bits;
+	return sectors > 0 ? sectors : 1;
+}
+
+void verification_metadata::init(secret_parameters &s, public_parameters &p, scheme_parameters &scheme, file &f, unsigned int threads, const unsigned char *name)
+{
+	PBPDP_PHASE(phase_sig_gen);
+	PBPDP_TRACE("Initializing verification_metadata...");
 	
+	_scheme = &scheme;
+	_hasher.init(scheme);
 	
-	element_t name;
-	element_init_Zr(name,scheme.get_pairing());
-	element_random(name);
+	unsigned int count = f.get_chunk_count();
+	allocate_authenticators(count,scheme);
+	_dynamic = false;
+	_ids.clear();
+	_next_id = count;
+	init_name(scheme,name);
 	
-	_name_len = scheme.get_name_len();
-	_name = new unsigned char[_name_len];
-	_W_buffer = new unsigned char[get_W_size()];
-	memcpy(_W_buffer,_name,_name_len);
-	element_to_bytes(_name,name);
+	if (threads == 0)
+	{
+		threads = std::thread::hardware_concurrency();
+	}
+	unsigned int max_threads = (count + authenticator_grain - 1) / authenticator_grain;
+	if (threads > max_threads)
+	{
+		threads = max_threads;
+	}
 	
-	element_clear(name);
+	std::atomic<unsigned int> next(0);
 	
-	element_pp_t pp;
-	element_pp_init(pp,p.get_u());
+	f.set_access_hint(access_sequential);
 	
-	std::cout << "Calculating authenticators..." << std::endl;
-	// calculate each sigma_i = (H(W_i)*u^m_i)^x
-	for (int i=0;i<count;i++)
+	PBPDP_TRACE("Calculating authenticators...");
+	if (threads <= 1)
+	{
+		calculate_authenticators(s,p,scheme,f,next,0);
+	}
+	else
 	{
-		get_HWi(t0,i);
+		PBPDP_TRACE("Using " << threads << " threads.");
 		
-		f.get_chunk(z1,i);
-		//element_set_mpz(z0,z1);
+		// each worker claims ranges of chunks as it finishes the last, so a slow
+		// range on one thread doesn't hold up the others
+		std::mutex file_lock;
+		std::exception_ptr error;
+		std::mutex error_lock;
+		std::vector<std::thread> workers;
+		
+		for (int i=0;i<threads;i++)
+		{
+			workers.push_back(std::thread([&]()
+			{
+				try
+				{
+					calculate_authenticators(s,p,scheme,f,next,&file_lock);
+				}
+				catch (...)
+				{
+					std::lock_guard<std::mutex> lock(error_lock);
+					error = std::current_exception();
+					// make the other workers run out of ranges
+					next = count;
+				}
+			}));
+		}
 		
-		//element_pp_pow_zn(t1,z0,pp);
-		element_pow_mpz(t1,p.get_u(),z1);
+		for (int i=0;i<workers.size();i++)
+		{
+			workers[i].join();
+		}
 		
-		element_mul(t0,t0,t1);
-		element_pow_zn(&_authenticators[i],t0,s.get_x());
+		if (error)
+		{
+			std::rethrow_exception(error);
+		}
 	}
-	std::cout << "Authenticators calculated." << std::endl;
-	//element_pp_clear(pp);
-	
-	// generate name signature
-	element_t name_sig;
-	element_init_G1(name_sig,scheme.get_pairing());
-	
-	// signature is H(name)^ssk
-	get_Hname(t0);
-	
-	element_pow_zn(name_sig,t0,s.get_ssk());
-	
-	_name_sig_len = scheme.get_sig_len();
-	_name_sig = new unsigned char[_name_sig_len];
-	element_to_bytes_x_only(_name_sig,name_sig);
+	PBPDP_TRACE("Authenticators calculated.");
 	
-	element_clear(name_sig);
+	sign_name(s,scheme);
 	
-	element_clear(z0);
-	//mpz_clear(z0);
-	mpz_clear(z1);
-	element_clear(t1);
-	element_clear(t0);
+	_initialized = true;
+	PBPDP_TRACE("Verification metatdata initialized...");
+}
+
+void verification_metadata::init_name(scheme_parameters &scheme, const unsigned char *name)
+{
+	_name_len = scheme.get_name_len();
+	_name = new unsigned char[_name_len];
+	_W_buffer = new unsigned char[get_W_size()];
+	if (name)
+	{
+		memcpy(_name,name,_name_len);
+	}
+	else
+	{
+		zr_element e(scheme.get_pairing());
+		element_random(e.get());
+		element_to_bytes(_name,e.get());
+	}
+	init_W(_W_buffer);
+}
+
+void verification_metadata::sign_name(secret_parameters &s, scheme_parameters &scheme)
+{
+	g1_element t0(scheme.get_pairing());
+	g1_element name_sig(scheme.get_pairing());
+	
+	// signature is H(name)^ssk
+	get_Hname(t0.get());
+	
+	element_pow_zn(name_sig.get(),t0.get(),s.get_ssk());
+	
+	_name_sig_len = scheme.get_sig_len();
+	_name_sig = new unsigned char[_name_sig_len];
+	element_to_bytes_compressed(_name_sig,name_sig.get());
+}
+
+void verification_metadata::calculate_authenticators(secret_parameters &s, public_parameters &p, scheme_parameters &scheme, file &f, std::atomic<unsigned int> &next, std::mutex *file_lock)
+{
+	// element_hash and the W buffers are mutable scratch, so every worker gets its own
+	element_hash hasher;
+	std::vector<unsigned char> W(authenticator_grain*get_W_size());
+	element_block<group_G1> HW;
+	unsigned int positions[authenticator_grain];
+	element_s *tags[authenticator_grain];
+	g1_element t1(scheme.get_pairing());
+	g1_element t2(scheme.get_pairing());
+	mpz_value z1;
+	mpz_value z2;
+	
+	hasher.init(scheme);
+	HW.reserve(scheme.get_pairing(),authenticator_grain);
+	
+	// calculate each sigma_i = (H(W_i)*prod(u_j^m_ij))^x
+	for (unsigned int start = next.fetch_add(authenticator_grain);start < _count;start = next.fetch_add(authenticator_grain))
+	{
+		unsigned int end = start + authenticator_grain;
+		if (end > _count)
+		{
+			end = _count;
+		}
+		
+		// the range's H(W_i) are hashed together
+		for (unsigned int i=start;i<end;i++)
+		{
+			positions[i-start] = i;
+		}
+		get_HWi_batch(HW.get(),positions,end-start,hasher,&W[0]);
+		
+		for (unsigned int i=start;i<end;i++)
+		{
+			if (file_lock)
+			{
+				std::lock_guard<std::mutex> lock(*file_lock);
+				f.get_chunk(z1.get(),i);
+			}
+			else
+			{
+				f.get_chunk(z1.get(),i);
+			}
+			
+			p.pow_u(t1,z1.get(),t2,z2);
+			
+			tags[i-start] = &_authenticators[i];
+			element_mul(tags[i-start],HW[i-start],t1.get());
+		}
+		// raised to x together, the range shares the exponent
+		scheme.pow_G1_batch(tags,tags,s.get_x(),end-start);
+		PBPDP_COUNT(counter_chunks_read,end-start);
+		PBPDP_COUNT(counter_g1_exps,end-start);
+	}
+	
+	hasher.cleanup();
+}
+
+void verification_metadata::cleanup()
+{
+	if (_initialized)
+	{
+		delete[] _name;
+		delete[] _name_sig;
+		delete[] _W_buffer;
+		clear_authenticators();
+		_hasher.cleanup();
+		_initialized = false;
+	}
+}
+
+unsigned int verification_metadata::get_serialized_size() const
+{
+	unsigned int size = serial_header_size + 1 + 2*sizeof(unsigned int) + _name_len + _name_sig_len;
+	if (_dynamic)
+	{
+		size += (1 + _count)*sizeof(unsigned int);
+	}
+	if (_serialize_tags)
+	{
+		size += _count*pairing_length_in_bytes_compressed_G1(_scheme->get_pairing());
+	}
+	return size;
+}
+
+void verification_metadata::serialize(unsigned char *data,unsigned int size) const
+{
+	serial_writer w(data,size);
+	w.put_header(serial_verification_metadata);
+	w.put_u8((_serialize_tags ? metadata_has_tags : 0) | (_dynamic ? metadata_has_ids : 0));
+	w.put_u32(_count);
+	w.put_bytes(_name,_name_len);
+	w.put_bytes(_name_sig,_name_sig_len);
+	if (_dynamic)
+	{
+		w.put_u32(_next_id);
+		for (int i=0;i<_count;i++)
+		{
+			w.put_u32(_ids[i]);
+		}
+	}
+	if (!_serialize_tags)
+	{
+		return;
+	}
+	if (_authenticators)
+	{
+		for (int i=0;i<_count;i++)
+		{
+			w.put_element_compressed(&_authenticators[i]);
+		}
+	}
+	else
+	{
+		g1_element t(_scheme->get_pairing());
+		for (int i=0;i<_count;i++)
+		{
+			_store->get_tag(t.get(),i);
+			w.put_element_compressed(t.get());
+		}
+	}
+}
+
+void verification_metadata::deserialize(unsigned char *data,unsigned int size)
+{
+	if (!_scheme)
+	{
+		throw std::runtime_error("verification_metadata: no scheme to deserialize with");
+	}
+	
+	serial_reader r(data,size);
+	unsigned char version = r.get_header(serial_verification_metadata);
+	// version 3 added the flags, before that the tags were always there
+	unsigned char flags = version >= 3 ? r.get_u8() : metadata_has_tags;
+	bool has_tags = flags & metadata_has_tags;
+	bool has_ids = flags & metadata_has_ids;
+	unsigned int count = r.get_u32();
+	
+	// check everything is there before touching any state
+	unsigned int name_len = _scheme->get_name_len();
+	unsigned int name_sig_len = _scheme->get_sig_len();
+	unsigned int fixed = serial_header_size + (version >= 3 ? 1 : 0) + sizeof(unsigned int) + name_len + name_sig_len;
+	unsigned int per_block = (has_tags ? pairing_length_in_bytes_compressed_G1(_scheme->get_pairing()) : 0) + (has_ids ? sizeof(unsigned int) : 0);
+	if (has_ids)
+	{
+		fixed += sizeof(unsigned int);
+	}
+	if (size < fixed || (per_block && (size - fixed) / per_block < count))
+	{
+		throw std::runtime_error("verification_metadata: truncated data");
+	}
+	
+	if (_initialized)
+	{
+		delete[] _name;
+		delete[] _name_sig;
+		delete[] _W_buffer;
+		_hasher.cleanup();
+	}
+	
+	_hasher.init(*_scheme);
+	_name_len = name_len;
+	_name = new unsigned char[_name_len];
+	memcpy(_name,r.get_bytes(_name_len),_name_len);
+	_W_buffer = new unsigned char[get_W_size()];
+	init_W(_W_buffer);
+	_name_sig_len = name_sig_len;
+	_name_sig = new unsigned char[_name_sig_len];
+	memcpy(_name_sig,r.get_bytes(_name_sig_len),_name_sig_len);
+	
+	_dynamic = has_ids;
+	_ids.clear();
+	_next_id = count;
+	if (has_ids)
+	{
+		_next_id = r.get_u32();
+		_ids.resize(count);
+		for (int i=0;i<count;i++)
+		{
+			_ids[i] = r.get_u32();
+		}
+	}
+	
+	if (has_tags)
+	{
+		// tags are decoded straight into the existing elements when the count matches
+		if (!_authenticators || count != _count)
+		{
+			allocate_authenticators(count,*_scheme);
+		}
+		_store = 0;
+		for (int i=0;i<_count;i++)
+		{
+			r.get_element_compressed(&_authenticators[i]);
+		}
+	}
+	else
+	{
+		// keep an attached store if it still matches
+		tag_store *store = _store;
+		clear_authenticators();
+		_count = count;
+		if (store && store->get_count() == _count)
+		{
+			_store = store;
+		}
+	}
+	
+	_initialized = true;
+}
+
+void verification_metadata::allocate_authenticators(unsigned int count, scheme_parameters &scheme)
+{
+	PBPDP_TRACE("Allocating " << count << " authenticators...");
+	clear_authenticators();
+	_authenticators = new element_s[count];
+	PBPDP_TRACE("Finished allocating space... now initializing.");
+	for (int i=0;i<count;i++)
+	{
+		element_init_G1(&_authenticators[i],scheme.get_pairing());
+	}
+	_count = count;
+	PBPDP_TRACE("Authenticators allocated...");
+}
+
+void verification_metadata::clear_authenticators()
+{
+	if (_authenticators)
+	{
+		for (int i=0;i<_count;i++)
+		{
+			element_clear(&_authenticators[i]);
+		}
+		delete[] _authenticators;
+		_authenticators = 0;
+	}
+	_store = 0;
+	_count = 0;
+}
+
+element_s* verification_metadata::load_authenticator(unsigned int i, element_t scratch)
+{
+	if (i >= _count)
+	{
+		throw std::out_of_range("verification_metadata: block position out of range");
+	}
+	if (_authenticators)
+	{
+		return &_authenticators[i];
+	}
+	if (!_store)
+	{
+		throw std::runtime_error("verification_metadata: no authenticators loaded");
+	}
+	_store->get_tag(scratch,i);
+	return scratch;
+}
+
+void verification_metadata::prefetch_authenticators(unsigned int first, unsigned int count)
+{
+	if (!_authenticators && _store)
+	{
+		_store->prefetch_tags(first,count);
+	}
+}
+
+void verification_metadata::attach_tag_store(tag_store &store)
+{
+	if (_initialized && store.get_count() != _count)
+	{
+		throw std::runtime_error("verification_metadata: tag store doesn't match the metadata");
+	}
+	clear_authenticators();
+	_store = &store;
+	_count = store.get_count();
+}
+
+void verification_metadata::save_tags(const char *path)
+{
+	tag_store::write(path,*this,*_scheme);
+}
+
+bool verification_metadata::check_sig(public_parameters &p, scheme_parameters &scheme)
+{
+	PBPDP_PHASE(phase_check_sig);
+	PBPDP_TRACE("Checking signature...");
+	// now we know sig = H(name)^ssk and spk = g^ssk  we need to verify that e(sig,g) = e(H(name),spk)
+	
+	g1_element Hname(scheme.get_pairing());
+	g1_element name_sig(scheme.get_pairing());
+	
+	get_Hname(Hname.get());
+	element_from_bytes_compressed(name_sig.get(),_name_sig);
+	
+	gt_element p0(scheme.get_pairing());
+	gt_element p1(scheme.get_pairing());
+	
+	scheme.pair_with_g(p0.get(),name_sig.get());
+	p.pair_with_spk(p1.get(),Hname.get());
+	
+	// the signature is stored with its sign bit, so the pairings match exactly
+	bool sig_valid = !element_cmp(p0.get(),p1.get());
+	
+	PBPDP_TRACE((sig_valid ? "Sig valid." : "Sig not valid."));
+	
+	return sig_valid;
+}
+
+unsigned int verification_metadata::get_W_size() const
+{
+	return _name_len + sizeof(unsigned int);
+}
+
+void verification_metadata::append_index_to_W(unsigned int id) const
+{
+	*(unsigned int*)(_W_buffer+_name_len) = id;
+}
+
+unsigned int verification_metadata::get_block_id(unsigned int i) const
+{
+	if (i >= _count)
+	{
+		throw std::out_of_range("verification_metadata: block position out of range");
+	}
+	return _ids.empty() ? i : _ids[i];
+}
+
+void verification_metadata::init_W(unsigned char *W) const
+{
+	memcpy(W,_name,_name_len);
+}
+
+void verification_metadata::attach_hw_cache(hw_cache *cache)
+{
+	// entries carry no scheme, a point from another pairing would just fail verification
+	if (cache && (!_scheme || cache->get_scheme_id() != _scheme->get_id()))
+	{
+		throw std::runtime_error("verification_metadata: H(W_i) cache was made for another scheme");
+	}
+	_hw_cache = cache;
+}
+
+void verification_metadata::get_HWi(element_t e,unsigned int i) const
+{	
+	append_index_to_W(get_block_id(i));
+	
+	if (_hw_cache && _hw_cache->lookup(e,_W_buffer,get_W_size()))
+	{
+		return;
+	}
+	_hasher.hash_data_to_element(e,_W_buffer,get_W_size());
+	PBPDP_COUNT(counter_hash_to_g1,1);
+	if (_hw_cache)
+	{
+		_hw_cache->insert(_W_buffer,get_W_size(),e);
+	}
+}
+
+void verification_metadata::get_HWi(element_t e,unsigned int i,const element_hash &hasher,unsigned char *W) const
+{
+	*(unsigned int*)(W+_name_len) = get_block_id(i);
+	
+	if (_hw_cache && _hw_cache->lookup(e,W,get_W_size()))
+	{
+		return;
+	}
+	hasher.hash_data_to_element(e,W,get_W_size());
+	PBPDP_COUNT(counter_hash_to_g1,1);
+	if (_hw_cache)
+	{
+		_hw_cache->insert(W,get_W_size(),e);
+	}
+}
+
+void verification_metadata::get_HWi_batch(element_s *out,const unsigned int *positions,unsigned int n,const element_hash &hasher,unsigned char *W) const
+{
+	unsigned int W_size = get_W_size();
+	const unsigned char *misses[hash_batch];
+	element_s *miss_out[hash_batch];
+	for (unsigned int first=0;first<n;first+=hash_batch)
+	{
+		unsigned int count = n - first < hash_batch ? n - first : hash_batch;
+		unsigned int m = 0;
+		for (int k=first;k<first+count;k++)
+		{
+			unsigned char *Wk = W + k*W_size;
+			init_W(Wk);
+			*(unsigned int*)(Wk+_name_len) = get_block_id(positions[k]);
+			if (_hw_cache && _hw_cache->lookup(&out[k],Wk,W_size))
+			{
+				continue;
+			}
+			misses[m] = Wk;
+			miss_out[m] = &out[k];
+			m++;
+		}
+		
+		hasher.hash_data_to_elements(miss_out,misses,W_size,m);
+		PBPDP_COUNT(counter_hash_to_g1,m);
+		if (_hw_cache)
+		{
+			for (int k=0;k<m;k++)
+			{
+				_hw_cache->insert(misses[k],W_size,miss_out[k]);
+			}
+		}
+	}
+}
+
+void verification_metadata::get_HWi(mpz_t e,unsigned int i) const
+{
+	append_index_to_W(get_block_id(i));
+	
+	_hasher.hash_data_to_mpz(e,_W_buffer,get_W_size());
+}
+
+void verification_metadata::tag_block(element_t out, unsigned int id, mpz_t m, secret_parameters &s, public_parameters &p)
+{
+	g1_element t0(_scheme->get_pairing());
+	g1_element t1(_scheme->get_pairing());
+	g1_element t2(_scheme->get_pairing());
+	mpz_value z;
+	
+	// sigma = (H(name||id)*prod(u_j^m_j))^x
+	append_index_to_W(id);
+	_hasher.hash_data_to_element(t0.get(),_W_buffer,get_W_size());
+	PBPDP_COUNT(counter_hash_to_g1,1);
+	PBPDP_COUNT(counter_g1_exps,1);
+	p.pow_u(t1,m,t2,z);
+	element_mul(t0.get(),t0.get(),t1.get());
+	_scheme->pow_G1(out,t0.get(),s.get_x());
+}
+
+void verification_metadata::materialize_ids()
+{
+	_dynamic = true;
+	if (_ids.empty() && _count > 0)
+	{
+		_ids.resize(_count);
+		for (int i=0;i<_count;i++)
+		{
+			_ids[i] = i;
+		}
+	}
+}
+
+unsigned int verification_metadata::new_block_id()
+{
+	if (_next_id == 0xffffffffu)
+	{
+		throw std::runtime_error("verification_metadata: block ids exhausted, the file must be tagged again");
+	}
+	return _next_id++;
+}
+
+void verification_metadata::update_block(unsigned int i, mpz_t m, secret_parameters &s, public_parameters &p)
+{
+	if (!_authenticators || i >= _count)
+	{
+		throw std::runtime_error("verification_metadata: can't update that block");
+	}
+	
+	// a fresh id, so the old block and tag no longer verify at this position
+	materialize_ids();
+	_ids[i] = new_block_id();
+	tag_block(&_authenticators[i],_ids[i],m,s,p);
+}
+
+void verification_metadata::insert_block(unsigned int i, mpz_t m, secret_parameters &s, public_parameters &p)
+{
+	if (!_authenticators && _count > 0)
+	{
+		throw std::runtime_error("verification_metadata: dynamic operations need resident tags");
+	}
+	if (i > _count)
+	{
+		throw std::out_of_range("verification_metadata: insert position out of range");
+	}
+	
+	materialize_ids();
+	unsigned int id = new_block_id();
+	
+	element_s *authenticators = new element_s[_count+1];
+	if (_count > 0)
+	{
+		// elements are plain handles, so they can be moved with their storage
+		memcpy(authenticators,_authenticators,i*sizeof(element_s));
+		memcpy(authenticators+i+1,_authenticators+i,(_count-i)*sizeof(element_s));
+	}
+	delete[] _authenticators;
+	_authenticators = authenticators;
+	element_init_G1(&_authenticators[i],_scheme->get_pairing());
+	_ids.insert(_ids.begin()+i,id);
+	_count++;
+	
+	tag_block(&_authenticators[i],id,m,s,p);
+}
+
+void verification_metadata::append_block(mpz_t m, secret_parameters &s, public_parameters &p)
+{
+	insert_block(_count,m,s,p);
+}
+
+void verification_metadata::delete_block(unsigned int i)
+{
+	if (!_authenticators || i >= _count)
+	{
+		throw std::runtime_error("verification_metadata: can't delete that block");
+	}
+	
+	materialize_ids();
+	element_clear(&_authenticators[i]);
+	memmove(_authenticators+i,_authenticators+i+1,(_count-i-1)*sizeof(element_s));
+	_ids.erase(_ids.begin()+i);
+	_count--;
+}
+
+void verification_metadata::get_Hname(element_t e) const
+{
+	_hasher.hash_data_to_element(e,_name,_name_len);
+	PBPDP_COUNT(counter_hash_to_g1,1);
+}
+
+void verification_metadata::get_Hname(mpz_t e) const
+{
+	_hasher.hash_data_to_mpz(e, _name, _name_len);
+}
+
+void challenge::init(scheme_parameters &scheme, unsigned int c, unsigned int chunk_count)
+{
+	PBPDP_PHASE(phase_challenge);
+	PBPDP_TRACE("Initializing challenge...");
+	_scheme = &scheme;
+	if (c > 0)
+	{
+		allocate_pairs(c);
+		
+		mpz_t mpz_s;
+		mpz_t mpz_lim;
+		
+		mpz_init(mpz_s);
+		
+		mpz_init_set_ui(mpz_lim,chunk_count);
+		
+		
+		PBPDP_TRACE("Generating " << _count << " challenge pairs.");
+		for (int i=0;i<_count;i++)
+		{
+			// select a random element
+			pbc_mpz_random(mpz_s,mpz_lim);
+			
+			_pairs[i]._s = mpz_get_ui(mpz_s);
+			
+			//std::cout << "Challenge " << i << " checks block " << _pairs[i]._s << std::endl;
+			
+			// select a random challenge value
+			element_random(_pairs[i]._v);
+		}
+		
+		mpz_clear(mpz_lim);
+		mpz_clear(mpz_s);
+	}
+	PBPDP_TRACE("Challenge initialized.");
+}
+
+void challenge::init_seeded(scheme_parameters &scheme, unsigned int c, unsigned int chunk_count, const unsigned char *seed)
+{
+	PBPDP_PHASE(phase_challenge);
+	PBPDP_TRACE("Initializing seeded challenge...");
+	if (c > chunk_count)
+	{
+		throw std::runtime_error("challenge: a seeded challenge can't cover more than every chunk");
+	}
+	
+	cleanup();
+	_scheme = &scheme;
+	
+	if (seed)
+	{
+		memcpy(_seed,seed,seed_size);
+	}
+	else
+	{
+		mpz_t z;
+		mpz_init(z);
+		pbc_mpz_randomb(z,seed_size*8);
+		size_t count;
+		memset(_seed,0,seed_size);
+		mpz_export(_seed,&count,1,sizeof(unsigned char),0,0,z);
+		mpz_clear(z);
+	}
+	
+	_seeded = true;
+	_count = c;
+	_chunk_count = chunk_count;
+	
+	// smallest even bit width covering every chunk index
+	_half_bits = 1;
+	while (_half_bits < 16 && (1ull << (2*_half_bits)) < chunk_count)
+	{
+		_half_bits++;
+	}
+	
+	_initialized = true;
+	PBPDP_TRACE("Challenge initialized.");
+}
+
+unsigned int challenge::feistel_round(unsigned int round, unsigned int half) const
+{
+	CryptoPP::SHA256 sha256;
+	unsigned char in[seed_size+5];
+	unsigned char digest[CryptoPP::SHA256::DIGESTSIZE];
+	
+	memcpy(in,_seed,seed_size);
+	in[seed_size] = round;
+	in[seed_size+1] = half >> 24;
+	in[seed_size+2] = half >> 16;
+	in[seed_size+3] = half >> 8;
+	in[seed_size+4] = half;
+	sha256.CalculateDigest(digest,in,sizeof(in));
+	
+	unsigned int f = ((unsigned int)digest[0] << 24) | ((unsigned int)digest[1] << 16) | ((unsigned int)digest[2] << 8) | digest[3];
+	return f & ((1u << _half_bits) - 1);
+}
+
+unsigned int challenge::permute_index(unsigned int i) const
+{
+	// a feistel network is a permutation of [0,4^half_bits), walking the cycle until
+	// we land back inside [0,chunk_count) restricts it to a permutation of the chunks
+	unsigned int mask = (1u << _half_bits) - 1;
+	unsigned long long x = i;
+	do
+	{
+		unsigned int left = x >> _half_bits;
+		unsigned int right = x & mask;
+		for (int round=0;round<feistel_rounds;round++)
+		{
+			unsigned int t = right;
+			right = left ^ feistel_round(round,right);
+			left = t;
+		}
+		x = ((unsigned long long)left << _half_bits) | right;
+	} while (x >= _chunk_count);
+	return x;
+}
+
+bool challenge::fits(unsigned int chunk_count) const
+{
+	if (_seeded)
+	{
+		// the permutation only covers 0.._chunk_count-1
+		return _chunk_count <= chunk_count;
+	}
+	for (int i=0;i<_count;i++)
+	{
+		if (_pairs[i]._s >= chunk_count)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+void challenge::get_pair(unsigned int i, unsigned int &s, element_t v) const
+{
+	if (!_seeded)
+	{
+		s = _pairs[i]._s;
+		element_set(v,_pairs[i]._v);
+		return;
+	}
+	
+	s = permute_index(i);
 	
+	// v_i = H(seed || 'v' || i)
+	CryptoPP::SHA256 sha256;
+	unsigned char in[seed_size+5];
+	unsigned char digest[CryptoPP::SHA256::DIGESTSIZE];
+	
+	memcpy(in,_seed,seed_size);
+	in[seed_size] = 'v';
+	in[seed_size+1] = i >> 24;
+	in[seed_size+2] = i >> 16;
+	in[seed_size+3] = i >> 8;
+	in[seed_size+4] = i;
+	sha256.CalculateDigest(digest,in,sizeof(in));
+	
+	element_from_hash(v,digest,sizeof(digest));
+}
+
+void challenge::allocate_pairs(unsigned int c)
+{
+	_pairs = new pair[c];
+	_count = c;
+	for (int i=0;i<_count;i++)
+	{
+		element_init_Zr(_pairs[i]._v,_scheme->get_pairing());
+	}
 	_initialized = true;
-	std::cout << "Verification metatdata initialized..." << std::endl;
 }
 
-void verification_metadata::cleanup()
+void challenge::cleanup()
+{
+	if (_initialized)
+	{
+		if (!_seeded)
+		{
+			for (int i=0;i<_count;i++)
+			{
+				element_clear(_pairs[i]._v);
+			}
+			delete[] _pairs;
+			_pairs = 0;
+		}
+		_count = 0;
+		_seeded = false;
+		_initialized = false;
+	}
+}
+
+void challenge::swap(challenge &other)
+{
+	std::swap(_initialized,other._initialized);
+	std::swap(_scheme,other._scheme);
+	std::swap(_pairs,other._pairs);
+	std::swap(_count,other._count);
+	std::swap(_seeded,other._seeded);
+	std::swap(_seed,other._seed);
+	std::swap(_chunk_count,other._chunk_count);
+	std::swap(_half_bits,other._half_bits);
+}
+
+unsigned int challenge::get_serialized_size() const
+{
+	if (_seeded)
+	{
+		return serial_header_size + 1 + 2*sizeof(unsigned int) + seed_size;
+	}
+	return serial_header_size + 1 + sizeof(unsigned int) + _count*(sizeof(unsigned int) + pairing_length_in_bytes_Zr(_scheme->get_pairing()));
+}
+
+void challenge::serialize(unsigned char *data,unsigned int size) const
+{
+	serial_writer w(data,size);
+	w.put_header(serial_challenge);
+	w.put_u8(_seeded);
+	w.put_u32(_count);
+	if (_seeded)
+	{
+		w.put_u32(_chunk_count);
+		w.put_bytes(_seed,seed_size);
+		return;
+	}
+	for (int i=0;i<_count;i++)
+	{
+		w.put_u32(_pairs[i]._s);
+		w.put_element(_pairs[i]._v);
+	}
+}
+
+void challenge::deserialize(unsigned char *data,unsigned int size)
+{
+	if (!_scheme)
+	{
+		throw std::runtime_error("challenge: no scheme to deserialize with");
+	}
+	
+	serial_reader r(data,size);
+	unsigned char version = r.get_header(serial_challenge);
+	// version 1 only had explicit challenges and no mode byte
+	bool seeded = version >= 2 ? r.get_u8() : false;
+	unsigned int count = r.get_u32();
+	
+	if (seeded)
+	{
+		unsigned int chunk_count = r.get_u32();
+		init_seeded(*_scheme,count,chunk_count,r.get_bytes(seed_size));
+		return;
+	}
+	
+	// check everything is there before touching any state
+	unsigned int fixed = serial_header_size + (version >= 2 ? 1 : 0) + sizeof(unsigned int);
+	if ((size - fixed) / (sizeof(unsigned int) + pairing_length_in_bytes_Zr(_scheme->get_pairing())) < count)
+	{
+		throw std::runtime_error("challenge: truncated data");
+	}
+	
+	if (_seeded || count != _count)
+	{
+		cleanup();
+		if (count > 0)
+		{
+			allocate_pairs(count);
+		}
+	}
+	for (int i=0;i<_count;i++)
+	{
+		_pairs[i]._s = r.get_u32();
+		r.get_element(_pairs[i]._v);
+	}
+}
+
+// one batch of challenge pairs with the chunks and tags they name, filled by the prover's
+// reader.  the buffers live in the proving thread's scratch, which has a set of slots for
+// each batch the reader can be ahead by
+struct chunk_batch
+{
+	void init(scratch &arena, unsigned int which, unsigned int size)
+	{
+		index = arena.get_uint(uint_batch+2*which,size);
+		order = arena.get_uint(uint_batch+2*which+1,size);
+		v = arena.get_Zr(zr_batch_v+which,size);
+		chunk = arena.get_mpz(mpz_batch_chunk+which,size);
+		tag = arena.get_pointers(pointers_batch_tags+which,size);
+		loaded = arena.get_G1(g1_batch_tags+which,size);
+	}
+
+	unsigned int					count;
+	unsigned int*					index;
+	unsigned int*					order;		// positions in the batch sorted by index
+	element_s*						v;
+	__mpz_struct*					chunk;
+	element_s**						tag;		// resident tags, or tags decoded into loaded
+	element_s*						loaded;
+};
+
+// expand pairs [start,start+n) and read the chunks and tags of those the shard holds (all
+// of them without a shard).  the indices are random, so read them in file order, and
+// prefetch runs of nearby chunks and their tags as single ranges so the file and the tag
+// store can turn them into a few large reads instead of n small ones
+static void read_chunk_batch(chunk_batch &b, challenge &c, verification_metadata &vm, file &f, unsigned int start, unsigned int n, const shard_spec *shard)
+{
+	PBPDP_PHASE(phase_proof_read);
+	b.count = 0;
+	for (int k=0;k<n;k++)
+	{
+		c.get_pair(start+k,b.index[b.count],&b.v[b.count]);
+		if (shard && !shard->holds(b.index[b.count]))
+		{
+			continue;
+		}
+		b.order[b.count] = b.count;
+		b.count++;
+	}
+	PBPDP_COUNT(counter_chunks_read,b.count);
+	std::sort(b.order,b.order+b.count,[&b](unsigned int x, unsigned int y) { return b.index[x] < b.index[y]; });
+	
+	for (int k=0;k<b.count;)
+	{
+		unsigned int first = b.index[b.order[k]];
+		unsigned int last = first;
+		for (k++;k<b.count && b.index[b.order[k]] - last <= prefetch_gap;k++)
+		{
+			last = b.index[b.order[k]];
+		}
+		f.prefetch_chunks(first,last-first+1);
+		vm.prefetch_authenticators(first,last-first+1);
+	}
+	
+	for (int k=0;k<b.count;k++)
+	{
+		unsigned int i = b.order[k];
+		f.get_chunk(&b.chunk[i],b.index[i]);
+	}
+	for (int k=0;k<b.count;k++)
+	{
+		unsigned int i = b.order[k];
+		b.tag[i] = vm.load_authenticator(b.index[i],&b.loaded[i]);
+	}
+}
+
+// the unmasked part of a proof over the challenged chunks the shard holds (all of them
+// without a shard):
+// mu'_j = sum(v_i*m_ij)
+// sigma = prod(sigma_i^v_i)
+// mu_prime and sigma must be initialized
+static void accumulate_chunks(challenge &c, verification_metadata &vm, public_parameters &p, scheme_parameters &scheme, file &f, const shard_spec *shard,
+	__mpz_struct *mu_prime, element_t sigma)
+{
+	if (!c.fits(vm.get_count()))
+	{
+		throw std::out_of_range("response_proof: challenge names chunks the metadata doesn't have");
+	}
+	unsigned int sectors = p.get_sector_count();
+	unsigned int batch = std::min(std::max((c.get_count() + 3) / 4,proof_min_batch),proof_batch);
+	batch = std::min(batch,c.get_count());
+	unsigned int batches = batch ? (c.get_count() + batch - 1) / batch : 0;
+	
+	// everything comes from the thread's scratch, reused between calls.  sizes are fixed
+	// before taking pointers, since growing a slot moves it
+	scratch &arena = scratch::get(scheme);
+	chunk_batch buffers[proof_depth];
+	for (int b=0;b<proof_depth;b++)
+	{
+		buffers[b].init(arena,b,batch);
+	}
+	element_s **exps = arena.get_pointers(pointers_exps,batch);
+	element_s *t0 = arena.get_G1(g1_temp,2);
+	__mpz_struct *sector = arena.get_mpz(mpz_temp,2);
+	__mpz_struct *t2 = sector + 1;
+	
+	for (int j=0;j<sectors;j++)
+	{
+		mpz_set_ui(&mu_prime[j],0);
+	}
+	element_set1(sigma);
+	
+	f.set_access_hint(access_random);
+	
+	// one reader thread expands the pairs and reads the chunks and tags up to proof_depth
+	// batches ahead of the arithmetic.  only the reader touches f and the tag store, so
+	// neither needs to be thread safe
+	std::mutex lock;
+	std::condition_variable changed;
+	unsigned int filled = 0;		// batches the reader has finished
+	unsigned int consumed = 0;		// batches the arithmetic has finished
+	bool stop = false;
+	std::exception_ptr error;
+	std::thread reader;
+	if (batches > 0)
+	{
+		reader = std::thread([&]()
+		{
+			for (unsigned int t=0;t<batches;t++)
+			{
+				{
+					std::unique_lock<std::mutex> l(lock);
+					changed.wait(l,[&]() { return t - consumed < proof_depth || stop; });
+					if (stop)
+					{
+						return;
+					}
+				}
+				try
+				{
+					unsigned int start = t*batch;
+					read_chunk_batch(buffers[t % proof_depth],c,vm,f,start,std::min(batch,c.get_count() - start),shard);
+				}
+				catch (...)
+				{
+					std::lock_guard<std::mutex> l(lock);
+					error = std::current_exception();
+					changed.notify_all();
+					return;
+				}
+				std::lock_guard<std::mutex> l(lock);
+				filled = t + 1;
+				changed.notify_all();
+			}
+		});
+	}
+	
+	// the reader has to be joined before anything thrown here leaves, or its destructor
+	// terminates the process
+	try
+	{
+		for (unsigned int t=0;t<batches;t++)
+		{
+			{
+				std::unique_lock<std::mutex> l(lock);
+				changed.wait(l,[&]() { return filled > t || error; });
+				if (filled <= t)
+				{
+					std::rethrow_exception(error);
+				}
+			}
+			
+			chunk_batch &b = buffers[t % proof_depth];
+			for (int k=0;k<b.count;k++)
+			{
+				element_to_mpz(t2,&b.v[k]);
+				
+				for (int j=0;j<sectors;j++)
+				{
+					p.get_sector(sector,&b.chunk[k],j);
+					mpz_mod(sector,sector,scheme.get_pairing()->r);
+					mpz_addmul(&mu_prime[j],t2,sector);
+				}
+				exps[k] = &b.v[k];
+			}
+			multi_pow_zn(t0,b.tag,exps,b.count,&arena);
+			PBPDP_COUNT(counter_multiexp_terms,b.count);
+			element_mul(sigma,sigma,t0);
+			
+			std::lock_guard<std::mutex> l(lock);
+			consumed = t + 1;
+			changed.notify_all();
+		}
+	}
+	catch (...)
+	{
+		{
+			std::lock_guard<std::mutex> l(lock);
+			stop = true;
+			changed.notify_all();
+		}
+		if (reader.joinable())
+		{
+			reader.join();
+		}
+		throw;
+	}
+	if (reader.joinable())
+	{
+		reader.join();
+	}
+}
+
+void response_proof::init(challenge &c, verification_metadata &vm, public_parameters &p, scheme_parameters &scheme, file &f, mask_pool *masks)
+{
+	PBPDP_PHASE(phase_proof);
+	PBPDP_TRACE("Initialiing response proof.");
+	_scheme = &scheme;
+	__mpz_struct *mu_prime = scratch::get(scheme).get_mpz(mpz_mu_prime,p.get_sector_count());
+	
+	element_init_G1(_sigma,scheme.get_pairing());
+	try
+	{
+		accumulate_chunks(c,vm,p,scheme,f,0,mu_prime,_sigma);
+	}
+	catch (...)
+	{
+		element_clear(_sigma);
+		throw;
+	}
+	finish(mu_prime,p,scheme,masks);
+	
+	_initialized = true;
+	PBPDP_TRACE("Response proof initialized.");
+}
+
+void response_proof::combine(std::vector<partial_proof*> &parts, public_parameters &p, scheme_parameters &scheme, mask_pool *masks)
+{
+	PBPDP_PHASE(phase_proof);
+	unsigned int sectors = p.get_sector_count();
+	
+	// every shard exactly once, all cut the same way
+	std::vector<bool> seen;
+	for (int i=0;i<parts.size();i++)
+	{
+		const shard_spec &shard = parts[i]->get_shard();
+		if (seen.empty())
+		{
+			seen.resize(shard.count,false);
+		}
+		if (shard.count != seen.size() || shard.stripe != parts[0]->get_shard().stripe || shard.index >= shard.count || seen[shard.index])
+		{
+			throw std::runtime_error("response_proof: partial proofs don't divide the file into shards");
+		}
+		if (parts[i]->get_mu_count() != sectors)
+		{
+			throw std::runtime_error("response_proof: partial proof has the wrong number of sectors");
+		}
+		seen[shard.index] = true;
+	}
+	if (seen.empty() || std::find(seen.begin(),seen.end(),false) != seen.end())
+	{
+		throw std::runtime_error("response_proof: a shard's partial proof is missing");
+	}
+	
+	init_from_partials(parts,p,scheme,masks);
+}
+
+void response_proof::init(std::vector<audit_file> &files, public_parameters &p, scheme_parameters &scheme, mask_pool *masks)
+{
+	PBPDP_PHASE(phase_proof);
+	if (files.empty())
+	{
+		throw std::runtime_error("response_proof: no files to prove");
+	}
+	
+	// each file's share is a partial proof holding every chunk, summed like shards are
+	std::vector<partial_proof> partials(files.size());
+	std::vector<partial_proof*> parts(files.size());
+	for (int i=0;i<files.size();i++)
+	{
+		if (!files[i].c || !files[i].vm || !files[i].f)
+		{
+			throw std::runtime_error("response_proof: audit file needs a challenge, metadata and the file");
+		}
+		partials[i].init(*files[i].c,*files[i].vm,p,scheme,*files[i].f,shard_spec());
+		parts[i] = &partials[i];
+	}
+	
+	init_from_partials(parts,p,scheme,masks);
+}
+
+void response_proof::init_from_partials(std::vector<partial_proof*> &parts, public_parameters &p, scheme_parameters &scheme, mask_pool *masks)
+{
+	unsigned int sectors = p.get_sector_count();
+	
+	cleanup();
+	_scheme = &scheme;
+	__mpz_struct *mu_prime = scratch::get(scheme).get_mpz(mpz_mu_prime,sectors);
+	for (int j=0;j<sectors;j++)
+	{
+		mpz_set_ui(&mu_prime[j],0);
+	}
+	element_init_G1(_sigma,scheme.get_pairing());
+	element_set1(_sigma);
+	for (int i=0;i<parts.size();i++)
+	{
+		for (int j=0;j<sectors;j++)
+		{
+			mpz_add(&mu_prime[j],&mu_prime[j],parts[i]->get_mu_prime(j));
+		}
+		element_mul(_sigma,_sigma,parts[i]->get_sigma());
+	}
+	finish(mu_prime,p,scheme,masks);
+	
+	_initialized = true;
+}
+
+void response_proof::finish(__mpz_struct *mu_prime, public_parameters &p, scheme_parameters &scheme, mask_pool *masks)
+{
+	unsigned int sectors = p.get_sector_count();
+	scratch &arena = scratch::get(scheme);
+	element_s *r = arena.get_Zr(zr_r,sectors);
+	element_s *gamma = arena.get_Zr(zr_gamma);
+	element_s *t0 = arena.get_G1(g1_temp,2);
+	element_s *t1 = t0 + 1;
+	__mpz_struct *t2 = arena.get_mpz(mpz_temp,2);
+	__mpz_struct *rj = t2 + 1;
+	element_hash &hasher = arena.get_hasher();
+	
+	element_init_GT(_R,scheme.get_pairing());
+	
+	// now R = e(prod(u_j^r_j),v), where each r_j is random.  a pool has these ready
+	if (!masks || !masks->take(p,r,_R))
+	{
+		element_set1(t0);
+		for (int j=0;j<sectors;j++)
+		{
+			element_random(&r[j]);
+			element_pp_pow_zn(t1,&r[j],p.get_u_pp(j));
+			PBPDP_COUNT(counter_g1_exps,1);
+			element_mul(t0,t0,t1);
+		}
+		p.pair_with_v(_R,t0);
+	}
+	
+	hasher.hash_element_to_element(gamma,_R);
+	element_to_mpz(t2,gamma);
+	
+	// mu_j = r_j + gamma * mu'_j
+	_mu = new __mpz_struct[sectors];
+	_mu_count = sectors;
+	for (int j=0;j<sectors;j++)
+	{
+		mpz_init(&_mu[j]);
+		mpz_mul(&_mu[j],t2,&mu_prime[j]);
+		
+		element_to_mpz(rj,&r[j]);
+		mpz_add(&_mu[j],rj,&_mu[j]);
+	}
+}
+
+void partial_proof::init(challenge &c, verification_metadata &vm, public_parameters &p, scheme_parameters &scheme, file &f, const shard_spec &shard)
+{
+	PBPDP_PHASE(phase_proof);
+	if (!shard.valid())
+	{
+		throw std::runtime_error("partial_proof: bad shard");
+	}
+	
+	cleanup();
+	_scheme = &scheme;
+	_shard = shard;
+	allocate(p.get_sector_count());
+	try
+	{
+		accumulate_chunks(c,vm,p,scheme,f,&_shard,_mu_prime,_sigma);
+	}
+	catch (...)
+	{
+		cleanup();
+		throw;
+	}
+}
+
+void partial_proof::allocate(unsigned int sectors)
+{
+	_mu_prime = new __mpz_struct[sectors];
+	_mu_count = sectors;
+	for (int j=0;j<sectors;j++)
+	{
+		mpz_init(&_mu_prime[j]);
+	}
+	element_init_G1(_sigma,_scheme->get_pairing());
+	_initialized = true;
+}
+
+void response_proof::cleanup()
+{
+	if (_initialized)
+	{
+		element_clear(_R);
+		element_clear(_sigma);
+		for (int j=0;j<_mu_count;j++)
+		{
+			mpz_clear(&_mu[j]);
+		}
+		delete[] _mu;
+		_mu = 0;
+		_mu_count = 0;
+		_initialized = false;
+	}
+}
+
+void response_proof::swap(response_proof &other)
+{
+	std::swap(_initialized,other._initialized);
+	std::swap(_scheme,other._scheme);
+	std::swap(_mu,other._mu);
+	std::swap(_mu_count,other._mu_count);
+	std::swap(_sigma,other._sigma);
+	std::swap(_R,other._R);
+}
+
+void partial_proof::cleanup()
+{
+	if (_initialized)
+	{
+		element_clear(_sigma);
+		for (int j=0;j<_mu_count;j++)
+		{
+			mpz_clear(&_mu_prime[j]);
+		}
+		delete[] _mu_prime;
+		_mu_prime = 0;
+		_mu_count = 0;
+		_initialized = false;
+	}
+}
+
+void partial_proof::swap(partial_proof &other)
+{
+	std::swap(_initialized,other._initialized);
+	std::swap(_scheme,other._scheme);
+	std::swap(_shard,other._shard);
+	std::swap(_mu_prime,other._mu_prime);
+	std::swap(_mu_count,other._mu_count);
+	std::swap(_sigma,other._sigma);
+}
+
+unsigned int partial_proof::get_serialized_size() const
+{
+	unsigned int size = serial_header_size + 4*sizeof(unsigned int);
+	for (int j=0;j<_mu_count;j++)
+	{
+		size += serialized_mpz_size(&_mu_prime[j]);
+	}
+	return size + pairing_length_in_bytes_compressed_G1(_scheme->get_pairing());
+}
+
+void partial_proof::serialize(unsigned char *data,unsigned int size) const
+{
+	serial_writer w(data,size);
+	w.put_header(serial_partial_proof);
+	w.put_u32(_shard.index);
+	w.put_u32(_shard.count);
+	w.put_u32(_shard.stripe);
+	w.put_u32(_mu_count);
+	for (int j=0;j<_mu_count;j++)
+	{
+		w.put_mpz(&_mu_prime[j]);
+	}
+	w.put_element_compressed(_sigma);
+}
+
+void partial_proof::deserialize(unsigned char *data,unsigned int size)
 {
-	delete[] _name;
-	delete[] _name_sig;
-	delete[] _W_buffer;
-	_initialized = false;
+	if (!_scheme)
+	{
+		throw std::runtime_error("partial_proof: no scheme to deserialize with");
+	}
+	
+	serial_reader r(data,size);
+	r.get_header(serial_partial_proof);
+	shard_spec shard;
+	shard.index = r.get_u32();
+	shard.count = r.get_u32();
+	shard.stripe = r.get_u32();
+	unsigned int mu_count = r.get_u32();
+	if (!shard.valid() || mu_count == 0 || mu_count > size)
+	{
+		throw std::runtime_error("partial_proof: bad shard or sector count");
+	}
+	
+	// check everything is there before touching any state
+	serial_reader check = r;
+	for (int j=0;j<mu_count;j++)
+	{
+		check.skip_mpz();
+	}
+	check.get_bytes(pairing_length_in_bytes_compressed_G1(_scheme->get_pairing()));
+	
+	// decoded straight into the existing elements when the sector count matches
+	if (!_initialized || mu_count != _mu_count)
+	{
+		cleanup();
+		allocate(mu_count);
+	}
+	_shard = shard;
+	for (int j=0;j<_mu_count;j++)
+	{
+		r.get_mpz(&_mu_prime[j]);
+	}
+	r.get_element_compressed(_sigma);
 }
 
-void verification_metadata::allocate_authenticators(unsigned int count, scheme_parameters &scheme)
+unsigned int response_proof::get_serialized_size() const
 {
-	std::cout << "Allocating " << count << " authenticators..." << std::endl;
-	clear_authenticators();
-	_authenticators = new element_s[count];
-	std::cout << "Finished allocating space... now initializing." << std::endl;
-	for (int i=0;i<count;i++)
+	unsigned int size = serial_header_size + sizeof(unsigned int);
+	for (int j=0;j<_mu_count;j++)
 	{
-		element_init_G1(&_authenticators[i],scheme.get_pairing());
+		size += serialized_mpz_size(&_mu[j]);
 	}
-	_count = count;
-	std::cout << "Authenticators allocated..." << std::endl;
+	return size + pairing_length_in_bytes_compressed_G1(_scheme->get_pairing()) + pairing_length_in_bytes_GT(_scheme->get_pairing());
 }
 
-void verification_metadata::clear_authenticators()
+void response_proof::serialize(unsigned char *data,unsigned int size) const
 {
-	if (_count > 0)
+	serial_writer w(data,size);
+	w.put_header(serial_response_proof);
+	w.put_u32(_mu_count);
+	for (int j=0;j<_mu_count;j++)
 	{
-		for (int i=0;i<_count;i++)
-		{
-			element_clear(&_authenticators[i]);
-		}
-		delete[] _authenticators;
-		_count = 0;
+		w.put_mpz(&_mu[j]);
 	}
+	w.put_element_compressed(_sigma);
+	w.put_element(_R);
 }
 
-bool verification_metadata::check_sig(public_parameters &p, scheme_parameters &scheme)
+void response_proof::deserialize(unsigned char *data,unsigned int size)
 {
-	std::cout << "Checking signature..." << std::endl;
-	// now we know sig = H(name)^ssk and spk = g^ssk  we need to verify that e(sig,g) = e(H(name),spk)
-	
-	element_t Hname;
-	element_t name_sig;
-	element_init_G1(Hname,scheme.get_pairing());
-	element_init_G1(name_sig,scheme.get_pairing());
-	
-	get_Hname(Hname);
-	element_from_bytes_x_only(name_sig,_name_sig);
-	
-	element_t p0,p1;
-	
-	element_init_GT(p0,scheme.get_pairing());
-	element_init_GT(p1,scheme.get_pairing());
-	
-	element_pairing(p0,name_sig,scheme.get_g());
-	element_pairing(p1,Hname,p.get_spk());
+	if (!_scheme)
+	{
+		throw std::runtime_error("response_proof: no scheme to deserialize with");
+	}
 	
-	// now we must compare the pairings, although since we only got the x coordinate,
-	// each one could be the inverse of the true value.
-	// so either p0 == p1 or 1/p0 == p1 (p0*p1 == 1)
-	bool sig_valid = false;
+	serial_reader r(data,size);
+	r.get_header(serial_response_proof);
+	unsigned int mu_count = r.get_u32();
+	if (mu_count == 0 || mu_count > size)
+	{
+		throw std::runtime_error("response_proof: bad sector count");
+	}
 	
-	if (!element_cmp(p0,p1))
+	// check everything is there before touching any state
+	serial_reader check = r;
+	for (int j=0;j<mu_count;j++)
 	{
-		std::cout << "Sig valid on first attempt." << std::endl;
-		sig_valid = true;
+		check.skip_mpz();
 	}
-	else
+	check.get_bytes(pairing_length_in_bytes_compressed_G1(_scheme->get_pairing()) + pairing_length_in_bytes_GT(_scheme->get_pairing()));
+	
+	// decoded straight into the existing elements when the sector count matches
+	if (!_initialized || mu_count != _mu_count)
 	{
-		std::cout << "Sig not valid on first attempt." << std::endl;
-		element_mul(p0,p0,p1);
-		if (element_is1(p0))
-		{
-			std::cout << "Sig valid on second attempt." << std::endl;
-			sig_valid = true;
-		}
-		else
+		cleanup();
+		_mu = new __mpz_struct[mu_count];
+		_mu_count = mu_count;
+		for (int j=0;j<mu_count;j++)
 		{
-			std::cout << "Sig not valid." << std::endl;
+			mpz_init(&_mu[j]);
 		}
+		element_init_G1(_sigma,_scheme->get_pairing());
+		element_init_GT(_R,_scheme->get_pairing());
+		_initialized = true;
 	}
-	
-	element_clear(p1);
-	element_clear(p0);
-	
-	element_clear(name_sig);
-	element_clear(Hname);
-	
-	return sig_valid;
+	for (int j=0;j<_mu_count;j++)
+	{
+		r.get_mpz(&_mu[j]);
+	}
+	r.get_element_compressed(_sigma);
+	r.get_element(_R);
 }
 
-unsigned int verification_metadata::get_W_size() const
+void key_gen(scheme_parameters &scheme, secret_parameters &s, public_parameters &p,char *params,unsigned int block_size,curve_type curve)
 {
-	return _name_len + sizeof(unsigned int);
+	scheme.init(params,curve);
+	s.init(scheme);
+	p.init(scheme,s,block_size ? public_parameters::sectors_for_block(scheme,block_size) : 1);
 }
 
-void verification_metadata::append_index_to_W(unsigned int i) const
+void sig_gen(verification_metadata &vmd, secret_parameters &s, public_parameters &p, scheme_parameters &scheme, file &f, unsigned int threads)
 {
-	*(unsigned int*)(_W_buffer+_name_len) = i;
+	vmd.init(s,p,scheme,f,threads);
 }
 
-void verification_metadata::get_HWi(element_t e,unsigned int i) const
-{	
-	append_index_to_W(i);
+void sig_gen_stream(verification_metadata &vmd, secret_parameters &s, public_parameters &p, scheme_parameters &scheme, file &f, tag_sink &out, const stream_options &options)
+{
+	vmd.init_streaming(s,p,scheme,f,out,options);
+}
+
+bool check_sig(verification_metadata &vmd, public_parameters &p, scheme_parameters &scheme)
+{
+	return vmd.check_sig(p,scheme);
+}
+
+void gen_challenge(challenge &chal, scheme_parameters &scheme, unsigned int c, unsigned int chunk_count)
+{
+	// generates a challenge for c chunks of the file which has chunk count chunk_count
+	chal.init(scheme,c,chunk_count);
+}
+
+void gen_seeded_challenge(challenge &chal, scheme_parameters &scheme, unsigned int c, unsigned int chunk_count)
+{
+	chal.init_seeded(scheme,c,chunk_count);
+}
+
+double detection_probability(unsigned int chunk_count, unsigned int c, double corrupted_fraction)
+{
+	if (chunk_count == 0 || corrupted_fraction <= 0)
+	{
+		return 0;
+	}
 	
-	_hasher.hash_data_to_element(e,_W_buffer,get_W_size());
+	// at least one chunk is corrupted, or there is nothing to detect
+	double n = chunk_count;
+	double bad = std::min(std::ceil(corrupted_fraction * n),n);
+	c = std::min(c,chunk_count);
+	
+	// chance that every one of the c chunks drawn without replacement is good
+	double miss = 1;
+	for (unsigned int i=0;i<c && miss > 0;i++)
+	{
+		miss *= std::max(n - bad - i,0.0) / (n - i);
+	}
+	return 1 - miss;
 }
 
-void verification_metadata::get_HWi(mpz_t e,unsigned int i) const
+unsigned int plan_challenge_size(unsigned int chunk_count, double target_detection, double corrupted_fraction)
 {
-	append_index_to_W(i);
+	if (target_detection <= 0 || target_detection > 1 || corrupted_fraction <= 0 || corrupted_fraction > 1)
+	{
+		throw std::runtime_error("plan_challenge_size: target and corrupted fraction must be in (0,1]");
+	}
 	
-	_hasher.hash_data_to_mpz(e,_W_buffer,get_W_size());
+	// the same product as detection_probability, stopping once it is small enough
+	double n = chunk_count;
+	double bad = std::min(std::ceil(corrupted_fraction * n),n);
+	double miss = 1;
+	unsigned int c = 0;
+	while (c < chunk_count && 1 - miss < target_detection)
+	{
+		miss *= std::max(n - bad - c,0.0) / (n - c);
+		c++;
+	}
+	return c;
 }
 
-void verification_metadata::get_Hname(element_t e) const
+challenge_plan plan_challenge(unsigned int chunk_count, double target_detection, double corrupted_fraction, const challenge_costs &costs)
 {
-	_hasher.hash_data_to_element(e,_name,_name_len);
+	challenge_plan plan;
+	plan.c = plan_challenge_size(chunk_count,target_detection,corrupted_fraction);
+	plan.detection = detection_probability(chunk_count,plan.c,corrupted_fraction);
+	plan.prover_seconds = costs.prover_fixed + costs.prover_per_pair * plan.c;
+	plan.verifier_seconds = costs.verifier_fixed + costs.verifier_per_pair * plan.c;
+	return plan;
 }
 
-void verification_metadata::get_Hname(mpz_t e) const
+// fits fixed + per_pair * c through the timings at the two sizes
+static void fit_cost(const double *seconds, const unsigned int *sizes, double &fixed, double &per_pair)
 {
-	_hasher.hash_data_to_mpz(e, _name, _name_len);
+	if (sizes[1] > sizes[0])
+	{
+		per_pair = (seconds[1] - seconds[0]) / (sizes[1] - sizes[0]);
+		fixed = std::max(seconds[0] - per_pair * sizes[0],0.0);
+	}
+	else
+	{
+		per_pair = sizes[1] ? seconds[1] / sizes[1] : 0;
+		fixed = 0;
+	}
 }
 
-void challenge::init(scheme_parameters &scheme, unsigned int c, unsigned int chunk_count)
+challenge_costs calibrate_challenge_costs(verification_metadata &vm, public_parameters &p, scheme_parameters &scheme, file &f)
 {
-	std::cout << "Initializing challenge..." << std::endl;
-	if (c > 0)
+	unsigned int n = f.get_chunk_count();
+	unsigned int sizes[2] = { std::min(n,calibrate_small_challenge), std::min(n,calibrate_large_challenge) };
+	double prover[2];
+	double verifier[2];
+	
+	for (int k=0;k<2;k++)
 	{
-		_pairs = new pair[c];
-		_count = c;
-		
-		mpz_t mpz_s;
-		mpz_t mpz_lim;
-		
-		mpz_init(mpz_s);
-		
-		mpz_init_set_ui(mpz_lim,chunk_count);
-		
-		
-		std::cout << "Generating " << _count << " challenge pairs." << std::endl;
-		for (int i=0;i<_count;i++)
+		prover[k] = verifier[k] = -1;
+		for (int rep=0;rep<calibrate_reps;rep++)
 		{
-			// select a random element
-			pbc_mpz_random(mpz_s,mpz_lim);
-			
-			_pairs[i]._s = mpz_get_ui(mpz_s);
+			challenge c;
+			response_proof rp;
+			gen_seeded_challenge(c,scheme,sizes[k],n);
 			
-			//std::cout << "Challenge " << i << " checks block " << _pairs[i]._s << std::endl;
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			gen_proof(rp,c,vm,p,scheme,f);
+			std::chrono::steady_clock::time_point proved = std::chrono::steady_clock::now();
+			bool valid = verify_proof(rp,c,vm,p,scheme);
+			std::chrono::steady_clock::time_point verified = std::chrono::steady_clock::now();
+			if (!valid)
+			{
+				throw std::runtime_error("calibrate_challenge_costs: proof didn't verify");
+			}
 			
-			// select a random challenge value
-			element_init_Zr(_pairs[i]._v,scheme.get_pairing());
-			element_random(_pairs[i]._v);
+			double prove_time = std::chrono::duration<double>(proved - start).count();
+			double verify_time = std::chrono::duration<double>(verified - proved).count();
+			prover[k] = prover[k] < 0 ? prove_time : std::min(prover[k],prove_time);
+			verifier[k] = verifier[k] < 0 ? verify_time : std::min(verifier[k],verify_time);
 		}
-		
-		mpz_clear(mpz_lim);
-		mpz_clear(mpz_s);
-		
-		_initialized = true;
 	}
-	std::cout << "Challenge initialized." << std::endl;
+	
+	challenge_costs costs;
+	fit_cost(prover,sizes,costs.prover_fixed,costs.prover_per_pair);
+	fit_cost(verifier,sizes,costs.verifier_fixed,costs.verifier_per_pair);
+	return costs;
 }
 
-void challenge::cleanup()
+void gen_partial_proof(partial_proof &pp, challenge &c, verification_metadata &vm, public_parameters &p, scheme_parameters &scheme, file &f, const shard_spec &shard)
 {
-	if (_initialized)
+	pp.init(c,vm,p,scheme,f,shard);
+}
+
+void combine_proofs(response_proof &rp, std::vector<partial_proof*> &parts, public_parameters &p, scheme_parameters &scheme, mask_pool *masks)
+{
+	rp.combine(parts,p,scheme,masks);
+}
+
+void gen_multi_file_proof(response_proof &rp, std::vector<audit_file> &files, public_parameters &p, scheme_parameters &scheme, mask_pool *masks)
+{
+	rp.init(files,p,scheme,masks);
+}
+
+void gen_proof(response_proof& rp, challenge &c, verification_metadata &vm, public_parameters &p, scheme_parameters &scheme, file &f, mask_pool *masks)
+{
+	rp.init(c,vm,p,scheme,f,masks);
+}
+
+// calculates the two G1 arguments of the verification equation
+//   R * e(A,g) = e(B,v)
+// where A = sigma^gamma and B = prod(H(W_i)^v_i)^gamma * prod(u_j^mu_j), the first
+// product running over every file's challenge.  returns false if the proof is malformed.
+static bool get_verification_terms(element_t A, element_t B, response_proof &r, const audit_file *files, unsigned int file_count, public_parameters &p, scheme_parameters &scheme)
+{
+	if (r.get_mu_count() != p.get_sector_count())
 	{
-		for (int i=0;i<_count;i++)
+		PBPDP_TRACE("Proof has " << r.get_mu_count() << " sectors, expected " << p.get_sector_count());
+		return false;
+	}
+	
+	// the challenges are expanded a batch at a time so memory doesn't grow with c
+	unsigned int batch = 0;
+	unsigned int W_size = 0;
+	for (int i=0;i<file_count;i++)
+	{
+		if (!files[i].c->fits(files[i].vm->get_count()))
 		{
-			element_clear(_pairs[i]._v);
+			PBPDP_TRACE("Challenge names chunks the metadata doesn't have");
+			return false;
 		}
-		delete[] _pairs;
-		_count = 0;
+		unsigned int count = files[i].c->get_count() < challenge_batch ? files[i].c->get_count() : challenge_batch;
+		batch = count > batch ? count : batch;
+		W_size = files[i].vm->get_W_size() > W_size ? files[i].vm->get_W_size() : W_size;
 	}
-}
-
-void response_proof::init(challenge &c, verification_metadata &vm, public_parameters &p, scheme_parameters &scheme, file &f)
-{
-	std::cout << "Initialiing response proof." << std::endl;
-	element_t r;
-	//element_t chunk;
-	mpz_t chunk;
-	element_t chunkmod;
-	//element_t mu_prime;
-	mpz_t mu_prime;
-	element_t gamma;
-	element_t t0;
-	mpz_t t1;
-	element_hash hasher;
 	
-	hasher.init(scheme);
+	scratch &arena = scratch::get(scheme);
+	element_s *HW = arena.get_G1(g1_HW,batch);
+	element_s *v = arena.get_Zr(zr_v,batch);
+	element_s **bases = arena.get_pointers(pointers_bases,batch);
+	element_s **exps = arena.get_pointers(pointers_exps,batch);
+	unsigned int *index = arena.get_uint(uint_index,batch);
+	unsigned char *W = arena.get_bytes(bytes_W,batch*W_size);	// our own, so several threads can verify against the same metadata
+	element_s *gamma = arena.get_Zr(zr_gamma);
+	element_s *t0 = arena.get_G1(g1_temp,2);
+	__mpz_struct *mu = arena.get_mpz(mpz_temp,2);
+	element_hash &hasher = arena.get_hasher();
+	for (int k=0;k<batch;k++)
+	{
+		bases[k] = &HW[k];
+		exps[k] = &v[k];
+	}
 	
-	element_init_Zr(r,scheme.get_pairing());
+	hasher.hash_element_to_element(gamma,r.get_R());
 	
-	element_random(r);
+	scheme.pow_G1(A,r.get_sigma(),gamma);
+	PBPDP_COUNT(counter_g1_exps,1);
 	
-	element_init_GT(_R,scheme.get_pairing());
+	element_set1(B);
+	for (int i=0;i<file_count;i++)
+	{
+		challenge &c = *files[i].c;
+		verification_metadata &vm = *files[i].vm;
+		for (unsigned int start=0;start<c.get_count();start+=batch)
+		{
+			unsigned int n = c.get_count() - start < batch ? c.get_count() - start : batch;
+			{
+				PBPDP_PHASE(phase_verify_hash);
+				for (int k=0;k<n;k++)
+				{
+					c.get_pair(start+k,index[k],&v[k]);
+				}
+				vm.get_HWi_batch(HW,index,n,hasher,W);
+			}
+			multi_pow_zn(t0,bases,exps,n,&arena);
+			PBPDP_COUNT(counter_multiexp_terms,n);
+			element_mul(B,B,t0);
+		}
+	}
 	
-	element_pairing(_R,p.get_u(),p.get_v());
+	scheme.pow_G1(B,B,gamma);
+	PBPDP_COUNT(counter_g1_exps,1+r.get_mu_count());
 	
-	// now R = e(u,v)^r, where r is random
-	element_pow_zn(_R,_R,r);
+	// times prod(u_j^mu_j)
+	for (int j=0;j<r.get_mu_count();j++)
+	{
+		mpz_mod(mu,r.get_mu(j),scheme.get_pairing()->r);
+		element_pp_pow(t0,mu,p.get_u_pp(j));
+		element_mul(B,B,t0);
+	}
 	
-	//element_init_Zr(chunk,scheme.get_pairing());
-	mpz_init(chunk);
-	element_init_Zr(chunkmod,scheme.get_pairing());
-	//element_init_Zr(mu_prime,scheme.get_pairing());
-	mpz_init(mu_prime);
-	mpz_init(t1);
-	element_init_G1(_sigma,scheme.get_pairing());
-	element_init_G1(t0,scheme.get_pairing());
+	return true;
+}
+
+static bool verify_files(response_proof &r, const audit_file *files, unsigned int file_count, public_parameters &p, scheme_parameters &scheme)
+{
+	PBPDP_PHASE(phase_verify);
+	PBPDP_TRACE("Verifying proof.");
+	element_t lhs;
+	element_t rhs;
+	element_t A;
+	element_t B;
 	
-	//element_set0(mu_prime);
-	mpz_set_ui(mu_prime,0);
-	element_set1(_sigma);
+	element_init_G1(A,scheme.get_pairing());
+	element_init_G1(B,scheme.get_pairing());
 	
-	// calculate the linear combination of sampled blocks from the challenge
-	// mu' = sum(v_i*mu_i)
-	// also
-	// sigma = prod(sigma_i^v_i)
-	for (int i=0;i<c.get_count();i++)
+	if (!get_verification_terms(A,B,r,files,file_count,p,scheme))
 	{
-		challenge::pair pair = c.get_pair(i);
-		f.get_chunk(chunk,pair._s);
-		element_set_mpz(chunkmod,chunk);
-		element_to_mpz(chunk,chunkmod);
-		
-		element_to_mpz(t1,pair._v);
-		
-		//element_mul(chunkmod,pair._v,chunkmod);
-		mpz_mul(chunk,t1,chunk);
-		
-		//element_add(mu_prime,mu_prime,chunk);
-		mpz_add(mu_prime,mu_prime,chunk);
-		
-		element_pow_zn(t0,vm.get_authenticator(pair._s),pair._v);
-		element_mul(_sigma,_sigma,t0);
+		element_clear(B);
+		element_clear(A);
+		return false;
 	}
 	
-	element_init_Zr(gamma,scheme.get_pairing());
+	element_init_GT(lhs,scheme.get_pairing());
+	element_init_GT(rhs,scheme.get_pairing());
 	
-	//element_init_Zr(_mu,scheme.get_pairing());
-	mpz_init(_mu);
+	scheme.pair_with_g(lhs,A);
+	element_mul(lhs,r.get_R(),lhs);
 	
-	hasher.hash_element_to_element(gamma,_R);
+	p.pair_with_v(rhs,B);
 	
-	// mu = r + gamma * mu'
-	//element_mul(_mu,gamma,mu_prime);
-	element_to_mpz(t1,gamma);
-	mpz_mul(_mu,t1,mu_prime);
 	
-	//element_add(_mu,r,_mu);
-	element_to_mpz(t1,r);
-	mpz_add(_mu,t1,_mu);
+	// check that they are equal.  for now all of the elements should have been 
+	// fully stored so they should always be equal.  in the future i may have to 
+	// serialize one coordinate of some elements for transport, which will mean
+	// that they may be inverses of each other
+	bool result = !element_cmp(lhs,rhs);
+	
+	// cleanup
+	element_clear(rhs);
+	element_clear(lhs);
+	element_clear(B);
+	element_clear(A);
 	
-	element_clear(gamma);
-	element_clear(t0);
-	//element_clear(mu_prime);
-	mpz_clear(mu_prime);
-	//element_clear(chunk);
-	mpz_clear(chunk);
-	element_clear(chunkmod);
-	element_clear(r);
-	mpz_clear(t1);
+	PBPDP_TRACE("Finished verifying proof.");
 	
-	_initialized = true;
-	std::cout << "Response proof initialized." << std::endl;
-
-	//element_printf("mu: %B\n",_mu);
-	//element_printf("sigma: %B\n",_sigma);
-	//element_printf("R: %B\n",_R);
-}
-
-void response_proof::cleanup()
-{
-	if (_initialized)
-	{
-		element_clear(_R);
-		element_clear(_sigma);
-		//element_clear(_mu);
-		mpz_clear(_mu);
-	}
-}
-
-void key_gen(scheme_parameters &scheme, secret_parameters &s, public_parameters &p,char *params)
-{
-	scheme.init(params);
-	s.init(scheme);
-	p.init(scheme,s);
-}
-
-void sig_gen(verification_metadata &vmd, secret_parameters &s, public_parameters &p, scheme_parameters &scheme, file &f)
-{
-	vmd.init(s,p,scheme,f);
+	return result;
 }
 
-bool check_sig(verification_metadata &vmd, public_parameters &p, scheme_parameters &scheme)
+bool verify_proof(response_proof &r, challenge &c, verification_metadata &vm, public_parameters &p, scheme_parameters &scheme)
 {
-	vmd.check_sig(p,scheme);
+	audit_file file(&c,&vm);
+	return verify_files(r,&file,1,p,scheme);
 }
 
-void gen_challenge(challenge &chal, scheme_parameters &scheme, unsigned int c, unsigned int chunk_count)
+bool verify_multi_file_proof(response_proof &rp, std::vector<audit_file> &files, public_parameters &p, scheme_parameters &scheme)
 {
-	// generates a challenge for c chunks of the file which has chunk count chunk_count
-	chal.init(scheme,c,chunk_count);
+	if (files.empty())
+	{
+		return false;
+	}
+	for (int i=0;i<files.size();i++)
+	{
+		if (!files[i].c || !files[i].vm)
+		{
+			throw std::runtime_error("verify_multi_file_proof: audit file needs a challenge and metadata");
+		}
+	}
+	return verify_files(rp,&files[0],files.size(),p,scheme);
 }
 
-void gen_proof(response_proof& rp, challenge &c, verification_metadata &vm, public_parameters &p, scheme_parameters &scheme, file &f)
+// the weighted terms of each proof in a batch.  a subset of the batch is valid
+// (with overwhelming probability) when
+//   prod(R_k) * e(prod(A_k),g) = prod(e(B_k,v_k))
+// with every term already raised to that proof's random weight
+struct batch_terms
 {
-	rp.init(c,vm,p,scheme,f);
-}
+	scheme_parameters *			scheme;
+	std::vector<element_s>		A;
+	std::vector<element_s>		B;
+	std::vector<element_s>		R;
+	std::vector<public_parameters*>	p;
+	std::vector<unsigned int>	entries;		// index of each term in the caller's batch
+};
 
-bool verify_proof(response_proof &r, challenge &c, verification_metadata &vm, public_parameters &p, scheme_parameters &scheme)
+static bool check_batch_terms(batch_terms &terms, unsigned int lo, unsigned int hi)
 {
-	std::cout << "Verifying proof." << std::endl;
-	element_t gamma;
+	pairing_s *pairing = terms.scheme->get_pairing();
+	element_t A;
 	element_t lhs;
 	element_t rhs;
 	element_t t0;
-	element_t t1;
 	
-	element_hash hasher;
+	element_init_G1(A,pairing);
+	element_init_GT(lhs,pairing);
+	element_init_GT(rhs,pairing);
+	element_init_GT(t0,pairing);
 	
-	hasher.init(scheme);
+	element_set1(A);
+	element_set1(lhs);
+	element_set1(rhs);
 	
-	element_init_Zr(gamma,scheme.get_pairing());
+	for (int k=lo;k<hi;k++)
+	{
+		element_mul(A,A,&terms.A[k]);
+		element_mul(lhs,lhs,&terms.R[k]);
+		terms.p[k]->pair_with_v(t0,&terms.B[k]);
+		element_mul(rhs,rhs,t0);
+	}
 	
-	hasher.hash_element_to_element(gamma,r.get_R());
+	terms.scheme->pair_with_g(t0,A);
+	element_mul(lhs,lhs,t0);
 	
-	element_init_G1(t0,scheme.get_pairing());
-	element_init_GT(lhs,scheme.get_pairing());
-	element_init_GT(rhs,scheme.get_pairing());
+	bool result = !element_cmp(lhs,rhs);
 	
-	element_pow_zn(t0,r.get_sigma(),gamma);
-	element_pairing(lhs,t0,scheme.get_g());
-	element_mul(lhs,r.get_R(),lhs);
+	element_clear(t0);
+	element_clear(rhs);
+	element_clear(lhs);
+	element_clear(A);
 	
-	element_init_G1(t1,scheme.get_pairing());
+	return result;
+}
+
+// narrows a failing range of the batch down to its bad proofs.  a range that is
+// known to fail doesn't need checking again, and if the left half of a failing
+// range passes then the right half must fail
+static void find_bad_proofs(batch_terms &terms, unsigned int lo, unsigned int hi, bool known_bad, std::vector<bool> &valid)
+{
+	if (!known_bad && check_batch_terms(terms,lo,hi))
+	{
+		return;
+	}
 	
-	element_set1(t1);
+	if (hi - lo == 1)
+	{
+		valid[terms.entries[lo]] = false;
+		return;
+	}
 	
-	for (int i=0;i<c.get_count();i++)
+	unsigned int mid = lo + (hi - lo) / 2;
+	bool left_valid = check_batch_terms(terms,lo,mid);
+	if (!left_valid)
 	{
-		challenge::pair pair = c.get_pair(i);
-		vm.get_HWi(t0,pair._s);
-		element_pow_zn(t0,t0,pair._v);
-		
-		element_mul(t1,t1,t0);
+		find_bad_proofs(terms,lo,mid,true,valid);
 	}
+	find_bad_proofs(terms,mid,hi,left_valid,valid);
+}
+
+bool verify_proof_batch(std::vector<batch_entry> &entries, scheme_parameters &scheme, std::vector<bool> *valid)
+{
+	PBPDP_PHASE(phase_batch_verify);
+	PBPDP_TRACE("Verifying batch of " << entries.size() << " proofs.");
+	
+	std::vector<bool> entry_valid(entries.size(),true);
+	batch_terms terms;
+	terms.scheme = &scheme;
 	
-	element_pow_zn(t1,t1,gamma);
+	element_t A;
+	element_t B;
+	mpz_t delta;
 	
-	//element_pow_zn(t0,p.get_u(),r.get_mu());
-	element_pow_mpz(t0,p.get_u(),r.get_mu());
+	element_init_G1(A,scheme.get_pairing());
+	element_init_G1(B,scheme.get_pairing());
+	mpz_init(delta);
 	
-	element_mul(t0,t1,t0);
+	for (int k=0;k<entries.size();k++)
+	{
+		batch_entry &entry = entries[k];
+		audit_file file(entry.c,entry.vm);
+		if (!get_verification_terms(A,B,*entry.rp,&file,1,*entry.p,scheme))
+		{
+			entry_valid[k] = false;
+			continue;
+		}
+		
+		// small random weights stop invalid proofs from cancelling each other out
+		do
+		{
+			pbc_mpz_randomb(delta,batch_weight_bits);
+		} while (!mpz_sgn(delta));
+		
+		terms.A.push_back(element_s());
+		terms.B.push_back(element_s());
+		terms.R.push_back(element_s());
+		element_s *a = &terms.A.back();
+		element_s *b = &terms.B.back();
+		element_s *R = &terms.R.back();
+		element_init_G1(a,scheme.get_pairing());
+		element_init_G1(b,scheme.get_pairing());
+		element_init_GT(R,scheme.get_pairing());
+		
+		element_pow_mpz(a,A,delta);
+		element_pow_mpz(b,B,delta);
+		element_pow_mpz(R,entry.rp->get_R(),delta);
+		PBPDP_COUNT(counter_g1_exps,2);
+		PBPDP_COUNT(counter_gt_exps,1);
+		terms.p.push_back(entry.p);
+		terms.entries.push_back(k);
+	}
 	
-	element_pairing(rhs,t0,p.get_v());
+	if (!terms.entries.empty())
+	{
+		find_bad_proofs(terms,0,terms.entries.size(),false,entry_valid);
+	}
 	
-	element_printf("LHS: %B\n",lhs);
-	element_printf("RHS: %B\n",rhs);
+	bool result = true;
+	for (int k=0;k<entry_valid.size();k++)
+	{
+		result = result && entry_valid[k];
+	}
 	
-	// check that they are equal.  for now all of the elements should have been 
-	// fully stored so they should always be equal.  in the future i may have to 
-	// serialize one coordinate of some elements for transport, which will mean
-	// that they may be inverses of each other
-	bool result = !element_cmp(lhs,rhs);
+	for (int k=0;k<terms.entries.size();k++)
+	{
+		element_clear(&terms.A[k]);
+		element_clear(&terms.B[k]);
+		element_clear(&terms.R[k]);
+	}
+	mpz_clear(delta);
+	element_clear(B);
+	element_clear(A);
 	
-	// cleanup
-	element_clear(t1);
-	element_clear(rhs);
-	element_clear(lhs);
-	element_clear(t0);
-	element_clear(gamma);
+	if (valid)
+	{
+		*valid = entry_valid;
+	}
 	
-	std::cout << "Finished verifying proof." << std::endl;
+	PBPDP_TRACE("Finished verifying batch.");
 	
 	return result;
 }
@@ -570,7 +2614,13 @@ void element_hash::init(scheme_parameters &scheme)
 {
 	_hash_sz = _sha256.DigestSize();
 	_hash_buf = new unsigned char[_hash_sz];
-	_element_buf = new unsigned char[2*pairing_length_in_bytes_G1(scheme.get_pairing())];
+	// big enough for an element of any group, GT is the largest on asymmetric curves
+	pairing_s *pairing = scheme.get_pairing();
+	unsigned int element_len = pairing_length_in_bytes_G1(pairing);
+	element_len = std::max(element_len,(unsigned int)pairing_length_in_bytes_G2(pairing));
+	element_len = std::max(element_len,(unsigned int)pairing_length_in_bytes_GT(pairing));
+	element_len = std::max(element_len,(unsigned int)pairing_length_in_bytes_Zr(pairing));
+	_element_buf = new unsigned char[element_len];
 	_initialized = true;
 }
 
@@ -580,16 +2630,34 @@ void element_hash::cleanup()
 	{
 		delete[] _hash_buf;
 		delete[] _element_buf;
+		_initialized = false;
 	}
 }
 
 void element_hash::hash_data_to_element(element_t e,unsigned char *data,unsigned int len) const
 {
+	PBPDP_COUNT(counter_hashes,1);
 	_sha256.CalculateDigest(_hash_buf,data,len);
 	
 	element_from_hash(e,_hash_buf,_hash_sz);
 }
 
+void element_hash::hash_data_to_elements(element_s **out,const unsigned char *const *data,unsigned int len,unsigned int n) const
+{
+	unsigned char digests[hash_batch*sha256_digest_size];
+	for (unsigned int first=0;first<n;first+=hash_batch)
+	{
+		unsigned int count = n - first < hash_batch ? n - first : hash_batch;
+		PBPDP_COUNT(counter_hashes,count);
+		sha256_batch(digests,data+first,len,count);
+		// pbc maps each digest to a point on its own
+		for (int k=0;k<count;k++)
+		{
+			element_from_hash(out[first+k],digests+k*sha256_digest_size,sha256_digest_size);
+		}
+	}
+}
+
 void element_hash::hash_element_to_element(element_t out, element_t in) const
 {
 	unsigned int n = element_to_bytes(_element_buf,in);
@@ -599,6 +2667,7 @@ void element_hash::hash_element_to_element(element_t out, element_t in) const
 
 void element_hash::hash_data_to_mpz(mpz_t e,unsigned char *data,unsigned int len) const
 {
+	PBPDP_COUNT(counter_hashes,1);
 	_sha256.CalculateDigest(_hash_buf,data,len);
 	
 	mpz_import(e,len,1,sizeof(unsigned char),0,0,data);
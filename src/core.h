@@ -1,5 +1,14 @@
+#ifndef PBPDP_CORE_H
+#define PBPDP_CORE_H
+
+#include <cryptopp/sha.h>
 #include <pbc/pbc.h>
 #include <vector>
+#include <string>
+#include <atomic>
+#include <mutex>
+
+#include "element.h"
 
 // this is an implementation of 
 //
@@ -7,68 +16,146 @@
 
 namespace pbpdp
 {	
+	enum access_hint
+	{
+		access_normal,
+		access_sequential,		// every chunk in order (sig_gen)
+		access_random			// a sparse sample (gen_proof)
+	};
+	
 	class file
 	{
 	// file chunks should be smaller than N for the scheme to work.  otherwise the server can store m_i as m_i mod N.  
 	public:
+		virtual ~file() {}
+		
 		virtual void get_chunk(element_t e,unsigned int i) = 0; // gets the next chunk into element e
 		virtual void get_chunk(mpz_t e,unsigned int i) = 0; // gets the next chunk into mpz integer e
 		virtual unsigned int get_chunk_count() = 0; // gets the total number of chunks in the file
+		// implementations need not be thread safe, multi-threaded callers serialize access to get_chunk
+		
+		virtual void set_access_hint(access_hint hint) {} // tells the backend how chunks are about to be read
+		virtual void prefetch_chunks(unsigned int first,unsigned int count) {} // chunks [first,first+count) will be read soon
+	};
+	
+	// where streamed tags go as they are made, tag_store_writer is one
+	class tag_sink
+	{
+	public:
+		virtual ~tag_sink() {}
+		
+		virtual void put_tag(unsigned int i, element_t e) = 0; // only called from one thread
+		virtual void sync() {} // tags put so far must survive a crash once this returns
+	};
+	
+	struct stream_options
+	{
+		stream_options() : threads(1), range_size(64), queue_depth(4), checkpoint_path(0), checkpoint_interval(1 << 16) {}
+		
+		unsigned int	threads;				// exponentiation workers, 0 for one per core
+		unsigned int	range_size;				// chunks that move through the pipeline together
+		unsigned int	queue_depth;			// ranges waiting between two stages
+		const char *	checkpoint_path;		// 0 for no checkpoints
+		unsigned int	checkpoint_interval;	// chunks tagged between checkpoints
 	};
 	
 	
 	class serializable
 	{
 	public:
+		virtual ~serializable() {}
 		virtual void serialize(unsigned char *data,unsigned int size) const = 0;
 		virtual void deserialize(unsigned char *data,unsigned int size) = 0;
 		virtual unsigned int get_serialized_size() const = 0;
 	};
 	
-	class scheme_parameters //: public serializable
+	// pairing families pbc can generate parameters for.  the scheme keeps tags, u and
+	// H(W_i) in G1 and g, v and spk in G2, so asymmetric pairings get the short group for
+	// the per block values.  generated sizes are pbc's usual ones, around 80 bit security
+	enum curve_type
+	{
+		curve_a,		// symmetric, supersingular y^2 = x^3 + x, 160 bit r, 512 bit q
+		curve_a1,		// symmetric, composite order, 1024 bit N
+		curve_d,		// asymmetric MNT, embedding degree 6, 159 bit q
+		curve_e,		// symmetric, complex multiplication, 160 bit r, 1024 bit q
+		curve_f			// asymmetric Barreto-Naehrig, embedding degree 12, 160 bit q
+	};
+	
+	curve_type get_curve_type(const char *name); // "a", "a1", "d", "e" or "f"
+	const char* get_curve_name(curve_type curve);
+	
+	class type_a_g1;
+	
+	class scheme_parameters : public serializable
 	{
 	public:
-		scheme_parameters() : _initialized(false) {}
-		void init(char *params = 0);
-		//void init(unsigned char *data,unsigned int sz); // initializes from serialized form
+		scheme_parameters() : _initialized(false), _g_pp_ready(false), _id(0), _fast_G1(0) {}
+		~scheme_parameters() { cleanup(); }
+		void init(char *params = 0, curve_type curve = curve_a); // generates curve parameters when there are no params
 		void cleanup();
 	
 		pairing_s* get_pairing() { return _pairing; }
+		unsigned int get_id() const { return _id; } // unique per init, 0 when uninitialized
 		element_s* get_g() { return _g; }
+		void pair_with_g(element_t out, element_t a); // e(a,g), using a precomputed miller loop when possible
+		// out = in^e in G1.  type a curves use the fixed width backend in type_a.h
+		void pow_G1(element_t out, element_t in, element_t e);
+		void pow_G1_batch(element_s *const *out, element_s *const *in, element_t e, unsigned int n); // out[k] = in[k]^e, out[k] may be in[k]
+		bool get_fast_G1() const { return _fast_G1 != 0; }
+		const type_a_g1* get_type_a_G1() const { return _fast_G1; } // 0 unless get_fast_G1()
+		void set_fast_G1(bool enabled); // on by default where it applies
 		unsigned int get_name_len() const { return _name_length; }
 		unsigned int get_sig_len() const { return _sig_length; }
 		
 		bool get_L_available() const { return _L_available; }
 		__mpz_struct* get_L() { return _L; }
 		
-		//void serialize(unsigned char *data,unsigned int size) const;
-		//void deserialize(unsigned char *data,unsigned int size);
-		//unsigned int get_serialized_size() const;
+		void serialize(unsigned char *data,unsigned int size) const;
+		void deserialize(unsigned char *data,unsigned int size); // initializes from serialized form
+		unsigned int get_serialized_size() const;
 		
 	private:
+		// every element made with the scheme points into _pairing, so it stays where it is
+		scheme_parameters(const scheme_parameters&);
+		scheme_parameters& operator=(const scheme_parameters&);
+		
+		void init_pairing();
+		void precompute();
+	
 		bool				_initialized;
+		std::string			_param_str;
 		pairing_t 			_pairing;
 		element_t			_g;					// G2
+		pairing_pp_t		_g_pp;				// pairing_pp only fixes the first argument, so only for symmetric pairings
+		bool				_g_pp_ready;
 		mpz_t				_L;					// eulers totient
 		bool				_L_available;
 		unsigned int 		_name_length;
 		unsigned int		_sig_length;
 		pbc_param_t			_params;
+		unsigned int		_id;
+		type_a_g1*			_fast_G1;			// 0 unless the curve is type a
 	};
 	
 	class element_hash
 	{
 	public:
 		element_hash() : _initialized(false) {}
+		~element_hash() { cleanup(); }
 		void init(scheme_parameters &scheme);
 		void cleanup();
 	
 		void hash_data_to_element(element_t e,unsigned char *data,unsigned int len) const;
+		// n messages of len bytes hashed as a batch, the same points as hash_data_to_element
+		void hash_data_to_elements(element_s **out,const unsigned char *const *data,unsigned int len,unsigned int n) const;
 		void hash_element_to_element(element_t out, element_t in) const;
 		void hash_data_to_mpz(mpz_t e,unsigned char *data,unsigned int len) const;
 		void hash_mpz_to_mpz(mpz_t out,mpz_t in) const;
 		
 	private:
+		element_hash(const element_hash&);
+		element_hash& operator=(const element_hash&);
+		
 		bool						_initialized;
 		mutable CryptoPP::SHA256 	_sha256;
 		mutable unsigned char*		_hash_buf;
@@ -76,55 +163,109 @@ namespace pbpdp
 		mutable unsigned char*		_element_buf;
 	};
 	
-	class secret_parameters //: public serializable
+	class tag_store;
+	class hw_cache;
+	class mask_pool;
+	
+	class secret_parameters : public serializable
 	{
 	public:
-		secret_parameters() : _initialized(false) {}
+		secret_parameters() : _initialized(false), _scheme(0) {}
+		secret_parameters(secret_parameters &&other) : _initialized(false), _scheme(0) { swap(other); }
+		~secret_parameters() { cleanup(); }
+		secret_parameters& operator=(secret_parameters &&other) { swap(other); return *this; }
 		void init(scheme_parameters &scheme);
 		void cleanup();
+		void swap(secret_parameters &other);
 		
 		element_s* get_ssk() { return _ssk; }
 		element_s* get_x() { return _x; }
 		
-		//void serialize(unsigned char *data,unsigned int size) const;
-		//void deserialize(unsigned char *data,unsigned int size);
-		//unsigned int get_serialized_size() const;
+		void set_scheme(scheme_parameters &scheme) { _scheme = &scheme; } // needed before deserializing into an uninitialized object
+		void serialize(unsigned char *data,unsigned int size) const;
+		void deserialize(unsigned char *data,unsigned int size);
+		unsigned int get_serialized_size() const;
 		
 	private:
+		secret_parameters(const secret_parameters&);
+		secret_parameters& operator=(const secret_parameters&);
+	
 		bool				_initialized;
+		scheme_parameters*	_scheme;
 		element_t			_ssk;				// Zp
 		element_t 			_x;					// Zp
 	};
 
-	class public_parameters // : public serializable
+	class public_parameters : public serializable
 	{
 	public:
-		public_parameters() : _initialized(false) {}
-		void init(scheme_parameters &scheme, secret_parameters &sp);
+		public_parameters() : _initialized(false), _scheme(0), _sectors(0), _pairing_pp_ready(false) {}
+		public_parameters(public_parameters &&other) : _initialized(false), _scheme(0), _sectors(0), _pairing_pp_ready(false) { swap(other); }
+		~public_parameters() { cleanup(); }
+		public_parameters& operator=(public_parameters &&other) { swap(other); return *this; }
+		// each chunk is split into sectors with their own generator u_j.  a single sector
+		// of unbounded size is the original scheme
+		void init(scheme_parameters &scheme, secret_parameters &sp, unsigned int sectors = 1);
 		void cleanup();
+		void swap(public_parameters &other); // anything holding a pointer to either (mask_pool, auditor) follows the object, not the keys
 		
 		element_s* get_spk() { return _spk; }
-		element_s* get_u() { return _u; }
+		element_s* get_u(unsigned int j = 0) { return &_u[j]; }
+		element_pp_s* get_u_pp(unsigned int j) { return &_u_pp[j]; }
 		element_s* get_v() { return _v; }
-		element_s* get_pair() { return _euv; }
+		// e(a,v) and e(a,spk), using precomputed miller loops when possible
+		void pair_with_v(element_t out, element_t a);
+		void pair_with_spk(element_t out, element_t a);
+		
+		unsigned int get_sector_count() const { return _sectors; }
+		unsigned int get_sector_bits() const { return _sector_bits; }
+		void get_sector(mpz_t out, mpz_t m, unsigned int j) const; // sector j of chunk m
+		void pow_u(g1_element &out, mpz_t m, g1_element &t, mpz_value &z); // out = prod(u_j^m_j), t and z are scratch
+		
+		static unsigned int get_sector_bits(scheme_parameters &scheme);
+		static unsigned int sectors_for_block(scheme_parameters &scheme, unsigned int block_size);
 		
-		//void serialize(unsigned char *data,unsigned int size) const;
-		//void deserialize(unsigned char *data,unsigned int size);
-		//unsigned int get_serialized_size() const;
+		void set_scheme(scheme_parameters &scheme) { _scheme = &scheme; } // needed before deserializing into an uninitialized object
+		void serialize(unsigned char *data,unsigned int size) const;
+		void deserialize(unsigned char *data,unsigned int size);
+		unsigned int get_serialized_size() const;
 		
 	private:
+		public_parameters(const public_parameters&);
+		public_parameters& operator=(const public_parameters&);
+		
+		void allocate_sectors(unsigned int sectors);
+		void clear_sectors();
+		void precompute();
+		void clear_precomputed();
+	
 		bool 				_initialized;
+		scheme_parameters*	_scheme;
 		element_t			_spk;			// G2
-		element_t			_u;				// G1
+		element_s*			_u;				// G1, one per sector
+		element_pp_s*		_u_pp;			// fixed base tables for _u
+		unsigned int		_sectors;
+		unsigned int		_sector_bits;
 		element_t			_v;				// G2
-		element_t			_euv;			// GT
+		pairing_pp_t		_v_pp;
+		pairing_pp_t		_spk_pp;
+		bool				_pairing_pp_ready;
 	};
 
-	class verification_metadata //: public serializable
+	class verification_metadata : public serializable
 	{
 	public:
-		verification_metadata() : _initialized(false), _count(0) {}
-		void init(secret_parameters &s, public_parameters &p, scheme_parameters &scheme, file &f);
+		verification_metadata() : _initialized(false), _scheme(0), _authenticators(0), _count(0), _store(0), _serialize_tags(true), _dynamic(false), _next_id(0), _hw_cache(0) {}
+		~verification_metadata() { cleanup(); }
+		// name is get_name_len() bytes, random when 0.  tagging again under the same name
+		// gives the same tags
+		void init(secret_parameters &s, public_parameters &p, scheme_parameters &scheme, file &f, unsigned int threads = 1, const unsigned char *name = 0);
+		// tags a file whose tags don't fit in memory.  ranges of chunks go through a pipeline
+		// (read, hash, exponentiate, write) with bounded queues between the stages, and each
+		// tag goes to out once it is made.  with a checkpoint path the progress is saved
+		// every so often, and a run that finds a checkpoint for the same file and keys goes on
+		// after the last saved range.  no tags stay resident, attach the finished store to prove
+		void init_streaming(secret_parameters &s, public_parameters &p, scheme_parameters &scheme, file &f, tag_sink &out, const stream_options &options = stream_options());
 		void cleanup();
 		
 		void allocate_authenticators(unsigned int count, scheme_parameters &scheme);
@@ -132,32 +273,83 @@ namespace pbpdp
 		
 		bool check_sig(public_parameters &p, scheme_parameters &scheme);
 		
-		element_s* get_authenticator(unsigned int i) { return &_authenticators[i]; }
+		element_s* get_authenticator(unsigned int i) { return &_authenticators[i]; } // resident tags only
+		element_s* load_authenticator(unsigned int i, element_t scratch); // resident tag, or tag decoded from the store into scratch
+		void prefetch_authenticators(unsigned int first, unsigned int count); // reads ahead in the store, nothing for resident tags
+		unsigned int get_count() const { return _count; }
+		bool has_resident_authenticators() const { return _authenticators != 0; }
+		
+		// drops the in memory tags and reads them from store on demand instead.  the store
+		// must outlive the metadata (or the next attach_tag_store)
+		void attach_tag_store(tag_store &store);
+		void save_tags(const char *path);
+		// whether serialize includes the tags.  the verifier never needs them, and a
+		// prover with a tag store only needs the rest of the metadata
+		void set_serialize_tags(bool tags) { _serialize_tags = tags; }
+		
+		// dynamic operations.  W_i holds a block id rather than the position, ids are never
+		// reused, so only the touched block is tagged again and a stale block/tag pair can't
+		// be replayed.  the caller applies the same change to the stored file.  these need
+		// the secret key and resident tags
+		void update_block(unsigned int i, mpz_t m, secret_parameters &s, public_parameters &p);
+		void insert_block(unsigned int i, mpz_t m, secret_parameters &s, public_parameters &p);
+		void append_block(mpz_t m, secret_parameters &s, public_parameters &p);
+		void delete_block(unsigned int i);
+		unsigned int get_block_id(unsigned int i) const; // id of the block at position i
+		
+		// H(W_i) points are looked up in cache before hashing, 0 detaches.  the cache must
+		// have been made for the metadata's scheme and outlive the metadata (or the next
+		// attach_hw_cache)
+		void attach_hw_cache(hw_cache *cache);
 		
 		unsigned int get_W_size() const;
-		void append_index_to_W(unsigned int i) const;
-		void get_HWi(element_t e,unsigned int i) const;
+		void append_index_to_W(unsigned int id) const;
+		void get_HWi(element_t e,unsigned int i) const; // H(W) of the block at position i
 		void get_HWi(mpz_t e,unsigned int i) const;
+		void get_HWi(element_t e,unsigned int i,const element_hash &hasher,unsigned char *W) const; // uses caller owned hasher and W buffer
+		// H(W) of the blocks at n positions, hashed as a batch.  W is caller owned room for n W's
+		void get_HWi_batch(element_s *out,const unsigned int *positions,unsigned int n,const element_hash &hasher,unsigned char *W) const;
+		void init_W(unsigned char *W) const; // copies the name into a W buffer of get_W_size() bytes
 		void get_Hname(element_t e) const;  // returns the hash of the name (for signing)
 		void get_Hname(mpz_t e) const;
 		
-		//void serialize(unsigned char *data,unsigned int size) const;
-		//void deserialize(unsigned char *data,unsigned int size);
-		//unsigned int get_serialized_size() const;
+		void set_scheme(scheme_parameters &scheme) { _scheme = &scheme; } // needed before deserializing into an uninitialized object
+		void serialize(unsigned char *data,unsigned int size) const;
+		void deserialize(unsigned char *data,unsigned int size);
+		unsigned int get_serialized_size() const;
 		
 	private:
+		// not movable either, caches and auditors keep pointers to it
+		verification_metadata(const verification_metadata&);
+		verification_metadata& operator=(const verification_metadata&);
+		
+		// tags chunks in ranges claimed from next until all count chunks are done
+		void calculate_authenticators(secret_parameters &s, public_parameters &p, scheme_parameters &scheme, file &f, std::atomic<unsigned int> &next, std::mutex *file_lock);
+		void tag_block(element_t out, unsigned int id, mpz_t m, secret_parameters &s, public_parameters &p);
+		void materialize_ids();
+		unsigned int new_block_id();
+		void init_name(scheme_parameters &scheme, const unsigned char *name); // random when name is 0
+		void sign_name(secret_parameters &s, scheme_parameters &scheme);
+	
 		bool				_initialized;
+		scheme_parameters*	_scheme;
 		element_s*			_authenticators;
 		unsigned int 		_count;
+		tag_store*			_store;
+		bool				_serialize_tags;
+		bool				_dynamic;	// a dynamic operation happened, so _ids and _next_id are serialized
+		std::vector<unsigned int>	_ids;		// block id at each position, empty while ids == positions
+		unsigned int		_next_id;		// kept even when every block is deleted, ids are never reused
 		unsigned char *		_name;
 		unsigned int		_name_len;
 		unsigned char *		_name_sig;
 		unsigned int		_name_sig_len;
 		mutable unsigned char* 		_W_buffer;
 		element_hash		_hasher;
+		hw_cache*			_hw_cache;
 	};
 	
-	class challenge //: public serializable
+	class challenge : public serializable
 	{
 	public:
 		typedef struct 
@@ -165,52 +357,219 @@ namespace pbpdp
 			unsigned int		_s;
 			element_t			_v;
 		} pair;
+		
+		static const unsigned int seed_size = 32;
 	
-		challenge() : _initialized(false) {}
+		challenge() : _initialized(false), _scheme(0), _pairs(0), _count(0), _seeded(false), _chunk_count(0), _half_bits(0) {}
+		challenge(challenge &&other) : _initialized(false), _scheme(0), _pairs(0), _count(0), _seeded(false), _chunk_count(0), _half_bits(0) { swap(other); }
+		~challenge() { cleanup(); }
+		challenge& operator=(challenge &&other) { swap(other); return *this; }
 		void init(scheme_parameters &scheme, unsigned int c, unsigned int chunk_count);
+		// a challenge defined by a seed.  the indices are a pseudo-random permutation of
+		// the chunks (so c <= chunk_count and there are no repeats) and the coefficients are
+		// hashed from the seed, so both sides expand them on the fly.  seed is random when 0
+		void init_seeded(scheme_parameters &scheme, unsigned int c, unsigned int chunk_count, const unsigned char *seed = 0);
 		void cleanup();
+		void swap(challenge &other);
 		
 		unsigned int get_count() const { return _count; }
-		pair get_pair(unsigned int i) const { return _pairs[i]; }
+		bool is_seeded() const { return _seeded; }
+		// whether every index is below chunk_count.  a challenge off the wire is checked
+		// against the metadata before anything is looked up with it
+		bool fits(unsigned int chunk_count) const;
+		pair get_pair(unsigned int i) const { return _pairs[i]; } // explicit challenges only
+		void get_pair(unsigned int i, unsigned int &s, element_t v) const; // either kind, v must be in Zr
 		
-		//void serialize(unsigned char *data,unsigned int size) const;
-		//void deserialize(unsigned char *data,unsigned int size);
-		//unsigned int get_serialized_size() const;
+		void set_scheme(scheme_parameters &scheme) { _scheme = &scheme; } // needed before deserializing into an uninitialized object
+		void serialize(unsigned char *data,unsigned int size) const;
+		void deserialize(unsigned char *data,unsigned int size);
+		unsigned int get_serialized_size() const;
 		
 	private:
+		challenge(const challenge&);
+		challenge& operator=(const challenge&);
+		
+		void allocate_pairs(unsigned int c);
+		unsigned int permute_index(unsigned int i) const;
+		unsigned int feistel_round(unsigned int round, unsigned int half) const;
+	
 		bool				_initialized;
+		scheme_parameters*	_scheme;
 		pair *				_pairs;
 		unsigned int 		_count;
+		bool				_seeded;
+		unsigned char		_seed[seed_size];
+		unsigned int		_chunk_count;
+		unsigned int		_half_bits;			// the permutation works on 2*_half_bits bit indices
 	};
 
-	class response_proof //: public serializable
+	// which chunks a prover shard holds.  chunks are dealt out in stripes of stripe
+	// consecutive chunks, round robin over count shards
+	struct shard_spec
+	{
+		shard_spec() : index(0), count(1), stripe(1) {}
+		shard_spec(unsigned int index, unsigned int count, unsigned int stripe = 1) : index(index), count(count), stripe(stripe) {}
+		
+		bool valid() const { return count > 0 && stripe > 0 && index < count; }
+		bool holds(unsigned int chunk) const { return (chunk / stripe) % count == index; } // only once valid()
+		
+		unsigned int		index;
+		unsigned int		count;
+		unsigned int		stripe;
+	};
+	
+	// one shard's share of a proof, over the challenged chunks it holds:
+	// mu'_j = sum(v_i*m_ij) and sigma = prod(sigma_i^v_i).  these aren't masked, so the
+	// partials and whatever combines them belong on the prover's side; only the combined
+	// response_proof goes to the verifier
+	class partial_proof : public serializable
 	{
 	public:
-		response_proof() : _initialized(false) {}
-		void init(challenge &c, verification_metadata &vm, public_parameters &p, scheme_parameters &scheme, file &f);
+		partial_proof() : _initialized(false), _scheme(0), _mu_prime(0), _mu_count(0) {}
+		partial_proof(partial_proof &&other) : _initialized(false), _scheme(0), _mu_prime(0), _mu_count(0) { swap(other); }
+		~partial_proof() { cleanup(); }
+		partial_proof& operator=(partial_proof &&other) { swap(other); return *this; }
+		void init(challenge &c, verification_metadata &vm, public_parameters &p, scheme_parameters &scheme, file &f, const shard_spec &shard);
 		void cleanup();
+		void swap(partial_proof &other);
 		
-		//element_s* get_mu() { return _mu; }
-		__mpz_struct* get_mu() { return _mu; }
+		const shard_spec& get_shard() const { return _shard; }
+		__mpz_struct* get_mu_prime(unsigned int j = 0) { return &_mu_prime[j]; }
+		unsigned int get_mu_count() const { return _mu_count; }
+		element_s* get_sigma() { return _sigma; }
+		
+		void set_scheme(scheme_parameters &scheme) { _scheme = &scheme; } // needed before deserializing into an uninitialized object
+		void serialize(unsigned char *data,unsigned int size) const;
+		void deserialize(unsigned char *data,unsigned int size);
+		unsigned int get_serialized_size() const;
+		
+	private:
+		partial_proof(const partial_proof&);
+		partial_proof& operator=(const partial_proof&);
+		
+		void allocate(unsigned int sectors);
+	
+		bool				_initialized;
+		scheme_parameters*	_scheme;
+		shard_spec			_shard;
+		__mpz_struct*		_mu_prime;			// one per sector
+		unsigned int		_mu_count;
+		element_t			_sigma;				// G1
+	};
+	
+	// one file of an audit round over several files under the same keys.  the prover
+	// needs f, the verifier doesn't
+	struct audit_file
+	{
+		audit_file() : c(0), vm(0), f(0) {}
+		audit_file(challenge *c, verification_metadata *vm, file *f = 0) : c(c), vm(vm), f(f) {}
+		
+		challenge *				c;
+		verification_metadata *	vm;
+		file *					f;
+	};
+	
+	class response_proof : public serializable
+	{
+	public:
+		response_proof() : _initialized(false), _scheme(0), _mu(0), _mu_count(0) {}
+		response_proof(response_proof &&other) : _initialized(false), _scheme(0), _mu(0), _mu_count(0) { swap(other); }
+		~response_proof() { cleanup(); }
+		response_proof& operator=(response_proof &&other) { swap(other); return *this; }
+		void init(challenge &c, verification_metadata &vm, public_parameters &p, scheme_parameters &scheme, file &f, mask_pool *masks = 0); // takes R from masks if it has one
+		// the proof of the whole challenge from one partial per shard, each exactly once
+		void combine(std::vector<partial_proof*> &parts, public_parameters &p, scheme_parameters &scheme, mask_pool *masks = 0);
+		// one proof answering every file's challenge, all tagged with the same keys
+		void init(std::vector<audit_file> &files, public_parameters &p, scheme_parameters &scheme, mask_pool *masks = 0);
+		void cleanup();
+		void swap(response_proof &other);
+		
+		__mpz_struct* get_mu(unsigned int j = 0) { return &_mu[j]; }
+		unsigned int get_mu_count() const { return _mu_count; }
 		element_s* get_sigma() { return _sigma; }
 		element_s* get_R() { return _R; }
 		
-		//void serialize(unsigned char *data,unsigned int size) const;
-		//void deserialize(unsigned char *data,unsigned int size);
-		//unsigned int get_serialized_size() const;
+		void set_scheme(scheme_parameters &scheme) { _scheme = &scheme; } // needed before deserializing into an uninitialized object
+		void serialize(unsigned char *data,unsigned int size) const;
+		void deserialize(unsigned char *data,unsigned int size);
+		unsigned int get_serialized_size() const;
 		
 	private:
+		response_proof(const response_proof&);
+		response_proof& operator=(const response_proof&);
+		
+		void init_from_partials(std::vector<partial_proof*> &parts, public_parameters &p, scheme_parameters &scheme, mask_pool *masks); // sums them, then finish
+		void finish(__mpz_struct *mu_prime, public_parameters &p, scheme_parameters &scheme, mask_pool *masks); // masks mu' and sets R
+	
 		bool				_initialized;
-		//element_t			_mu;				// Zp
-		mpz_t				_mu;
+		scheme_parameters*	_scheme;
+		__mpz_struct*		_mu;				// one per sector
+		unsigned int		_mu_count;
 		element_t			_sigma;				// G1
 		element_t			_R;					// GT
 	};
 	
-	void key_gen(scheme_parameters &scheme, secret_parameters &s, public_parameters &p,char *params = 0);
-	void sig_gen(verification_metadata &vmd, secret_parameters &s, public_parameters &p, scheme_parameters &scheme, file &f);
+	// block_size of 0 tags each chunk as a single sector, otherwise chunks of block_size bytes are split into Zr sized sectors
+	void key_gen(scheme_parameters &scheme, secret_parameters &s, public_parameters &p,char *params = 0,unsigned int block_size = 0,curve_type curve = curve_a);
+	void sig_gen(verification_metadata &vmd, secret_parameters &s, public_parameters &p, scheme_parameters &scheme, file &f, unsigned int threads = 1);
+	void sig_gen_stream(verification_metadata &vmd, secret_parameters &s, public_parameters &p, scheme_parameters &scheme, file &f, tag_sink &out, const stream_options &options = stream_options());
 	bool check_sig(verification_metadata &vmd, public_parameters &p, scheme_parameters &scheme);
 	void gen_challenge(challenge &chal, scheme_parameters &scheme, unsigned int c, unsigned int chunk_count);
-	void gen_proof(response_proof &rp, challenge &c, verification_metadata &vm, public_parameters &p, scheme_parameters &scheme, file &f);
+	void gen_seeded_challenge(challenge &chal, scheme_parameters &scheme, unsigned int c, unsigned int chunk_count);
+	
+	// audit sizing.  if a fraction of the chunks is corrupted, a challenge of c distinct
+	// chunks misses all of them with a hypergeometric probability that depends on c and
+	// hardly at all on the file size, so a fixed c (about 460 for 99% at 1%) audits any file
+	double detection_probability(unsigned int chunk_count, unsigned int c, double corrupted_fraction);
+	unsigned int plan_challenge_size(unsigned int chunk_count, double target_detection, double corrupted_fraction); // smallest c reaching the target
+	
+	// seconds an audit costs each side, fixed + per_pair * c.  fit them from bench's
+	// gen_proof and verify_proof rows, or measure them with calibrate_challenge_costs
+	struct challenge_costs
+	{
+		challenge_costs() : prover_fixed(0), prover_per_pair(0), verifier_fixed(0), verifier_per_pair(0) {}
+		
+		double			prover_fixed;
+		double			prover_per_pair;
+		double			verifier_fixed;
+		double			verifier_per_pair;
+	};
+	
+	struct challenge_plan
+	{
+		unsigned int	c;
+		double			detection;			// probability the challenge catches the corruption
+		double			prover_seconds;
+		double			verifier_seconds;
+	};
+	
+	challenge_plan plan_challenge(unsigned int chunk_count, double target_detection, double corrupted_fraction, const challenge_costs &costs = challenge_costs());
+	// times proofs over vm and f at two challenge sizes on this machine
+	challenge_costs calibrate_challenge_costs(verification_metadata &vm, public_parameters &p, scheme_parameters &scheme, file &f);
+	void gen_proof(response_proof &rp, challenge &c, verification_metadata &vm, public_parameters &p, scheme_parameters &scheme, file &f, mask_pool *masks = 0);
+	// sharded provers: each shard proves the chunks it holds and one of them (or a
+	// coordinator) combines the partials.  the result verifies like gen_proof's
+	void gen_partial_proof(partial_proof &pp, challenge &c, verification_metadata &vm, public_parameters &p, scheme_parameters &scheme, file &f, const shard_spec &shard);
+	void combine_proofs(response_proof &rp, std::vector<partial_proof*> &parts, public_parameters &p, scheme_parameters &scheme, mask_pool *masks = 0);
 	bool verify_proof(response_proof &r, challenge &c, verification_metadata &vm, public_parameters &p, scheme_parameters &scheme);
-};
\ No newline at end of file
+	
+	// one (mu, sigma, R) for an audit round over many files of one owner, checked with a
+	// single pairing equation.  every file keeps its own challenge
+	void gen_multi_file_proof(response_proof &rp, std::vector<audit_file> &files, public_parameters &p, scheme_parameters &scheme, mask_pool *masks = 0);
+	bool verify_multi_file_proof(response_proof &rp, std::vector<audit_file> &files, public_parameters &p, scheme_parameters &scheme);
+	
+	struct batch_entry
+	{
+		response_proof *		rp;
+		challenge *				c;
+		verification_metadata *	vm;
+		public_parameters *		p;
+	};
+	
+	// verifies K proofs with K+1 pairings by combining them with random weights.  if the
+	// batch fails the bad proofs are found by recursively splitting it, and valid (when
+	// given) is set to the result for each entry.
+	bool verify_proof_batch(std::vector<batch_entry> &entries, scheme_parameters &scheme, std::vector<bool> *valid = 0);
+};
+
+#endif
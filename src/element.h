@@ -0,0 +1,220 @@
+#ifndef PBPDP_ELEMENT_H
+#define PBPDP_ELEMENT_H
+
+#include <pbc/pbc.h>
+#include <utility>
+#include <vector>
+
+// owning wrappers for pbc elements and gmp integers.  element_t and mpz_t are arrays
+// holding pointers to their data, so copying one shallowly leads to double frees and
+// forgetting a clear leaks.  these clear themselves and can only be moved, which also
+// makes them safe to keep in std::vector.  the group is part of the type, so a Zr value
+// can't be handed to something that expects G1.  get() gives the underlying element for
+// the pbc calls.
+
+namespace pbpdp
+{
+	enum group_tag
+	{
+		group_G1,
+		group_G2,
+		group_GT,
+		group_Zr
+	};
+
+	template <group_tag G> void init_in_group(element_s *e, pairing_s *pairing);
+	template <> inline void init_in_group<group_G1>(element_s *e, pairing_s *pairing) { element_init_G1(e,pairing); }
+	template <> inline void init_in_group<group_G2>(element_s *e, pairing_s *pairing) { element_init_G2(e,pairing); }
+	template <> inline void init_in_group<group_GT>(element_s *e, pairing_s *pairing) { element_init_GT(e,pairing); }
+	template <> inline void init_in_group<group_Zr>(element_s *e, pairing_s *pairing) { element_init_Zr(e,pairing); }
+
+	template <group_tag G>
+	class typed_element
+	{
+	public:
+		typed_element() : _initialized(false) {}
+		explicit typed_element(pairing_s *pairing) : _initialized(false) { init(pairing); }
+		typed_element(typed_element &&other) : _initialized(false) { swap(other); }
+		~typed_element() { cleanup(); }
+
+		typed_element& operator=(typed_element &&other)
+		{
+			swap(other);
+			return *this;
+		}
+
+		void init(pairing_s *pairing)
+		{
+			cleanup();
+			init_in_group<G>(_e,pairing);
+			_initialized = true;
+		}
+
+		void cleanup()
+		{
+			if (_initialized)
+			{
+				element_clear(_e);
+				_initialized = false;
+			}
+		}
+
+		// the data lives on the heap, so the handles can trade places
+		void swap(typed_element &other)
+		{
+			std::swap(_e[0],other._e[0]);
+			std::swap(_initialized,other._initialized);
+		}
+
+		bool is_initialized() const { return _initialized; }
+		element_s* get() { return _e; }
+
+	private:
+		typed_element(const typed_element&);
+		typed_element& operator=(const typed_element&);
+
+		element_t			_e;
+		bool				_initialized;
+	};
+
+	typedef typed_element<group_G1> g1_element;
+	typedef typed_element<group_G2> g2_element;
+	typedef typed_element<group_GT> gt_element;
+	typedef typed_element<group_Zr> zr_element;
+
+	// always initialized, a moved from value is just zero
+	class mpz_value
+	{
+	public:
+		mpz_value() { mpz_init(_z); }
+		mpz_value(mpz_value &&other) { mpz_init(_z); mpz_swap(_z,other._z); }
+		~mpz_value() { mpz_clear(_z); }
+
+		mpz_value& operator=(mpz_value &&other)
+		{
+			mpz_swap(_z,other._z);
+			return *this;
+		}
+
+		__mpz_struct* get() { return _z; }
+
+	private:
+		mpz_value(const mpz_value&);
+		mpz_value& operator=(const mpz_value&);
+
+		mpz_t				_z;
+	};
+
+	// a contiguous run of elements in one group, laid out the way multi_pow_zn and the
+	// element_s* interfaces want them.  it only grows, so once it has reached the size a
+	// caller needs, reusing it allocates nothing.  growing moves the elements, so
+	// pointers into the block are only good until the next reserve
+	template <group_tag G>
+	class element_block
+	{
+	public:
+		element_block() : _pairing(0) {}
+		element_block(element_block &&other) : _pairing(0) { swap(other); }
+		~element_block() { cleanup(); }
+
+		element_block& operator=(element_block &&other)
+		{
+			swap(other);
+			return *this;
+		}
+
+		void reserve(pairing_s *pairing, unsigned int count)
+		{
+			if (pairing != _pairing)
+			{
+				cleanup();
+				_pairing = pairing;
+			}
+			unsigned int old_size = _e.size();
+			if (count > old_size)
+			{
+				_e.resize(count);
+				for (int k=old_size;k<count;k++)
+				{
+					init_in_group<G>(&_e[k],pairing);
+				}
+			}
+		}
+
+		void cleanup()
+		{
+			for (int k=0;k<_e.size();k++)
+			{
+				element_clear(&_e[k]);
+			}
+			_e.clear();
+			_pairing = 0;
+		}
+
+		void swap(element_block &other)
+		{
+			_e.swap(other._e);
+			std::swap(_pairing,other._pairing);
+		}
+
+		unsigned int size() const { return _e.size(); }
+		element_s* get() { return _e.empty() ? 0 : &_e[0]; }
+		element_s* operator[](unsigned int k) { return &_e[k]; }
+
+	private:
+		element_block(const element_block&);
+		element_block& operator=(const element_block&);
+
+		std::vector<element_s>	_e;
+		pairing_s*				_pairing;
+	};
+
+	// the same for integers
+	class mpz_block
+	{
+	public:
+		mpz_block() {}
+		mpz_block(mpz_block &&other) { _z.swap(other._z); }
+		~mpz_block() { cleanup(); }
+
+		mpz_block& operator=(mpz_block &&other)
+		{
+			_z.swap(other._z);
+			return *this;
+		}
+
+		void reserve(unsigned int count)
+		{
+			unsigned int old_size = _z.size();
+			if (count > old_size)
+			{
+				_z.resize(count);
+				for (int k=old_size;k<count;k++)
+				{
+					mpz_init(&_z[k]);
+				}
+			}
+		}
+
+		void cleanup()
+		{
+			for (int k=0;k<_z.size();k++)
+			{
+				mpz_clear(&_z[k]);
+			}
+			_z.clear();
+		}
+
+		unsigned int size() const { return _z.size(); }
+		__mpz_struct* get() { return _z.empty() ? 0 : &_z[0]; }
+		__mpz_struct* operator[](unsigned int k) { return &_z[k]; }
+
+	private:
+		mpz_block(const mpz_block&);
+		mpz_block& operator=(const mpz_block&);
+
+		std::vector<__mpz_struct>	_z;
+	};
+}
+
+#endif
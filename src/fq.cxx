@@ -0,0 +1,589 @@
+#include "fq.h"
+
+#include <atomic>
+#include <cstring>
+#include <stdexcept>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define PBPDP_FQ_X86
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+namespace pbpdp
+{
+
+typedef unsigned __int128 uint128_t;
+
+static const unsigned int lane_bits = 52;
+static const uint64_t lane_mask = (1ULL << lane_bits) - 1;
+static const unsigned int lanes_r_bits = lane_bits * fq_lane_limbs;	// 520
+
+static void to_limbs(uint64_t *w, unsigned int n, const __mpz_struct *z)
+{
+	memset(w,0,n*sizeof(uint64_t));
+	size_t count;
+	mpz_export(w,&count,-1,sizeof(uint64_t),0,0,z);
+}
+
+static void from_limbs(__mpz_struct *z, const uint64_t *w, unsigned int n)
+{
+	mpz_import(z,n,-1,sizeof(uint64_t),0,0,w);
+}
+
+// r = t - q if that doesn't go negative (counting the carry out of t), else t
+static inline __attribute__((always_inline)) void reduce_once(uint64_t *r, const uint64_t *t, uint64_t top, const uint64_t *q)
+{
+	uint64_t d[fq_limbs];
+	uint64_t borrow = 0;
+	for (int j=0;j<fq_limbs;j++)
+	{
+		uint128_t diff = (uint128_t)t[j] - q[j] - borrow;
+		d[j] = (uint64_t)diff;
+		borrow = (uint64_t)(diff >> 64) & 1;
+	}
+	// keep t only when it was below q
+	uint64_t keep = -(uint64_t)(borrow > top);
+	for (int j=0;j<fq_limbs;j++)
+	{
+		r[j] = (t[j] & keep) | (d[j] & ~keep);
+	}
+}
+
+// r = a*b/2^512 mod q, one word of b at a time
+static inline __attribute__((always_inline)) void mont_mul(uint64_t *r, const uint64_t *a, const uint64_t *b, const uint64_t *q, uint64_t n0)
+{
+	uint64_t t[fq_limbs+2] = {};
+	#pragma GCC unroll 8
+	for (int i=0;i<fq_limbs;i++)
+	{
+		uint128_t c = 0;
+		#pragma GCC unroll 8
+		for (int j=0;j<fq_limbs;j++)
+		{
+			c = (uint128_t)a[j]*b[i] + t[j] + (uint64_t)(c >> 64);
+			t[j] = (uint64_t)c;
+		}
+		c = (uint128_t)t[fq_limbs] + (uint64_t)(c >> 64);
+		t[fq_limbs] = (uint64_t)c;
+		t[fq_limbs+1] = (uint64_t)(c >> 64);
+
+		// add m*q to clear the low word, then drop it
+		uint64_t m = t[0]*n0;
+		c = (uint128_t)m*q[0] + t[0];
+		#pragma GCC unroll 8
+		for (int j=1;j<fq_limbs;j++)
+		{
+			c = (uint128_t)m*q[j] + t[j] + (uint64_t)(c >> 64);
+			t[j-1] = (uint64_t)c;
+		}
+		c = (uint128_t)t[fq_limbs] + (uint64_t)(c >> 64);
+		t[fq_limbs-1] = (uint64_t)c;
+		t[fq_limbs] = t[fq_limbs+1] + (uint64_t)(c >> 64);
+	}
+	reduce_once(r,t,t[fq_limbs],q);
+}
+
+static void mul_portable(uint64_t *r, const uint64_t *a, const uint64_t *b, const uint64_t *q, uint64_t n0)
+{
+	mont_mul(r,a,b,q,n0);
+}
+
+#ifdef PBPDP_FQ_X86
+
+__attribute__((target("bmi2,adx")))
+static void mul_mulx(uint64_t *r, const uint64_t *a, const uint64_t *b, const uint64_t *q, uint64_t n0)
+{
+	mont_mul(r,a,b,q,n0);
+}
+
+// the lanes are eight elements in 52 bit limbs.  ifma multiplies the low 52 bits of two
+// words and adds the low or high half of the 104 bit product to a 64 bit accumulator, so
+// a whole row of partial products goes into the accumulators before any carrying
+
+// t has limbs of up to 64 bits.  carries them along and returns t mod 2^520
+__attribute__((target("avx512f,avx512ifma")))
+static inline void normalize_lanes(__m512i *t)
+{
+	const __m512i mask = _mm512_set1_epi64(lane_mask);
+	for (int j=0;j<fq_lane_limbs-1;j++)
+	{
+		t[j+1] = _mm512_add_epi64(t[j+1],_mm512_srli_epi64(t[j],lane_bits));
+		t[j] = _mm512_and_si512(t[j],mask);
+	}
+	t[fq_lane_limbs-1] = _mm512_and_si512(t[fq_lane_limbs-1],mask);
+}
+
+// r = t - q in the lanes where t >= q.  t is normalized and below 2q
+__attribute__((target("avx512f,avx512ifma")))
+static inline void reduce_once_lanes(fq_vector &r, const __m512i *t, const uint64_t *q)
+{
+	const __m512i mask = _mm512_set1_epi64(lane_mask);
+	__m512i d[fq_lane_limbs];
+	__m512i borrow = _mm512_setzero_si512();
+	for (int j=0;j<fq_lane_limbs;j++)
+	{
+		d[j] = _mm512_sub_epi64(_mm512_sub_epi64(t[j],_mm512_set1_epi64(q[j])),borrow);
+		borrow = _mm512_srli_epi64(d[j],63);
+		d[j] = _mm512_and_si512(d[j],mask);
+	}
+	__mmask8 keep = _mm512_test_epi64_mask(borrow,borrow);
+	for (int j=0;j<fq_lane_limbs;j++)
+	{
+		_mm512_store_si512(r.limb[j],_mm512_mask_blend_epi64(keep,d[j],t[j]));
+	}
+}
+
+__attribute__((target("avx512f,avx512ifma")))
+static void mul_lanes_ifma(fq_vector &r, const fq_vector &a, const fq_vector &b, const uint64_t *q, uint64_t n0)
+{
+	const __m512i zero = _mm512_setzero_si512();
+	const __m512i n0v = _mm512_set1_epi64(n0);
+	__m512i A[fq_lane_limbs];
+	__m512i t[fq_lane_limbs+1];
+	for (int j=0;j<fq_lane_limbs;j++)
+	{
+		A[j] = _mm512_load_si512(a.limb[j]);
+		t[j] = zero;
+	}
+	t[fq_lane_limbs] = zero;
+
+	for (int i=0;i<fq_lane_limbs;i++)
+	{
+		__m512i bi = _mm512_load_si512(b.limb[i]);
+		for (int j=0;j<fq_lane_limbs;j++)
+		{
+			t[j] = _mm512_madd52lo_epu64(t[j],A[j],bi);
+			t[j+1] = _mm512_madd52hi_epu64(t[j+1],A[j],bi);
+		}
+
+		// m*q clears the low 52 bits of t[0], what is above them carries into t[1]
+		__m512i m = _mm512_madd52lo_epu64(zero,t[0],n0v);
+		for (int j=0;j<fq_lane_limbs;j++)
+		{
+			__m512i qj = _mm512_set1_epi64(q[j]);
+			t[j] = _mm512_madd52lo_epu64(t[j],m,qj);
+			t[j+1] = _mm512_madd52hi_epu64(t[j+1],m,qj);
+		}
+		__m512i carry = _mm512_srli_epi64(t[0],lane_bits);
+		for (int j=0;j<fq_lane_limbs;j++)
+		{
+			t[j] = t[j+1];
+		}
+		t[0] = _mm512_add_epi64(t[0],carry);
+		t[fq_lane_limbs] = zero;
+	}
+
+	normalize_lanes(t);
+	reduce_once_lanes(r,t,q);
+}
+
+__attribute__((target("avx512f,avx512ifma")))
+static void add_lanes_ifma(fq_vector &r, const fq_vector &a, const fq_vector &b, const uint64_t *q)
+{
+	__m512i t[fq_lane_limbs];
+	for (int j=0;j<fq_lane_limbs;j++)
+	{
+		t[j] = _mm512_add_epi64(_mm512_load_si512(a.limb[j]),_mm512_load_si512(b.limb[j]));
+	}
+	normalize_lanes(t);
+	reduce_once_lanes(r,t,q);
+}
+
+__attribute__((target("avx512f,avx512ifma")))
+static void sub_lanes_ifma(fq_vector &r, const fq_vector &a, const fq_vector &b, const uint64_t *q)
+{
+	const __m512i mask = _mm512_set1_epi64(lane_mask);
+	const __m512i zero = _mm512_setzero_si512();
+	__m512i t[fq_lane_limbs];
+	__m512i borrow = zero;
+	for (int j=0;j<fq_lane_limbs;j++)
+	{
+		t[j] = _mm512_sub_epi64(_mm512_sub_epi64(_mm512_load_si512(a.limb[j]),_mm512_load_si512(b.limb[j])),borrow);
+		borrow = _mm512_srli_epi64(t[j],63);
+		t[j] = _mm512_and_si512(t[j],mask);
+	}
+	// add q back where it went negative, the carry out of the top limb cancels the borrow
+	__m512i negative = _mm512_sub_epi64(zero,borrow);
+	for (int j=0;j<fq_lane_limbs;j++)
+	{
+		t[j] = _mm512_add_epi64(t[j],_mm512_and_si512(_mm512_set1_epi64(q[j]),negative));
+	}
+	normalize_lanes(t);
+	for (int j=0;j<fq_lane_limbs;j++)
+	{
+		_mm512_store_si512(r.limb[j],t[j]);
+	}
+}
+
+__attribute__((target("avx512f,avx512ifma")))
+static unsigned int lanes_zero_ifma(const fq_vector &a)
+{
+	__m512i any = _mm512_setzero_si512();
+	for (int j=0;j<fq_lane_limbs;j++)
+	{
+		any = _mm512_or_si512(any,_mm512_load_si512(a.limb[j]));
+	}
+	return _mm512_testn_epi64_mask(any,any);
+}
+
+static bool cpu_has(fq_impl impl)
+{
+	unsigned int eax, ebx, ecx, edx;
+	if (!__get_cpuid(1,&eax,&ebx,&ecx,&edx))
+	{
+		return false;
+	}
+	// avx-512 needs the os to save the opmask and zmm registers too
+	bool avx512_os = false;
+	if (ecx & bit_OSXSAVE)
+	{
+		unsigned int xcr0_lo, xcr0_hi;
+		__asm__("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+		avx512_os = (xcr0_lo & 0xe6) == 0xe6;
+	}
+	if (!__get_cpuid_count(7,0,&eax,&ebx,&ecx,&edx))
+	{
+		return false;
+	}
+	bool mulx = (ebx & bit_BMI2) && (ebx & bit_ADX);
+	switch (impl)
+	{
+	case fq_mulx:
+		return mulx;
+	case fq_ifma:
+		return mulx && avx512_os && (ebx & bit_AVX512F) && (ebx & bit_AVX512IFMA);
+	default:
+		return true;
+	}
+}
+
+#endif
+
+bool fq_supported(fq_impl impl)
+{
+	if (impl == fq_portable)
+	{
+		return true;
+	}
+#ifdef PBPDP_FQ_X86
+	return cpu_has(impl);
+#else
+	return false;
+#endif
+}
+
+static fq_impl best_impl()
+{
+	if (fq_supported(fq_ifma))
+	{
+		return fq_ifma;
+	}
+	if (fq_supported(fq_mulx))
+	{
+		return fq_mulx;
+	}
+	return fq_portable;
+}
+
+// -1 until the first call picks one
+static std::atomic<int> current_impl(-1);
+
+fq_impl fq_get_impl()
+{
+	int impl = current_impl;
+	if (impl < 0)
+	{
+		impl = best_impl();
+		current_impl = impl;
+	}
+	return (fq_impl)impl;
+}
+
+void fq_set_impl(fq_impl impl)
+{
+	if (!fq_supported(impl))
+	{
+		throw std::runtime_error("fq_set_impl: not supported by this cpu");
+	}
+	current_impl = impl;
+}
+
+void fq_field::init(const __mpz_struct *q)
+{
+	if (mpz_cmp_ui(q,3) < 0 || mpz_even_p(q) || mpz_sizeinbase(q,2) > 64*fq_limbs)
+	{
+		throw std::runtime_error("fq_field: modulus must be odd and at most 512 bits");
+	}
+	cleanup();
+	_impl = fq_get_impl();
+
+	mpz_init_set(_q_mpz,q);
+	to_limbs(_q.limb,fq_limbs,q);
+
+	// -q^-1 mod 2^64 by newton's iteration, each step doubles the correct low bits
+	uint64_t inverse = _q.limb[0];
+	for (int k=0;k<5;k++)
+	{
+		inverse *= 2 - _q.limb[0]*inverse;
+	}
+	_n0 = -inverse;
+	_n0_52 = _n0 & lane_mask;
+
+	mpz_t t;
+	mpz_init(t);
+	mpz_setbit(t,64*fq_limbs);
+	mpz_mod(t,t,q);
+	to_limbs(_one.limb,fq_limbs,t);
+	mpz_mul(t,t,t);
+	mpz_mod(t,t,q);
+	to_limbs(_r2.limb,fq_limbs,t);
+	mpz_sub_ui(t,q,2);
+	to_limbs(_q_minus_2,fq_limbs,t);
+
+	for (int j=0;j<fq_lane_limbs;j++)
+	{
+		mpz_tdiv_q_2exp(t,q,lane_bits*j);
+		_q52[j] = mpz_get_ui(t) & lane_mask;
+	}
+	mpz_init(_lanes_r_inv);
+	mpz_setbit(_lanes_r_inv,lanes_r_bits);
+	mpz_invert(_lanes_r_inv,_lanes_r_inv,q);
+	mpz_clear(t);
+
+	_initialized = true;
+
+	mpz_t one;
+	mpz_init_set_ui(one,1);
+	for (int k=0;k<fq_lanes;k++)
+	{
+		set_lane_mpz(_lanes_one,k,one);
+	}
+	mpz_clear(one);
+}
+
+void fq_field::cleanup()
+{
+	if (_initialized)
+	{
+		mpz_clear(_lanes_r_inv);
+		mpz_clear(_q_mpz);
+		_initialized = false;
+	}
+}
+
+void fq_field::set_mpz(fq_element &r, const __mpz_struct *z) const
+{
+	// z*2^512 from z's plain limbs
+	mpz_t t;
+	mpz_init(t);
+	mpz_mod(t,z,_q_mpz);
+	to_limbs(r.limb,fq_limbs,t);
+	mpz_clear(t);
+	mul(r,r,_r2);
+}
+
+void fq_field::get_mpz(__mpz_struct *z, const fq_element &a) const
+{
+	fq_element plain;
+	fq_element unit = {};
+	unit.limb[0] = 1;
+	mul(plain,a,unit);
+	from_limbs(z,plain.limb,fq_limbs);
+}
+
+bool fq_field::is_zero(const fq_element &a) const
+{
+	uint64_t any = 0;
+	for (int j=0;j<fq_limbs;j++)
+	{
+		any |= a.limb[j];
+	}
+	return !any;
+}
+
+void fq_field::add(fq_element &r, const fq_element &a, const fq_element &b) const
+{
+	uint64_t t[fq_limbs];
+	uint64_t carry = 0;
+	for (int j=0;j<fq_limbs;j++)
+	{
+		uint128_t sum = (uint128_t)a.limb[j] + b.limb[j] + carry;
+		t[j] = (uint64_t)sum;
+		carry = (uint64_t)(sum >> 64);
+	}
+	reduce_once(r.limb,t,carry,_q.limb);
+}
+
+void fq_field::sub(fq_element &r, const fq_element &a, const fq_element &b) const
+{
+	uint64_t borrow = 0;
+	for (int j=0;j<fq_limbs;j++)
+	{
+		uint128_t diff = (uint128_t)a.limb[j] - b.limb[j] - borrow;
+		r.limb[j] = (uint64_t)diff;
+		borrow = (uint64_t)(diff >> 64) & 1;
+	}
+	// add q back if it went negative
+	uint64_t negative = -borrow;
+	uint64_t carry = 0;
+	for (int j=0;j<fq_limbs;j++)
+	{
+		uint128_t sum = (uint128_t)r.limb[j] + (_q.limb[j] & negative) + carry;
+		r.limb[j] = (uint64_t)sum;
+		carry = (uint64_t)(sum >> 64);
+	}
+}
+
+void fq_field::mul(fq_element &r, const fq_element &a, const fq_element &b) const
+{
+#ifdef PBPDP_FQ_X86
+	if (_impl != fq_portable)
+	{
+		mul_mulx(r.limb,a.limb,b.limb,_q.limb,_n0);
+		return;
+	}
+#endif
+	mul_portable(r.limb,a.limb,b.limb,_q.limb,_n0);
+}
+
+// a^(q-2) a nibble of the exponent at a time
+void fq_field::inv(fq_element &r, const fq_element &a) const
+{
+	fq_element table[16];
+	table[0] = _one;
+	table[1] = a;
+	for (int k=2;k<16;k++)
+	{
+		mul(table[k],table[k-1],a);
+	}
+	fq_element x = _one;
+	for (int bit=64*fq_limbs-4;bit>=0;bit-=4)
+	{
+		for (int k=0;k<4;k++)
+		{
+			sqr(x,x);
+		}
+		unsigned int nibble = (_q_minus_2[bit/64] >> (bit%64)) & 15;
+		if (nibble)
+		{
+			mul(x,x,table[nibble]);
+		}
+	}
+	r = x;
+}
+
+void fq_field::set_lane_mpz(fq_vector &r, unsigned int lane, const __mpz_struct *z) const
+{
+	mpz_t t;
+	mpz_init(t);
+	mpz_mod(t,z,_q_mpz);
+	mpz_mul_2exp(t,t,lanes_r_bits);
+	mpz_mod(t,t,_q_mpz);
+	uint64_t w[fq_limbs+2];
+	to_limbs(w,fq_limbs+2,t);
+	mpz_clear(t);
+
+	for (int j=0;j<fq_lane_limbs;j++)
+	{
+		unsigned int bit = lane_bits*j;
+		uint64_t limb = w[bit/64] >> (bit%64);
+		if (bit%64 > 64 - lane_bits)
+		{
+			limb |= w[bit/64+1] << (64 - bit%64);
+		}
+		r.limb[j][lane] = limb & lane_mask;
+	}
+}
+
+void fq_field::get_lane_mpz(__mpz_struct *z, const fq_vector &a, unsigned int lane) const
+{
+	uint64_t w[fq_limbs+2] = {};
+	for (int j=0;j<fq_lane_limbs;j++)
+	{
+		unsigned int bit = lane_bits*j;
+		uint64_t limb = a.limb[j][lane];
+		w[bit/64] |= limb << (bit%64);
+		if (bit%64 > 64 - lane_bits)
+		{
+			w[bit/64+1] |= limb >> (64 - bit%64);
+		}
+	}
+	from_limbs(z,w,fq_limbs+2);
+	mpz_mul(z,z,_lanes_r_inv);
+	mpz_mod(z,z,_q_mpz);
+}
+
+unsigned int fq_field::lanes_zero(const fq_vector &a) const
+{
+#ifdef PBPDP_FQ_X86
+	if (has_lanes())
+	{
+		return lanes_zero_ifma(a);
+	}
+#endif
+	throw std::runtime_error("fq_field: no lane operations on this cpu");
+}
+
+void fq_field::add_lanes(fq_vector &r, const fq_vector &a, const fq_vector &b) const
+{
+#ifdef PBPDP_FQ_X86
+	if (has_lanes())
+	{
+		add_lanes_ifma(r,a,b,_q52);
+		return;
+	}
+#endif
+	throw std::runtime_error("fq_field: no lane operations on this cpu");
+}
+
+void fq_field::sub_lanes(fq_vector &r, const fq_vector &a, const fq_vector &b) const
+{
+#ifdef PBPDP_FQ_X86
+	if (has_lanes())
+	{
+		sub_lanes_ifma(r,a,b,_q52);
+		return;
+	}
+#endif
+	throw std::runtime_error("fq_field: no lane operations on this cpu");
+}
+
+void fq_field::mul_lanes(fq_vector &r, const fq_vector &a, const fq_vector &b) const
+{
+#ifdef PBPDP_FQ_X86
+	if (has_lanes())
+	{
+		mul_lanes_ifma(r,a,b,_q52,_n0_52);
+		return;
+	}
+#endif
+	throw std::runtime_error("fq_field: no lane operations on this cpu");
+}
+
+void fq_field::inv_lanes(fq_vector &r, const fq_vector &a) const
+{
+	fq_vector table[16];
+	table[0] = _lanes_one;
+	table[1] = a;
+	for (int k=2;k<16;k++)
+	{
+		mul_lanes(table[k],table[k-1],a);
+	}
+	fq_vector x = _lanes_one;
+	for (int bit=64*fq_limbs-4;bit>=0;bit-=4)
+	{
+		for (int k=0;k<4;k++)
+		{
+			sqr_lanes(x,x);
+		}
+		unsigned int nibble = (_q_minus_2[bit/64] >> (bit%64)) & 15;
+		if (nibble)
+		{
+			mul_lanes(x,x,table[nibble]);
+		}
+	}
+	r = x;
+}
+
+};
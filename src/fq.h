@@ -0,0 +1,98 @@
+#ifndef PBPDP_FQ_H
+#define PBPDP_FQ_H
+
+#include <stdint.h>
+#include <gmp.h>
+
+// fixed width arithmetic modulo an odd q of at most 512 bits, the base field of the type
+// a curves.  pbc does its field arithmetic with gmp's variable length routines, which
+// spend much of their time on lengths and carries that never change for one modulus.
+// elements here are eight 64 bit limbs in montgomery form, multiplied with a loop of
+// fixed length.  where the cpu has avx-512 ifma there are also lane operations, on eight
+// independent elements at a time held in 52 bit limbs, for curve code that runs the same
+// steps on several points.  the implementation is picked at run time like sha256's.
+
+namespace pbpdp
+{
+	static const unsigned int fq_limbs = 8;
+	static const unsigned int fq_lanes = 8;
+	static const unsigned int fq_lane_limbs = 10;	// 52 bits each
+
+	enum fq_impl
+	{
+		fq_portable,
+		fq_mulx,			// the same loop built for bmi2 and adx
+		fq_ifma				// mulx for single elements, avx-512 ifma for lanes
+	};
+
+	bool fq_supported(fq_impl impl);
+	fq_impl fq_get_impl();
+	void fq_set_impl(fq_impl impl); // fields initialized afterwards use it, throws if the cpu lacks it
+
+	// x*2^512 mod q, least significant limb first
+	struct fq_element
+	{
+		uint64_t				limb[fq_limbs];
+	};
+
+	// eight elements x*2^520 mod q, limb major
+	struct fq_vector
+	{
+		alignas(64) uint64_t	limb[fq_lane_limbs][fq_lanes];
+	};
+
+	// every result is fully reduced, and any argument may also be the result
+	class fq_field
+	{
+	public:
+		fq_field() : _initialized(false) {}
+		~fq_field() { cleanup(); }
+		void init(const __mpz_struct *q); // throws unless q is odd and at most 512 bits
+		void cleanup();
+
+		fq_impl get_impl() const { return _impl; }
+		const __mpz_struct* get_q() const { return _q_mpz; }
+
+		void set_mpz(fq_element &r, const __mpz_struct *z) const; // z mod q
+		void get_mpz(__mpz_struct *z, const fq_element &a) const;
+		const fq_element& one() const { return _one; }
+		bool is_zero(const fq_element &a) const;
+
+		void add(fq_element &r, const fq_element &a, const fq_element &b) const;
+		void sub(fq_element &r, const fq_element &a, const fq_element &b) const;
+		void mul(fq_element &r, const fq_element &a, const fq_element &b) const;
+		void sqr(fq_element &r, const fq_element &a) const { mul(r,a,a); }
+		void inv(fq_element &r, const fq_element &a) const; // a^(q-2), so 0 for 0
+
+		// lane operations, only when has_lanes()
+		bool has_lanes() const { return _impl == fq_ifma; }
+		void set_lane_mpz(fq_vector &r, unsigned int lane, const __mpz_struct *z) const;
+		void get_lane_mpz(__mpz_struct *z, const fq_vector &a, unsigned int lane) const;
+		const fq_vector& lanes_one() const { return _lanes_one; }
+		unsigned int lanes_zero(const fq_vector &a) const; // bit k set when lane k is 0
+		void add_lanes(fq_vector &r, const fq_vector &a, const fq_vector &b) const;
+		void sub_lanes(fq_vector &r, const fq_vector &a, const fq_vector &b) const;
+		void mul_lanes(fq_vector &r, const fq_vector &a, const fq_vector &b) const;
+		void sqr_lanes(fq_vector &r, const fq_vector &a) const { mul_lanes(r,a,a); }
+		void inv_lanes(fq_vector &r, const fq_vector &a) const;
+
+	private:
+		fq_field(const fq_field&);
+		fq_field& operator=(const fq_field&);
+
+		bool				_initialized;
+		fq_impl				_impl;
+		mpz_t				_q_mpz;
+		mpz_t				_lanes_r_inv;		// 2^-520 mod q
+		fq_element			_q;
+		fq_element			_one;				// 2^512 mod q
+		fq_element			_r2;				// 2^1024 mod q
+		uint64_t			_n0;				// -q^-1 mod 2^64
+		uint64_t			_q_minus_2[fq_limbs];
+		uint64_t			_q52[fq_lane_limbs];
+		uint64_t			_n0_52;				// -q^-1 mod 2^52
+		fq_vector			_lanes_one;			// 2^520 mod q in every lane
+	};
+};
+
+#endif
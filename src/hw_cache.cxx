@@ -0,0 +1,170 @@
+#include "hw_cache.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#include <cerrno>
+#include <stdexcept>
+#include <vector>
+
+namespace pbpdp
+{
+
+// allowance for the list node, hash bucket and string headers of each entry
+static const unsigned int hw_cache_entry_overhead = 128;
+
+void hw_cache::init(scheme_parameters &scheme, const hw_cache_options &options)
+{
+	cleanup();
+	
+	_options = options;
+	_scheme_id = scheme.get_id();
+	_value_size = pairing_length_in_bytes_G1(scheme.get_pairing());
+	// W is the name plus a 32 bit id
+	_capacity = _options.memory_bytes / (scheme.get_name_len() + sizeof(unsigned int) + _value_size + hw_cache_entry_overhead);
+	memset(&_stats,0,sizeof(_stats));
+	
+	if (_options.disk_bytes > 0 && !_options.spill_path.empty())
+	{
+		_fd = ::open(_options.spill_path.c_str(),O_RDWR | O_CREAT | O_TRUNC,0600);
+		if (_fd < 0)
+		{
+			throw std::runtime_error("hw_cache: unable to open " + _options.spill_path + ": " + strerror(errno));
+		}
+	}
+	_initialized = true;
+}
+
+void hw_cache::cleanup()
+{
+	if (_fd >= 0)
+	{
+		::close(_fd);
+		unlink(_options.spill_path.c_str());
+		_fd = -1;
+	}
+	_lru.clear();
+	_entries.clear();
+	_spilled.clear();
+	_spill_end = 0;
+	_scheme_id = 0;
+	_initialized = false;
+}
+
+bool hw_cache::lookup(element_t e, const unsigned char *W, unsigned int W_len)
+{
+	std::string key((const char*)W,W_len);
+	
+	std::lock_guard<std::mutex> lock(_lock);
+	if (!_initialized)
+	{
+		return false;
+	}
+	
+	std::unordered_map<std::string,lru_list::iterator>::iterator it = _entries.find(key);
+	if (it != _entries.end())
+	{
+		_lru.splice(_lru.begin(),_lru,it->second);
+		element_from_bytes(e,(unsigned char*)&it->second->second[0]);
+		_stats.hits++;
+		return true;
+	}
+	
+	std::unordered_map<std::string,uint64_t>::iterator sp = _spilled.find(key);
+	if (sp != _spilled.end())
+	{
+		std::vector<unsigned char> value(_value_size);
+		if (pread(_fd,&value[0],_value_size,sp->second) == (ssize_t)_value_size)
+		{
+			element_from_bytes(e,&value[0]);
+			_spilled.erase(sp);
+			_stats.disk_hits++;
+			
+			// back into memory, it's hot again
+			_lru.push_front(std::make_pair(key,std::string((const char*)&value[0],_value_size)));
+			_entries[key] = _lru.begin();
+			while (_lru.size() > _capacity)
+			{
+				_entries.erase(_lru.back().first);
+				spill(_lru.back().first,_lru.back().second);
+				_lru.pop_back();
+				_stats.evictions++;
+			}
+			return true;
+		}
+		_spilled.erase(sp);
+	}
+	
+	_stats.misses++;
+	return false;
+}
+
+void hw_cache::insert(const unsigned char *W, unsigned int W_len, element_t e)
+{
+	if (_capacity == 0)
+	{
+		return;
+	}
+	
+	std::string key((const char*)W,W_len);
+	std::string value(_value_size,'\0');
+	element_to_bytes((unsigned char*)&value[0],e);
+	
+	std::lock_guard<std::mutex> lock(_lock);
+	if (!_initialized || _entries.count(key))
+	{
+		return;
+	}
+	
+	_lru.push_front(std::make_pair(key,value));
+	_entries[key] = _lru.begin();
+	while (_lru.size() > _capacity)
+	{
+		_entries.erase(_lru.back().first);
+		spill(_lru.back().first,_lru.back().second);
+		_lru.pop_back();
+		_stats.evictions++;
+	}
+}
+
+// called with the lock held
+void hw_cache::spill(const std::string &key, const std::string &value)
+{
+	if (_fd < 0)
+	{
+		return;
+	}
+	
+	// when the spill file is full start over rather than track free space
+	if (_spill_end + _value_size > _options.disk_bytes)
+	{
+		_spilled.clear();
+		_spill_end = 0;
+	}
+	if (pwrite(_fd,value.data(),_value_size,_spill_end) != (ssize_t)_value_size)
+	{
+		return;	// losing a cached point only costs a hash
+	}
+	_spilled[key] = _spill_end;
+	_spill_end += _value_size;
+	_stats.spills++;
+}
+
+void hw_cache::clear()
+{
+	std::lock_guard<std::mutex> lock(_lock);
+	_lru.clear();
+	_entries.clear();
+	_spilled.clear();
+	_spill_end = 0;
+}
+
+hw_cache_stats hw_cache::get_stats()
+{
+	std::lock_guard<std::mutex> lock(_lock);
+	hw_cache_stats stats = _stats;
+	stats.entries = _lru.size();
+	return stats;
+}
+
+};
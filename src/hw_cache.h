@@ -0,0 +1,89 @@
+#ifndef PBPDP_HW_CACHE_H
+#define PBPDP_HW_CACHE_H
+
+#include <stdint.h>
+#include <string>
+#include <list>
+#include <unordered_map>
+#include <mutex>
+
+#include "core.h"
+
+// a cache of H(W_i) points for the verifier.  hashing to G1 costs a square root, and an
+// auditor challenges the same files over and over, so verification_metadata looks the
+// point up here before hashing.  entries are keyed by W = name || block id, which is
+// unique to a block version (ids are never reused), so updated blocks never hit stale
+// points.  H only depends on the scheme's pairing, not the keys, so one cache can be
+// shared by every file an auditor checks under the scheme it was made for.  metadata
+// under any other scheme refuses to attach it.
+//
+// the most recently used points are kept in memory up to memory_bytes.  with a spill
+// path, points evicted from memory are written there (up to disk_bytes, then the spill
+// file starts over) and read back instead of hashed again.
+
+namespace pbpdp
+{
+	struct hw_cache_options
+	{
+		hw_cache_options() : memory_bytes(64 << 20), disk_bytes(0) {}
+		
+		size_t			memory_bytes;		// rough limit on memory used by cached points
+		uint64_t		disk_bytes;			// size of the spill file, 0 disables spilling
+		std::string		spill_path;
+	};
+	
+	struct hw_cache_stats
+	{
+		uint64_t		hits;				// found in memory
+		uint64_t		disk_hits;			// read back from the spill file
+		uint64_t		misses;				// had to be hashed
+		uint64_t		evictions;			// dropped from memory
+		uint64_t		spills;				// written to the spill file
+		size_t			entries;			// points in memory now
+	};
+	
+	class hw_cache
+	{
+	public:
+		hw_cache() : _initialized(false), _scheme_id(0), _value_size(0), _capacity(0), _fd(-1), _spill_end(0) {}
+		~hw_cache() { cleanup(); }
+		
+		void init(scheme_parameters &scheme, const hw_cache_options &options = hw_cache_options());
+		void cleanup();
+		
+		unsigned int get_scheme_id() const { return _scheme_id; } // the scheme's get_id() at init
+		
+		// these are safe to call from several threads
+		bool lookup(element_t e, const unsigned char *W, unsigned int W_len);
+		void insert(const unsigned char *W, unsigned int W_len, element_t e);
+		void clear();
+		
+		hw_cache_stats get_stats();
+		
+	private:
+		hw_cache(const hw_cache&);
+		hw_cache& operator=(const hw_cache&);
+	
+		typedef std::list<std::pair<std::string,std::string> > lru_list;
+		
+		void spill(const std::string &key, const std::string &value);
+	
+		bool				_initialized;
+		hw_cache_options	_options;
+		unsigned int		_scheme_id;
+		unsigned int		_value_size;	// uncompressed G1, so a hit needs no square root
+		size_t				_capacity;		// entries held in memory
+		
+		std::mutex			_lock;
+		lru_list			_lru;			// most recently used first
+		std::unordered_map<std::string,lru_list::iterator>	_entries;
+		
+		int					_fd;
+		uint64_t			_spill_end;
+		std::unordered_map<std::string,uint64_t>	_spilled;	// offset of each point in the spill file
+		
+		hw_cache_stats		_stats;
+	};
+};
+
+#endif
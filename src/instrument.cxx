@@ -0,0 +1,180 @@
+#include "instrument.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+
+namespace pbpdp
+{
+
+static const char *counter_names[counter_count] =
+{
+	"pairings",
+	"g1_exps",
+	"gt_exps",
+	"multiexp_terms",
+	"hash_to_g1",
+	"hashes",
+	"chunks_read",
+	"bytes_read"
+};
+
+static const char *phase_names[phase_count] =
+{
+	"sig_gen",
+	"check_sig",
+	"challenge",
+	"proof",
+	"proof_read",
+	"verify",
+	"verify_hash",
+	"batch_verify"
+};
+
+static std::atomic<uint64_t> counters[counter_count];
+static std::atomic<uint64_t> phase_calls[phase_count];
+static std::atomic<uint64_t> phase_nanoseconds[phase_count];
+static std::atomic<instrument_sink*> current_sink(0);
+
+const char* get_counter_name(instrument_counter c)
+{
+	return counter_names[c];
+}
+
+const char* get_phase_name(instrument_phase p)
+{
+	return phase_names[p];
+}
+
+void memory_sink::trace(const std::string &message)
+{
+	std::lock_guard<std::mutex> lock(_lock);
+	if (_max_traces == 0)
+	{
+		return;
+	}
+	if (_traces.size() >= _max_traces)
+	{
+		_traces.erase(_traces.begin());
+	}
+	_traces.push_back(message);
+}
+
+void memory_sink::publish(const instrument_snapshot &snapshot)
+{
+	std::lock_guard<std::mutex> lock(_lock);
+	_snapshot = snapshot;
+}
+
+instrument_snapshot memory_sink::get_snapshot()
+{
+	std::lock_guard<std::mutex> lock(_lock);
+	return _snapshot;
+}
+
+std::vector<std::string> memory_sink::get_traces()
+{
+	std::lock_guard<std::mutex> lock(_lock);
+	return _traces;
+}
+
+void metrics_file_sink::trace(const std::string &message)
+{
+	if (_trace_stream)
+	{
+		std::lock_guard<std::mutex> lock(_lock);
+		*_trace_stream << message << std::endl;
+	}
+}
+
+void metrics_file_sink::publish(const instrument_snapshot &snapshot)
+{
+	std::lock_guard<std::mutex> lock(_lock);
+	
+	// write aside and rename, so a reader never sees half a file
+	std::string tmp = _path + ".tmp";
+	std::ofstream out(tmp.c_str());
+	for (int i=0;i<counter_count;i++)
+	{
+		out << "pbpdp_" << counter_names[i] << "_total " << snapshot.counters[i] << "\n";
+	}
+	for (int i=0;i<phase_count;i++)
+	{
+		out << "pbpdp_" << phase_names[i] << "_calls " << snapshot.phase_calls[i] << "\n";
+		out << "pbpdp_" << phase_names[i] << "_seconds " << snapshot.phase_seconds[i] << "\n";
+	}
+	out.close();
+	if (out.fail() || rename(tmp.c_str(),_path.c_str()) != 0)
+	{
+		remove(tmp.c_str());
+	}
+}
+
+namespace instrument
+{
+
+void set_sink(instrument_sink *sink)
+{
+	current_sink = sink;
+}
+
+void add(instrument_counter c, uint64_t n)
+{
+	counters[c].fetch_add(n,std::memory_order_relaxed);
+}
+
+void add_phase(instrument_phase p, double seconds)
+{
+	phase_calls[p].fetch_add(1,std::memory_order_relaxed);
+	phase_nanoseconds[p].fetch_add((uint64_t)(seconds*1e9),std::memory_order_relaxed);
+}
+
+void trace(const std::string &message)
+{
+	instrument_sink *sink = current_sink;
+	if (sink)
+	{
+		sink->trace(message);
+	}
+}
+
+instrument_snapshot get_snapshot()
+{
+	instrument_snapshot snapshot;
+	for (int i=0;i<counter_count;i++)
+	{
+		snapshot.counters[i] = counters[i].load(std::memory_order_relaxed);
+	}
+	for (int i=0;i<phase_count;i++)
+	{
+		snapshot.phase_calls[i] = phase_calls[i].load(std::memory_order_relaxed);
+		snapshot.phase_seconds[i] = phase_nanoseconds[i].load(std::memory_order_relaxed) / 1e9;
+	}
+	return snapshot;
+}
+
+void publish()
+{
+	instrument_sink *sink = current_sink;
+	if (sink)
+	{
+		sink->publish(get_snapshot());
+	}
+}
+
+void reset()
+{
+	for (int i=0;i<counter_count;i++)
+	{
+		counters[i] = 0;
+	}
+	for (int i=0;i<phase_count;i++)
+	{
+		phase_calls[i] = 0;
+		phase_nanoseconds[i] = 0;
+	}
+}
+
+};
+
+};
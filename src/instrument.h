@@ -0,0 +1,144 @@
+#ifndef PBPDP_INSTRUMENT_H
+#define PBPDP_INSTRUMENT_H
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <fstream>
+#include <mutex>
+#include <chrono>
+
+// operation counters, phase timers and trace messages for the hot paths.  the library
+// only touches these through the PBPDP_ macros below, which compile to nothing unless
+// PBPDP_INSTRUMENT is defined (configure --enable-instrumentation), so a normal build
+// pays nothing for them.  what is collected goes to a sink the application installs.
+
+namespace pbpdp
+{
+	enum instrument_counter
+	{
+		counter_pairings,
+		counter_g1_exps,
+		counter_gt_exps,
+		counter_multiexp_terms,		// bases fed to multi-exponentiations
+		counter_hash_to_g1,
+		counter_hashes,				// hashes to Zr
+		counter_chunks_read,
+		counter_bytes_read,			// from mmap files and tag stores
+		counter_count
+	};
+	
+	enum instrument_phase
+	{
+		phase_sig_gen,
+		phase_check_sig,
+		phase_challenge,
+		phase_proof,
+		phase_proof_read,			// runs alongside phase_proof on the reader thread
+		phase_verify,
+		phase_verify_hash,			// H(W_i) for the challenged blocks
+		phase_batch_verify,
+		phase_count
+	};
+	
+	struct instrument_snapshot
+	{
+		uint64_t	counters[counter_count];
+		uint64_t	phase_calls[phase_count];
+		double		phase_seconds[phase_count];
+	};
+	
+	const char* get_counter_name(instrument_counter c);
+	const char* get_phase_name(instrument_phase p);
+	
+	class instrument_sink
+	{
+	public:
+		virtual ~instrument_sink() {}
+		
+		virtual void trace(const std::string &message) {}
+		virtual void publish(const instrument_snapshot &snapshot) {}
+	};
+	
+	// keeps the last snapshot and the most recent trace messages
+	class memory_sink : public instrument_sink
+	{
+	public:
+		memory_sink(unsigned int max_traces = 1000) : _max_traces(max_traces), _snapshot() {}
+		
+		void trace(const std::string &message);
+		void publish(const instrument_snapshot &snapshot);
+		
+		instrument_snapshot get_snapshot();
+		std::vector<std::string> get_traces();
+		
+	private:
+		unsigned int				_max_traces;
+		std::mutex					_lock;
+		instrument_snapshot			_snapshot;
+		std::vector<std::string>	_traces;
+	};
+	
+	// rewrites a text file of "name value" lines on each publish, for a metrics scraper
+	// to pick up.  traces go to an optional stream
+	class metrics_file_sink : public instrument_sink
+	{
+	public:
+		metrics_file_sink(const std::string &path, std::ostream *trace_stream = 0) : _path(path), _trace_stream(trace_stream) {}
+		
+		void trace(const std::string &message);
+		void publish(const instrument_snapshot &snapshot);
+		
+	private:
+		std::string		_path;
+		std::ostream*	_trace_stream;
+		std::mutex		_lock;
+	};
+	
+	namespace instrument
+	{
+		void set_sink(instrument_sink *sink); // 0 discards everything, the sink must outlive its use
+		
+		void add(instrument_counter c, uint64_t n);
+		void add_phase(instrument_phase p, double seconds);
+		void trace(const std::string &message);
+		
+		instrument_snapshot get_snapshot();
+		void publish(); // hands a snapshot to the sink
+		void reset();
+	};
+	
+	class phase_timer
+	{
+	public:
+		phase_timer(instrument_phase p) : _phase(p), _start(std::chrono::steady_clock::now()) {}
+		~phase_timer()
+		{
+			std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - _start;
+			instrument::add_phase(_phase,elapsed.count());
+		}
+		
+	private:
+		instrument_phase						_phase;
+		std::chrono::steady_clock::time_point	_start;
+	};
+};
+
+#ifdef PBPDP_INSTRUMENT
+#define PBPDP_CONCAT_(a,b) a##b
+#define PBPDP_CONCAT(a,b) PBPDP_CONCAT_(a,b)
+#define PBPDP_COUNT(c,n) ::pbpdp::instrument::add(::pbpdp::c,(n))
+#define PBPDP_PHASE(p) ::pbpdp::phase_timer PBPDP_CONCAT(_pbpdp_phase_,__LINE__)(::pbpdp::p)
+#define PBPDP_TRACE(msg) do { std::ostringstream _pbpdp_trace; _pbpdp_trace << msg; ::pbpdp::instrument::trace(_pbpdp_trace.str()); } while (0)
+#else
+#define PBPDP_COUNT(c,n) ((void)0)
+#define PBPDP_PHASE(p) ((void)0)
+#define PBPDP_TRACE(msg) ((void)0)
+#endif
+
+#endif
@@ -0,0 +1,191 @@
+#include "keystore.h"
+#include "serial.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#include <cerrno>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace pbpdp
+{
+
+static const unsigned int keystore_version = 2;
+static const unsigned int keystore_header_size = 24;
+static const unsigned int keystore_has_secret = 1;
+
+// sections in file order
+enum keystore_section
+{
+	section_scheme,
+	section_public,
+	section_secret,
+	section_count
+};
+
+void keystore::write(const char *path, scheme_parameters &scheme, public_parameters &p, secret_parameters *s)
+{
+	unsigned int lengths[section_count];
+	lengths[section_scheme] = scheme.get_serialized_size();
+	lengths[section_public] = p.get_serialized_size();
+	lengths[section_secret] = s ? s->get_serialized_size() : 0;
+	
+	unsigned int size = keystore_header_size;
+	for (int i=0;i<section_count;i++)
+	{
+		size += lengths[i];
+	}
+	std::vector<unsigned char> data(size);
+	
+	serial_writer w(&data[0],keystore_header_size);
+	w.put_bytes((const unsigned char*)"PDKS",4);
+	w.put_u32(keystore_version);
+	w.put_u32(s ? keystore_has_secret : 0);
+	for (int i=0;i<section_count;i++)
+	{
+		w.put_u32(lengths[i]);
+	}
+	
+	unsigned char *section = &data[keystore_header_size];
+	scheme.serialize(section,lengths[section_scheme]);
+	section += lengths[section_scheme];
+	p.serialize(section,lengths[section_public]);
+	section += lengths[section_public];
+	if (s)
+	{
+		s->serialize(section,lengths[section_secret]);
+	}
+	
+	// write aside and rename, so a crash never leaves half a key store behind.  a leftover
+	// tmp file would keep its own mode, so it's replaced rather than truncated
+	std::string tmp = std::string(path) + ".tmp";
+	unlink(tmp.c_str());
+	int fd = ::open(tmp.c_str(),O_WRONLY | O_CREAT | O_EXCL,s ? 0600 : 0644);
+	if (fd < 0)
+	{
+		throw std::runtime_error("keystore: unable to create " + tmp + ": " + strerror(errno));
+	}
+	unsigned int written = 0;
+	while (written < size)
+	{
+		ssize_t n = ::write(fd,&data[written],size-written);
+		if (n < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			break;
+		}
+		written += n;
+	}
+	bool ok = written == size && fsync(fd) == 0;
+	std::string err = strerror(errno);
+	::close(fd);
+	if (!ok || rename(tmp.c_str(),path) != 0)
+	{
+		unlink(tmp.c_str());
+		throw std::runtime_error(std::string("keystore: unable to write ") + path + ": " + err);
+	}
+}
+
+void keystore::open(const char *path)
+{
+	close();
+	
+	_fd = ::open(path,O_RDONLY);
+	if (_fd < 0)
+	{
+		throw std::runtime_error(std::string("keystore: unable to open ") + path + ": " + strerror(errno));
+	}
+	
+	struct stat st;
+	if (fstat(_fd,&st) != 0 || st.st_size < keystore_header_size)
+	{
+		close();
+		throw std::runtime_error(std::string("keystore: ") + path + " is not a key store");
+	}
+	_size = st.st_size;
+	
+	void *data = mmap(0,_size,PROT_READ,MAP_PRIVATE,_fd,0);
+	if (data == MAP_FAILED)
+	{
+		std::string err = strerror(errno);
+		close();
+		throw std::runtime_error(std::string("keystore: unable to map ") + path + ": " + err);
+	}
+	_data = (unsigned char*)data;
+	
+	serial_reader r(_data,keystore_header_size);
+	if (memcmp(r.get_bytes(4),"PDKS",4) != 0 || r.get_u32() != keystore_version)
+	{
+		close();
+		throw std::runtime_error(std::string("keystore: ") + path + " is not a key store");
+	}
+	_flags = r.get_u32();
+	uint64_t size = keystore_header_size;
+	for (int i=0;i<section_count;i++)
+	{
+		_lengths[i] = r.get_u32();
+		size += _lengths[i];
+	}
+	if (size > _size)
+	{
+		close();
+		throw std::runtime_error(std::string("keystore: ") + path + " is truncated");
+	}
+}
+
+void keystore::close()
+{
+	if (_data)
+	{
+		munmap(_data,_size);
+		_data = 0;
+	}
+	if (_fd >= 0)
+	{
+		::close(_fd);
+		_fd = -1;
+	}
+	_size = 0;
+}
+
+bool keystore::has_secret() const
+{
+	return _data && (_flags & keystore_has_secret);
+}
+
+void keystore::load(scheme_parameters &scheme, public_parameters &p, secret_parameters *s)
+{
+	if (!_data)
+	{
+		throw std::runtime_error("keystore: not open");
+	}
+	if (s && !has_secret())
+	{
+		throw std::runtime_error("keystore: no secret key in the store");
+	}
+	
+	// the sections are only read, the casts are for the deserialize signatures
+	unsigned char *section = _data + keystore_header_size;
+	scheme.deserialize(section,_lengths[section_scheme]);
+	section += _lengths[section_scheme];
+	
+	p.set_scheme(scheme);
+	p.deserialize(section,_lengths[section_public]);
+	section += _lengths[section_public];
+	
+	if (s)
+	{
+		s->set_scheme(scheme);
+		s->deserialize(section,_lengths[section_secret]);
+	}
+}
+
+};
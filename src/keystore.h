@@ -0,0 +1,50 @@
+#ifndef PBPDP_KEYSTORE_H
+#define PBPDP_KEYSTORE_H
+
+#include <stdint.h>
+
+#include "core.h"
+
+// everything a prover or auditor needs to pick up where it left off: the pairing
+// parameters and g, the public parameters, and optionally the secret key.  the sections
+// are the objects' own serialized forms behind a small header:
+//
+//   'P','D','K','S' | version u32 | flags u32 | scheme, public and secret lengths u32 |
+//   sections in that order
+//
+// loading maps the file once and restores straight out of the mapping, without
+// generating parameters.  pbc's fixed base tables can't be saved, so those are rebuilt
+// from the loaded points.
+
+namespace pbpdp
+{
+	class keystore
+	{
+	public:
+		keystore() : _fd(-1), _data(0), _size(0), _flags(0) {}
+		~keystore() { close(); }
+		
+		// replaces path atomically.  with a secret key the file is only readable by its owner
+		static void write(const char *path, scheme_parameters &scheme, public_parameters &p, secret_parameters *s = 0);
+		
+		void open(const char *path);
+		void close();
+		
+		bool has_secret() const;
+		// restores into uninitialized (or cleaned up) objects.  s is only filled in if the
+		// store has a secret key, asking for one that isn't there throws
+		void load(scheme_parameters &scheme, public_parameters &p, secret_parameters *s = 0);
+		
+	private:
+		keystore(const keystore&);
+		keystore& operator=(const keystore&);
+	
+		int					_fd;
+		unsigned char*		_data;
+		uint64_t			_size;
+		unsigned int		_flags;
+		unsigned int		_lengths[3];
+	};
+};
+
+#endif
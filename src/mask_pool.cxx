@@ -0,0 +1,175 @@
+#include "mask_pool.h"
+#include "instrument.h"
+
+#include <cstring>
+
+namespace pbpdp
+{
+
+void mask_pool::init(public_parameters &p, scheme_parameters &scheme, unsigned int capacity, unsigned int low_water)
+{
+	cleanup();
+	
+	PBPDP_TRACE("Initializing mask pool of " << capacity << "...");
+	_scheme = &scheme;
+	_params = &p;
+	_sectors = p.get_sector_count();
+	_capacity = capacity;
+	_low_water = low_water < capacity ? low_water : capacity / 2;
+	_stopping = false;
+	_fill_requested = false;
+	memset(&_stats,0,sizeof(_stats));
+	
+	_euv.resize(_sectors);
+	_euv_pp.resize(_sectors);
+	for (int j=0;j<_sectors;j++)
+	{
+		element_init_GT(&_euv[j],scheme.get_pairing());
+		p.pair_with_v(&_euv[j],p.get_u(j));
+		element_pp_init(&_euv_pp[j],&_euv[j]);
+	}
+	
+	_initialized = true;
+	_refill = std::thread(&mask_pool::refill,this);
+}
+
+void mask_pool::cleanup()
+{
+	if (!_initialized)
+	{
+		return;
+	}
+	
+	{
+		std::lock_guard<std::mutex> lock(_lock);
+		_stopping = true;
+		_wake.notify_all();
+		_filled.notify_all();
+	}
+	_refill.join();
+	
+	while (!_masks.empty())
+	{
+		free_mask(_masks.front());
+		_masks.pop_front();
+	}
+	for (int j=0;j<_sectors;j++)
+	{
+		element_pp_clear(&_euv_pp[j]);
+		element_clear(&_euv[j]);
+	}
+	_euv_pp.clear();
+	_euv.clear();
+	_initialized = false;
+}
+
+// R = prod(e(u_j,v)^r_j)
+mask_pool::mask* mask_pool::make_mask(element_t t0)
+{
+	mask *m = new mask;
+	m->r.resize(_sectors);
+	element_init_GT(m->R,_scheme->get_pairing());
+	element_set1(m->R);
+	for (int j=0;j<_sectors;j++)
+	{
+		element_init_Zr(&m->r[j],_scheme->get_pairing());
+		element_random(&m->r[j]);
+		element_pp_pow_zn(t0,&m->r[j],&_euv_pp[j]);
+		PBPDP_COUNT(counter_gt_exps,1);
+		element_mul(m->R,m->R,t0);
+	}
+	return m;
+}
+
+void mask_pool::free_mask(mask *m)
+{
+	for (int j=0;j<_sectors;j++)
+	{
+		element_clear(&m->r[j]);
+	}
+	element_clear(m->R);
+	delete m;
+}
+
+void mask_pool::refill()
+{
+	element_t t0;
+	element_init_GT(t0,_scheme->get_pairing());
+	
+	std::unique_lock<std::mutex> lock(_lock);
+	while (!_stopping)
+	{
+		if (_masks.size() >= _capacity || (_masks.size() > _low_water && !_fill_requested))
+		{
+			_wake.wait(lock);
+			continue;
+		}
+		
+		// top up to capacity, making masks outside the lock so take isn't held up
+		while (!_stopping && _masks.size() < _capacity)
+		{
+			lock.unlock();
+			mask *m = make_mask(t0);
+			lock.lock();
+			_masks.push_back(m);
+			_stats.generated++;
+		}
+		_fill_requested = false;
+		_filled.notify_all();
+	}
+	
+	lock.unlock();
+	element_clear(t0);
+}
+
+bool mask_pool::take(public_parameters &p, element_s *r, element_t R)
+{
+	mask *m;
+	{
+		std::lock_guard<std::mutex> lock(_lock);
+		if (&p != _params || p.get_sector_count() != _sectors)
+		{
+			_stats.mismatched++;
+			return false;
+		}
+		if (_masks.empty())
+		{
+			_stats.empty++;
+			_wake.notify_one();
+			return false;
+		}
+		m = _masks.front();
+		_masks.pop_front();
+		_stats.taken++;
+		if (_masks.size() <= _low_water)
+		{
+			_wake.notify_one();
+		}
+	}
+	
+	for (int j=0;j<_sectors;j++)
+	{
+		element_set(&r[j],&m->r[j]);
+	}
+	element_set(R,m->R);
+	free_mask(m);
+	return true;
+}
+
+void mask_pool::fill()
+{
+	std::unique_lock<std::mutex> lock(_lock);
+	_fill_requested = true;
+	_wake.notify_one();
+	_filled.wait(lock,[this]() { return _masks.size() >= _capacity || _stopping; });
+}
+
+mask_pool_stats mask_pool::get_stats()
+{
+	std::lock_guard<std::mutex> lock(_lock);
+	mask_pool_stats stats = _stats;
+	stats.available = _masks.size();
+	return stats;
+}
+
+};
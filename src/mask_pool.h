@@ -0,0 +1,84 @@
+#ifndef PBPDP_MASK_POOL_H
+#define PBPDP_MASK_POOL_H
+
+#include <stdint.h>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "core.h"
+
+// precomputed masks for the prover.  every proof needs random r_j and
+// R = prod(e(u_j,v)^r_j), which costs a pairing or a GT exponentiation on the path of
+// every audit response even though none of it depends on the challenge.  a pool keeps
+// a stock of (r,R) pairs made ahead of time by a background thread, using fixed base
+// tables for each e(u_j,v), so gen_proof only has to take one.  each mask is handed out
+// once and then forgotten, reusing r would leak the file's blocks.
+
+namespace pbpdp
+{
+	struct mask_pool_stats
+	{
+		uint64_t		generated;			// masks made by the refill thread
+		uint64_t		taken;				// masks handed to proofs
+		uint64_t		empty;				// proofs that found the pool empty
+		uint64_t		mismatched;			// proofs for other public parameters, which made their own mask
+		size_t			available;			// masks in the pool now
+	};
+	
+	class mask_pool
+	{
+	public:
+		mask_pool() : _initialized(false), _params(0), _sectors(0), _capacity(0), _low_water(0), _stopping(false), _fill_requested(false) {}
+		~mask_pool() { cleanup(); }
+		
+		// refills to capacity whenever the pool drops to low_water (default capacity/2).
+		// p must outlive the pool
+		void init(public_parameters &p, scheme_parameters &scheme, unsigned int capacity, unsigned int low_water = ~0u);
+		void cleanup();
+		
+		// r must hold get_sector_count() initialized Zr elements and R a GT element.
+		// false when the pool is empty or p isn't the parameters it was made for (or their
+		// sector count changed), the caller then makes its own mask
+		bool take(public_parameters &p, element_s *r, element_t R);
+		void fill(); // blocks until the pool is full, for warming up before audits arrive
+		
+		mask_pool_stats get_stats();
+		
+	private:
+		mask_pool(const mask_pool&);
+		mask_pool& operator=(const mask_pool&);
+	
+		struct mask
+		{
+			std::vector<element_s>	r;		// Zr, one per sector
+			element_t				R;		// GT
+		};
+		
+		void refill();
+		mask* make_mask(element_t t0);
+		void free_mask(mask *m);
+	
+		bool						_initialized;
+		scheme_parameters*			_scheme;
+		public_parameters*			_params;
+		unsigned int				_sectors;
+		std::vector<element_s>		_euv;			// GT, e(u_j,v)
+		std::vector<element_pp_s>	_euv_pp;		// fixed base tables for _euv
+		unsigned int				_capacity;
+		unsigned int				_low_water;
+		
+		std::mutex					_lock;
+		std::condition_variable		_wake;			// the refill thread has work or should stop
+		std::condition_variable		_filled;
+		std::deque<mask*>			_masks;
+		bool						_stopping;
+		bool						_fill_requested;
+		std::thread					_refill;
+		mask_pool_stats				_stats;
+	};
+};
+
+#endif
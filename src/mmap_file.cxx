@@ -0,0 +1,162 @@
+#include "mmap_file.h"
+#include "instrument.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#include <cerrno>
+#include <stdexcept>
+#include <string>
+
+namespace pbpdp
+{
+
+void mmap_file::open(const char *path, unsigned int chunk_size)
+{
+	close();
+	
+	if (chunk_size == 0)
+	{
+		throw std::runtime_error("mmap_file: chunk size must be positive");
+	}
+	
+	_fd = ::open(path,O_RDONLY);
+	if (_fd < 0)
+	{
+		throw std::runtime_error(std::string("mmap_file: unable to open ") + path + ": " + strerror(errno));
+	}
+	
+	struct stat st;
+	if (fstat(_fd,&st) != 0)
+	{
+		std::string err = strerror(errno);
+		close();
+		throw std::runtime_error(std::string("mmap_file: unable to stat ") + path + ": " + err);
+	}
+	
+	_size = st.st_size;
+	_chunk_size = chunk_size;
+	
+	uint64_t count = (_size + _chunk_size - 1) / _chunk_size;
+	if (count > 0xffffffffull)
+	{
+		close();
+		throw std::runtime_error("mmap_file: too many chunks, use a larger chunk size");
+	}
+	_chunk_count = count;
+	
+	if (_size > 0)
+	{
+		void *data = mmap(0,_size,PROT_READ,MAP_SHARED,_fd,0);
+		if (data == MAP_FAILED)
+		{
+			std::string err = strerror(errno);
+			close();
+			throw std::runtime_error(std::string("mmap_file: unable to map ") + path + ": " + err);
+		}
+		_data = (unsigned char*)data;
+		
+		// reading the tail chunk straight from the mapping would run past the end
+		// of the file, so keep a zero padded copy of it
+		uint64_t tail_start = (uint64_t)(_chunk_count-1) * _chunk_size;
+		if (_size - tail_start < _chunk_size)
+		{
+			_tail = new unsigned char[_chunk_size];
+			memset(_tail,0,_chunk_size);
+			memcpy(_tail,_data+tail_start,_size-tail_start);
+		}
+	}
+}
+
+void mmap_file::close()
+{
+	if (_data)
+	{
+		munmap(_data,_size);
+		_data = 0;
+	}
+	if (_fd >= 0)
+	{
+		::close(_fd);
+		_fd = -1;
+	}
+	delete[] _tail;
+	_tail = 0;
+	_size = 0;
+	_chunk_count = 0;
+}
+
+const unsigned char* mmap_file::get_chunk_data(unsigned int i) const
+{
+	if (i >= _chunk_count)
+	{
+		throw std::out_of_range("mmap_file: chunk index out of range");
+	}
+	if (_tail && i == _chunk_count-1)
+	{
+		return _tail;
+	}
+	return _data + (uint64_t)i * _chunk_size;
+}
+
+void mmap_file::get_chunk(element_t e,unsigned int i)
+{
+	PBPDP_COUNT(counter_bytes_read,_chunk_size);
+	element_from_bytes(e,(unsigned char*)get_chunk_data(i));
+}
+
+void mmap_file::get_chunk(mpz_t e,unsigned int i)
+{
+	PBPDP_COUNT(counter_bytes_read,_chunk_size);
+	mpz_import(e,_chunk_size,1,sizeof(unsigned char),0,0,get_chunk_data(i));
+}
+
+void mmap_file::set_access_hint(access_hint hint)
+{
+	if (!_data)
+	{
+		return;
+	}
+	
+	int advice = MADV_NORMAL;
+	switch (hint)
+	{
+	case access_sequential:
+		advice = MADV_SEQUENTIAL;
+		break;
+	case access_random:
+		advice = MADV_RANDOM;
+		break;
+	default:
+		break;
+	}
+	// only a hint, so failure is harmless
+	madvise(_data,_size,advice);
+}
+
+void mmap_file::prefetch_chunks(unsigned int first,unsigned int count)
+{
+	if (!_data || first >= _chunk_count || count == 0)
+	{
+		return;
+	}
+	if (count > _chunk_count - first)
+	{
+		count = _chunk_count - first;
+	}
+	
+	uint64_t page = sysconf(_SC_PAGESIZE);
+	uint64_t start = (uint64_t)first * _chunk_size;
+	uint64_t end = (uint64_t)(first + count) * _chunk_size;
+	if (end > _size)
+	{
+		end = _size;
+	}
+	start -= start % page;
+	
+	madvise(_data+start,end-start,MADV_WILLNEED);
+}
+
+};
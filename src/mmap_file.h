@@ -0,0 +1,48 @@
+#ifndef PBPDP_MMAP_FILE_H
+#define PBPDP_MMAP_FILE_H
+
+#include <stdint.h>
+
+#include "core.h"
+
+namespace pbpdp
+{
+	// a file backed by a read only memory mapping, so chunks are paged in on demand
+	// instead of reading the whole object into memory.  get_chunk reads straight out of
+	// the mapping and is safe to call from several threads.
+	class mmap_file : public file
+	{
+	public:
+		mmap_file() : _fd(-1), _data(0), _size(0), _chunk_size(0), _chunk_count(0), _tail(0) {}
+		~mmap_file() { close(); }
+		
+		void open(const char *path, unsigned int chunk_size);
+		void close();
+		
+		void get_chunk(element_t e,unsigned int i);
+		void get_chunk(mpz_t e,unsigned int i);
+		unsigned int get_chunk_count() { return _chunk_count; }
+		
+		void set_access_hint(access_hint hint);
+		void prefetch_chunks(unsigned int first,unsigned int count);
+		
+		uint64_t get_size() const { return _size; }
+		unsigned int get_chunk_size() const { return _chunk_size; }
+		
+		// pointer to the chunk_size bytes of chunk i, the last chunk is zero padded
+		const unsigned char* get_chunk_data(unsigned int i) const;
+		
+	private:
+		mmap_file(const mmap_file&);
+		mmap_file& operator=(const mmap_file&);
+	
+		int					_fd;
+		unsigned char*		_data;
+		uint64_t			_size;
+		unsigned int		_chunk_size;
+		unsigned int		_chunk_count;
+		unsigned char*		_tail;			// padded copy of a partial last chunk
+	};
+};
+
+#endif
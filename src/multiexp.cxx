@@ -0,0 +1,277 @@
+#include "multiexp.h"
+#include "scratch.h"
+
+#include <vector>
+
+namespace pbpdp
+{
+
+// below this many terms Straus' method beats Pippenger's
+static const unsigned int straus_threshold = 32;
+// window width of Straus' method, each base gets a table of 2^w powers
+static const unsigned int straus_window = 4;
+
+static unsigned int get_window(__mpz_struct *e, unsigned int bit, unsigned int width)
+{
+	unsigned int d = 0;
+	for (int b=width-1;b>=0;b--)
+	{
+		d = (d << 1) | mpz_tstbit(e,bit+b);
+	}
+	return d;
+}
+
+static unsigned int get_max_bits(__mpz_struct **exps, unsigned int n)
+{
+	unsigned int bits = 0;
+	for (int i=0;i<n;i++)
+	{
+		unsigned int b = mpz_sgn(exps[i]) ? mpz_sizeinbase(exps[i],2) : 0;
+		if (b > bits)
+		{
+			bits = b;
+		}
+	}
+	return bits;
+}
+
+// temporaries in the group of out, from the arena's helper slot when there is one
+class temp_elements
+{
+public:
+	temp_elements() : _elements(0), _count(0) {}
+	
+	void init(element_t out, scratch *arena, unsigned int count)
+	{
+		if (arena)
+		{
+			_elements = arena->get_G1(scratch_helper_slot,count);
+			return;
+		}
+		_local.resize(count);
+		for (int i=0;i<count;i++)
+		{
+			element_init_same_as(&_local[i],out);
+		}
+		_elements = count ? &_local[0] : 0;
+		_count = count;
+	}
+	
+	void cleanup()
+	{
+		for (int i=0;i<_count;i++)
+		{
+			element_clear(&_local[i]);
+		}
+		_local.clear();
+		_count = 0;
+		_elements = 0;
+	}
+	
+	element_s* get(unsigned int i) { return &_elements[i]; }
+	
+private:
+	element_s					*_elements;
+	unsigned int				_count;
+	std::vector<element_s>		_local;
+};
+
+void multi_pow_straus(element_t out, element_s **bases, __mpz_struct **exps, unsigned int n, scratch *arena)
+{
+	unsigned int w = straus_window;
+	unsigned int table_size = 1 << w;
+	unsigned int bits = get_max_bits(exps,n);
+	unsigned int windows = (bits + w - 1) / w;
+	
+	// table[i*table_size+d] = bases[i]^d
+	temp_elements table;
+	table.init(out,arena,n*table_size);
+	for (int i=0;i<n;i++)
+	{
+		element_s *t = table.get(i*table_size);
+		element_set1(&t[0]);
+		element_set(&t[1],bases[i]);
+		for (int d=2;d<table_size;d++)
+		{
+			element_mul(&t[d],&t[d-1],bases[i]);
+		}
+	}
+	
+	bool is1 = true;
+	element_set1(out);
+	for (int k=windows-1;k>=0;k--)
+	{
+		if (!is1)
+		{
+			for (int b=0;b<w;b++)
+			{
+				element_square(out,out);
+			}
+		}
+		for (int i=0;i<n;i++)
+		{
+			unsigned int d = get_window(exps[i],k*w,w);
+			if (d)
+			{
+				element_mul(out,out,table.get(i*table_size+d));
+				is1 = false;
+			}
+		}
+	}
+	
+	table.cleanup();
+}
+
+void multi_pow_pippenger(element_t out, element_s **bases, __mpz_struct **exps, unsigned int n, scratch *arena)
+{
+	// window width ~ log2(n) - 2 balances the n bucket additions per window against
+	// the 2^c additions needed to sum the buckets
+	unsigned int c = 2;
+	while (c < 16 && (1u << (c + 3)) <= n)
+	{
+		c++;
+	}
+	unsigned int bucket_count = 1 << c;
+	unsigned int bits = get_max_bits(exps,n);
+	unsigned int windows = (bits + c - 1) / c;
+	
+	// buckets 1..bucket_count-1, then the running sum and the window's sum in the unused bucket 0
+	// and one past the end
+	temp_elements buckets;
+	buckets.init(out,arena,bucket_count+1);
+	element_s *running = buckets.get(0);
+	element_s *sum = buckets.get(bucket_count);
+	std::vector<unsigned int> local_used;
+	unsigned int *used;
+	if (arena)
+	{
+		used = arena->get_uint(scratch_helper_slot,bucket_count);
+	}
+	else
+	{
+		local_used.resize(bucket_count);
+		used = &local_used[0];
+	}
+	
+	bool is1 = true;
+	element_set1(out);
+	for (int k=windows-1;k>=0;k--)
+	{
+		if (!is1)
+		{
+			for (int b=0;b<c;b++)
+			{
+				element_square(out,out);
+			}
+		}
+		
+		// sort the bases into buckets by their digit in this window
+		for (int d=1;d<bucket_count;d++)
+		{
+			used[d] = 0;
+		}
+		for (int i=0;i<n;i++)
+		{
+			unsigned int d = get_window(exps[i],k*c,c);
+			if (!d)
+			{
+				continue;
+			}
+			if (used[d])
+			{
+				element_mul(buckets.get(d),buckets.get(d),bases[i]);
+			}
+			else
+			{
+				element_set(buckets.get(d),bases[i]);
+				used[d] = 1;
+			}
+		}
+		
+		// sum(d*bucket_d) as a running sum from the top bucket down
+		bool running_is1 = true;
+		bool sum_is1 = true;
+		for (int d=bucket_count-1;d>0;d--)
+		{
+			if (used[d])
+			{
+				if (running_is1)
+				{
+					element_set(running,buckets.get(d));
+					running_is1 = false;
+				}
+				else
+				{
+					element_mul(running,running,buckets.get(d));
+				}
+			}
+			if (!running_is1)
+			{
+				if (sum_is1)
+				{
+					element_set(sum,running);
+					sum_is1 = false;
+				}
+				else
+				{
+					element_mul(sum,sum,running);
+				}
+			}
+		}
+		
+		if (!sum_is1)
+		{
+			element_mul(out,out,sum);
+			is1 = false;
+		}
+	}
+	
+	buckets.cleanup();
+}
+
+void multi_pow_mpz(element_t out, element_s **bases, __mpz_struct **exps, unsigned int n, scratch *arena)
+{
+	if (n < straus_threshold)
+	{
+		multi_pow_straus(out,bases,exps,n,arena);
+	}
+	else
+	{
+		multi_pow_pippenger(out,bases,exps,n,arena);
+	}
+}
+
+void multi_pow_zn(element_t out, element_s **bases, element_s **exps, unsigned int n, scratch *arena)
+{
+	if (arena)
+	{
+		// the arena's mpz_t keep their limbs between calls
+		__mpz_struct *z = arena->get_mpz(scratch_helper_slot,n);
+		__mpz_struct **zp = arena->get_mpz_pointers(scratch_helper_slot,n);
+		for (int i=0;i<n;i++)
+		{
+			element_to_mpz(&z[i],exps[i]);
+			zp[i] = &z[i];
+		}
+		multi_pow_mpz(out,bases,zp,n,arena);
+		return;
+	}
+	
+	std::vector<__mpz_struct> z(n);
+	std::vector<__mpz_struct*> zp(n);
+	for (int i=0;i<n;i++)
+	{
+		mpz_init(&z[i]);
+		element_to_mpz(&z[i],exps[i]);
+		zp[i] = &z[i];
+	}
+	
+	multi_pow_mpz(out,bases,n ? &zp[0] : 0,n);
+	
+	for (int i=0;i<n;i++)
+	{
+		mpz_clear(&z[i]);
+	}
+}
+
+};
@@ -0,0 +1,25 @@
+#ifndef PBPDP_MULTIEXP_H
+#define PBPDP_MULTIEXP_H
+
+#include <pbc/pbc.h>
+
+// multi-exponentiation for the products of powers in the scheme (sigma = prod(sigma_i^v_i)
+// on the prover, prod(H(W_i)^v_i) on the verifier).  small products use Straus' interleaved
+// window method, large ones Pippenger's bucket method.
+
+namespace pbpdp
+{
+	class scratch;
+	
+	// out = prod(bases[i]^exps[i]) for i < n.  out must be initialized in the same group as the bases.
+	// with an arena the temporaries come from its helper slots and out must be in its G1,
+	// without one they are allocated for the call
+	void multi_pow_zn(element_t out, element_s **bases, element_s **exps, unsigned int n, scratch *arena = 0);
+	void multi_pow_mpz(element_t out, element_s **bases, __mpz_struct **exps, unsigned int n, scratch *arena = 0);
+	
+	// the individual algorithms, exposed for benchmarking
+	void multi_pow_straus(element_t out, element_s **bases, __mpz_struct **exps, unsigned int n, scratch *arena = 0);
+	void multi_pow_pippenger(element_t out, element_s **bases, __mpz_struct **exps, unsigned int n, scratch *arena = 0);
+};
+
+#endif
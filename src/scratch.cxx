@@ -0,0 +1,174 @@
+#include "scratch.h"
+
+#include <mutex>
+#include <set>
+
+namespace pbpdp
+{
+
+// every live arena, so a scheme being cleaned up can find the ones bound to it.  function
+// statics, since arenas die at thread exit and may run into static destruction order
+static std::mutex& arenas_lock()
+{
+	static std::mutex lock;
+	return lock;
+}
+
+static std::set<scratch*>& arenas()
+{
+	static std::set<scratch*> all;
+	return all;
+}
+
+scratch::scratch() : _scheme_id(0), _pairing(0)
+{
+	std::lock_guard<std::mutex> lock(arenas_lock());
+	arenas().insert(this);
+}
+
+scratch::~scratch()
+{
+	std::lock_guard<std::mutex> lock(arenas_lock());
+	arenas().erase(this);
+	clear();
+}
+
+scratch& scratch::get(scheme_parameters &scheme)
+{
+	static thread_local scratch arena;
+	if (arena._scheme_id != scheme.get_id())
+	{
+		arena.bind(scheme);
+	}
+	return arena;
+}
+
+void scratch::release(scheme_parameters &scheme)
+{
+	std::lock_guard<std::mutex> lock(arenas_lock());
+	for (std::set<scratch*>::iterator i=arenas().begin();i!=arenas().end();i++)
+	{
+		if ((*i)->_scheme_id == scheme.get_id())
+		{
+			(*i)->clear();
+		}
+	}
+}
+
+void scratch::bind(scheme_parameters &scheme)
+{
+	std::lock_guard<std::mutex> lock(arenas_lock());
+	clear();
+	_hasher.init(scheme);
+	_pairing = scheme.get_pairing();
+	_scheme_id = scheme.get_id();
+}
+
+void scratch::clear()
+{
+	_G1.clear();
+	_GT.clear();
+	_Zr.clear();
+	_mpz.clear();
+	_uint.clear();
+	_pointers.clear();
+	_mpz_pointers.clear();
+	_bytes.clear();
+	_hasher.cleanup();
+	_pairing = 0;
+	_scheme_id = 0;
+}
+
+element_s* scratch::get_G1(unsigned int slot, unsigned int count)
+{
+	if (slot >= _G1.size())
+	{
+		_G1.resize(slot+1);
+	}
+	_G1[slot].reserve(_pairing,count);
+	return _G1[slot].get();
+}
+
+element_s* scratch::get_GT(unsigned int slot, unsigned int count)
+{
+	if (slot >= _GT.size())
+	{
+		_GT.resize(slot+1);
+	}
+	_GT[slot].reserve(_pairing,count);
+	return _GT[slot].get();
+}
+
+element_s* scratch::get_Zr(unsigned int slot, unsigned int count)
+{
+	if (slot >= _Zr.size())
+	{
+		_Zr.resize(slot+1);
+	}
+	_Zr[slot].reserve(_pairing,count);
+	return _Zr[slot].get();
+}
+
+__mpz_struct* scratch::get_mpz(unsigned int slot, unsigned int count)
+{
+	if (slot >= _mpz.size())
+	{
+		_mpz.resize(slot+1);
+	}
+	_mpz[slot].reserve(count);
+	return _mpz[slot].get();
+}
+
+unsigned int* scratch::get_uint(unsigned int slot, unsigned int count)
+{
+	if (slot >= _uint.size())
+	{
+		_uint.resize(slot+1);
+	}
+	if (_uint[slot].size() < count)
+	{
+		_uint[slot].resize(count);
+	}
+	return _uint[slot].data();
+}
+
+element_s** scratch::get_pointers(unsigned int slot, unsigned int count)
+{
+	if (slot >= _pointers.size())
+	{
+		_pointers.resize(slot+1);
+	}
+	if (_pointers[slot].size() < count)
+	{
+		_pointers[slot].resize(count);
+	}
+	return _pointers[slot].data();
+}
+
+__mpz_struct** scratch::get_mpz_pointers(unsigned int slot, unsigned int count)
+{
+	if (slot >= _mpz_pointers.size())
+	{
+		_mpz_pointers.resize(slot+1);
+	}
+	if (_mpz_pointers[slot].size() < count)
+	{
+		_mpz_pointers[slot].resize(count);
+	}
+	return _mpz_pointers[slot].data();
+}
+
+unsigned char* scratch::get_bytes(unsigned int slot, unsigned int count)
+{
+	if (slot >= _bytes.size())
+	{
+		_bytes.resize(slot+1);
+	}
+	if (_bytes[slot].size() < count)
+	{
+		_bytes[slot].resize(count);
+	}
+	return _bytes[slot].data();
+}
+
+}
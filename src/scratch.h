@@ -0,0 +1,70 @@
+#ifndef PBPDP_SCRATCH_H
+#define PBPDP_SCRATCH_H
+
+#include <vector>
+#include <atomic>
+
+#include "core.h"
+#include "element.h"
+
+// per thread temporaries for the prover and verifier.  an audit needs a few thousand
+// elements and integers for the challenge batches, and setting them up and tearing them
+// down again was a noticeable part of every gen_proof and verify_proof.  each thread
+// gets one arena that keeps them between calls, so after the first audit the hot path
+// allocates nothing.
+//
+// an arena is bound to one scheme at a time and starts over when the thread uses another.
+// scheme_parameters::cleanup releases every arena bound to it, so none outlives the
+// pairing its elements belong to.
+
+namespace pbpdp
+{
+	// slot 0 of each kind belongs to the helpers that take an arena, like multi_pow_zn.
+	// callers number their own slots from scratch_first_slot
+	static const unsigned int scratch_helper_slot = 0;
+	static const unsigned int scratch_first_slot = 1;
+
+	class scratch
+	{
+	public:
+		static scratch& get(scheme_parameters &scheme); // the calling thread's arena, bound to scheme
+		static void release(scheme_parameters &scheme); // empties every thread's arena bound to scheme
+
+		element_hash& get_hasher() { return _hasher; }
+
+		// blocks are named by slot and only grow.  a pointer into one is good until the same
+		// slot is asked for with a larger count, or the arena moves to another scheme.  the
+		// contents are whatever the last user left there
+		element_s* get_G1(unsigned int slot, unsigned int count = 1);
+		element_s* get_GT(unsigned int slot, unsigned int count = 1);
+		element_s* get_Zr(unsigned int slot, unsigned int count = 1);
+		__mpz_struct* get_mpz(unsigned int slot, unsigned int count = 1);
+		unsigned int* get_uint(unsigned int slot, unsigned int count);
+		element_s** get_pointers(unsigned int slot, unsigned int count);
+		__mpz_struct** get_mpz_pointers(unsigned int slot, unsigned int count);
+		unsigned char* get_bytes(unsigned int slot, unsigned int count);
+
+	private:
+		scratch();
+		~scratch();
+		scratch(const scratch&);
+		scratch& operator=(const scratch&);
+
+		void bind(scheme_parameters &scheme);
+		void clear();
+
+		std::atomic<unsigned int>					_scheme_id;		// 0 while unbound
+		pairing_s*									_pairing;
+		element_hash								_hasher;
+		std::vector<element_block<group_G1> >		_G1;
+		std::vector<element_block<group_GT> >		_GT;
+		std::vector<element_block<group_Zr> >		_Zr;
+		std::vector<mpz_block>						_mpz;
+		std::vector<std::vector<unsigned int> >		_uint;
+		std::vector<std::vector<element_s*> >		_pointers;
+		std::vector<std::vector<__mpz_struct*> >	_mpz_pointers;
+		std::vector<std::vector<unsigned char> >	_bytes;
+	};
+}
+
+#endif
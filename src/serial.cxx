@@ -0,0 +1,135 @@
+#include "serial.h"
+
+#include <stdexcept>
+#include <cstring>
+
+namespace pbpdp
+{
+
+unsigned int serialized_mpz_size(const __mpz_struct *z)
+{
+	unsigned int bytes = mpz_sgn(z) ? (mpz_sizeinbase(z,2) + 7) / 8 : 0;
+	return sizeof(unsigned int) + bytes;
+}
+
+unsigned char *serial_writer::reserve(unsigned int n)
+{
+	if (n > _end - _p)
+	{
+		throw std::runtime_error("serialize: buffer too small");
+	}
+	unsigned char *p = _p;
+	_p += n;
+	return p;
+}
+
+void serial_writer::put_header(serial_type type)
+{
+	unsigned char *p = reserve(serial_header_size);
+	p[0] = 'P';
+	p[1] = 'D';
+	p[2] = serial_version;
+	p[3] = type;
+}
+
+void serial_writer::put_u8(unsigned char v)
+{
+	*reserve(1) = v;
+}
+
+void serial_writer::put_u32(unsigned int v)
+{
+	unsigned char *p = reserve(4);
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+void serial_writer::put_bytes(const unsigned char *b,unsigned int n)
+{
+	memcpy(reserve(n),b,n);
+}
+
+void serial_writer::put_element(const element_s *e)
+{
+	element_s *el = const_cast<element_s*>(e);
+	element_to_bytes(reserve(element_length_in_bytes(el)),el);
+}
+
+void serial_writer::put_element_compressed(const element_s *e)
+{
+	element_s *el = const_cast<element_s*>(e);
+	element_to_bytes_compressed(reserve(element_length_in_bytes_compressed(el)),el);
+}
+
+void serial_writer::put_mpz(const __mpz_struct *z)
+{
+	unsigned int n = serialized_mpz_size(z) - sizeof(unsigned int);
+	put_u32(n);
+	size_t count;
+	mpz_export(reserve(n),&count,1,sizeof(unsigned char),0,0,z);
+}
+
+unsigned char *serial_reader::get_bytes(unsigned int n)
+{
+	if (n > _end - _p)
+	{
+		throw std::runtime_error("deserialize: unexpected end of data");
+	}
+	unsigned char *p = _p;
+	_p += n;
+	return p;
+}
+
+unsigned char serial_reader::get_header(serial_type type)
+{
+	unsigned char *p = get_bytes(serial_header_size);
+	if (p[0] != 'P' || p[1] != 'D')
+	{
+		throw std::runtime_error("deserialize: bad magic");
+	}
+	if (p[2] == 0 || p[2] > serial_version)
+	{
+		throw std::runtime_error("deserialize: unsupported version");
+	}
+	if (p[3] != type)
+	{
+		throw std::runtime_error("deserialize: unexpected object type");
+	}
+	return p[2];
+}
+
+unsigned char serial_reader::get_u8()
+{
+	return *get_bytes(1);
+}
+
+unsigned int serial_reader::get_u32()
+{
+	unsigned char *p = get_bytes(4);
+	return ((unsigned int)p[0] << 24) | ((unsigned int)p[1] << 16) | ((unsigned int)p[2] << 8) | p[3];
+}
+
+void serial_reader::get_element(element_t e)
+{
+	element_from_bytes(e,get_bytes(element_length_in_bytes(e)));
+}
+
+void serial_reader::get_element_compressed(element_t e)
+{
+	element_from_bytes_compressed(e,get_bytes(element_length_in_bytes_compressed(e)));
+}
+
+void serial_reader::get_mpz(mpz_t z)
+{
+	unsigned int n = get_u32();
+	mpz_import(z,n,1,sizeof(unsigned char),0,0,get_bytes(n));
+}
+
+void serial_reader::skip_mpz()
+{
+	get_bytes(get_u32());
+}
+
+};
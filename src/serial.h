@@ -0,0 +1,72 @@
+#ifndef PBPDP_SERIAL_H
+#define PBPDP_SERIAL_H
+
+#include <pbc/pbc.h>
+
+// helpers for the wire format of the serializable classes.  every object starts with a
+// four byte header ('P','D',version,type) followed by big endian fields.  points in G1
+// and G2 are compressed to x plus a sign bit, everything else uses pbc's full encoding.
+// both helpers throw std::runtime_error when the buffer is too small or malformed.
+
+namespace pbpdp
+{
+	enum serial_type
+	{
+		serial_scheme_parameters = 1,
+		serial_public_parameters = 2,
+		serial_verification_metadata = 3,
+		serial_challenge = 4,
+		serial_response_proof = 5,
+		serial_secret_parameters = 6,
+		serial_partial_proof = 7
+	};
+	
+	// 2: challenges carry a mode byte and may be seeded
+	// 3: verification metadata carries a flags byte and may omit the tags
+	// 4: verification metadata may carry a block id table
+	static const unsigned char serial_version = 4;
+	static const unsigned int serial_header_size = 4;
+	
+	unsigned int serialized_mpz_size(const __mpz_struct *z);
+	
+	class serial_writer
+	{
+	public:
+		serial_writer(unsigned char *data,unsigned int size) : _p(data), _end(data+size) {}
+		
+		void put_header(serial_type type);
+		void put_u8(unsigned char v);
+		void put_u32(unsigned int v);
+		void put_bytes(const unsigned char *b,unsigned int n);
+		void put_element(const element_s *e);
+		void put_element_compressed(const element_s *e);
+		void put_mpz(const __mpz_struct *z);
+		
+	private:
+		unsigned char *reserve(unsigned int n);
+	
+		unsigned char *		_p;
+		unsigned char *		_end;
+	};
+	
+	class serial_reader
+	{
+	public:
+		serial_reader(unsigned char *data,unsigned int size) : _p(data), _end(data+size) {}
+		
+		unsigned char get_header(serial_type type); // returns the version
+		unsigned char get_u8();
+		unsigned int get_u32();
+		unsigned char *get_bytes(unsigned int n); // points into the buffer
+		void get_element(element_t e);
+		void get_element_compressed(element_t e);
+		void get_mpz(mpz_t z);
+		void skip_mpz(); // for checking lengths before decoding anything
+		
+	private:
+		unsigned char *		_p;
+		unsigned char *		_end;
+	};
+};
+
+#endif
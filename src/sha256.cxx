@@ -0,0 +1,449 @@
+#include "sha256.h"
+
+#include <stdint.h>
+#include <atomic>
+#include <cstring>
+#include <stdexcept>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define PBPDP_SHA256_X86
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+namespace pbpdp
+{
+
+// messages hashed together by the avx2 path
+static const unsigned int avx2_lanes = 8;
+
+static const uint32_t K[64] =
+{
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static const uint32_t initial_state[8] =
+{
+	0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+static inline uint32_t load_be32(const unsigned char *p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static inline void store_be32(unsigned char *p, uint32_t x)
+{
+	p[0] = x >> 24;
+	p[1] = x >> 16;
+	p[2] = x >> 8;
+	p[3] = x;
+}
+
+static inline unsigned int padded_blocks(unsigned int len)
+{
+	return (len + 9 + 63) / 64;
+}
+
+// block b of the padded message: the data, then 0x80, zeros and the bit length
+static void get_block(unsigned char *block, const unsigned char *data, unsigned int len, unsigned int b)
+{
+	unsigned int offset = b * 64;
+	unsigned int n = 0;
+	if (offset < len)
+	{
+		n = len - offset < 64 ? len - offset : 64;
+		memcpy(block,data+offset,n);
+	}
+	if (n < 64)
+	{
+		memset(block+n,0,64-n);
+		if (offset + n == len)
+		{
+			block[n] = 0x80;
+		}
+	}
+	if (b == padded_blocks(len) - 1)
+	{
+		uint64_t bits = (uint64_t)len * 8;
+		for (int i=0;i<8;i++)
+		{
+			block[63-i] = bits >> (8*i);
+		}
+	}
+}
+
+static void store_digest(unsigned char *digest, const uint32_t *state)
+{
+	for (int i=0;i<8;i++)
+	{
+		store_be32(digest+4*i,state[i]);
+	}
+}
+
+// scalar
+
+static inline uint32_t rotr(uint32_t x, unsigned int n)
+{
+	return (x >> n) | (x << (32 - n));
+}
+
+static void compress_scalar(uint32_t *state, const unsigned char *block)
+{
+	uint32_t w[64];
+	for (int t=0;t<16;t++)
+	{
+		w[t] = load_be32(block+4*t);
+	}
+	for (int t=16;t<64;t++)
+	{
+		uint32_t s0 = rotr(w[t-15],7) ^ rotr(w[t-15],18) ^ (w[t-15] >> 3);
+		uint32_t s1 = rotr(w[t-2],17) ^ rotr(w[t-2],19) ^ (w[t-2] >> 10);
+		w[t] = w[t-16] + s0 + w[t-7] + s1;
+	}
+
+	uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+	uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+	for (int t=0;t<64;t++)
+	{
+		uint32_t t1 = h + (rotr(e,6) ^ rotr(e,11) ^ rotr(e,25)) + ((e & f) ^ (~e & g)) + K[t] + w[t];
+		uint32_t t2 = (rotr(a,2) ^ rotr(a,13) ^ rotr(a,22)) + ((a & b) ^ (a & c) ^ (b & c));
+		h = g;
+		g = f;
+		f = e;
+		e = d + t1;
+		d = c;
+		c = b;
+		b = a;
+		a = t1 + t2;
+	}
+	state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+	state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
+
+static void sha256_one_scalar(unsigned char *digest, const unsigned char *data, unsigned int len)
+{
+	uint32_t state[8];
+	unsigned char block[64];
+	memcpy(state,initial_state,sizeof(state));
+	unsigned int blocks = padded_blocks(len);
+	for (unsigned int b=0;b<blocks;b++)
+	{
+		// whole blocks of data are hashed in place
+		if ((b + 1) * 64 <= len)
+		{
+			compress_scalar(state,data+b*64);
+		}
+		else
+		{
+			get_block(block,data,len,b);
+			compress_scalar(state,block);
+		}
+	}
+	store_digest(digest,state);
+}
+
+#ifdef PBPDP_SHA256_X86
+
+// sha extensions, the usual two rounds per sha256rnds2 arrangement with the state split
+// into ABEF and CDGH
+
+__attribute__((target("sha,sse4.1,ssse3")))
+static void compress_shani(uint32_t *state, const unsigned char *block)
+{
+	const __m128i byte_swap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL,0x0405060700010203ULL);
+
+	__m128i tmp = _mm_loadu_si128((const __m128i*)&state[0]);
+	__m128i state1 = _mm_loadu_si128((const __m128i*)&state[4]);
+	tmp = _mm_shuffle_epi32(tmp,0xb1);							// CDAB
+	state1 = _mm_shuffle_epi32(state1,0x1b);					// EFGH
+	__m128i state0 = _mm_alignr_epi8(tmp,state1,8);				// ABEF
+	state1 = _mm_blend_epi16(state1,tmp,0xf0);					// CDGH
+	__m128i abef = state0;
+	__m128i cdgh = state1;
+
+	__m128i w[4];
+	// unrolled, so w stays in registers
+#pragma GCC unroll 16
+	for (int i=0;i<16;i++)
+	{
+		if (i < 4)
+		{
+			w[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(block+16*i)),byte_swap);
+		}
+		else
+		{
+			// w[i%4] holds words 4i-16.., the others 4i-12.., 4i-8.. and 4i-4..
+			__m128i w7 = _mm_alignr_epi8(w[(i+3)%4],w[(i+2)%4],4);
+			w[i%4] = _mm_sha256msg2_epu32(_mm_add_epi32(_mm_sha256msg1_epu32(w[i%4],w[(i+1)%4]),w7),w[(i+3)%4]);
+		}
+		__m128i msg = _mm_add_epi32(w[i%4],_mm_loadu_si128((const __m128i*)&K[4*i]));
+		state1 = _mm_sha256rnds2_epu32(state1,state0,msg);
+		msg = _mm_shuffle_epi32(msg,0x0e);
+		state0 = _mm_sha256rnds2_epu32(state0,state1,msg);
+	}
+
+	state0 = _mm_add_epi32(state0,abef);
+	state1 = _mm_add_epi32(state1,cdgh);
+
+	tmp = _mm_shuffle_epi32(state0,0x1b);						// FEBA
+	state1 = _mm_shuffle_epi32(state1,0xb1);					// DCHG
+	state0 = _mm_blend_epi16(tmp,state1,0xf0);					// DCBA
+	state1 = _mm_alignr_epi8(state1,tmp,8);						// HGFE
+	_mm_storeu_si128((__m128i*)&state[0],state0);
+	_mm_storeu_si128((__m128i*)&state[4],state1);
+}
+
+static void sha256_one_shani(unsigned char *digest, const unsigned char *data, unsigned int len)
+{
+	uint32_t state[8];
+	unsigned char block[64];
+	memcpy(state,initial_state,sizeof(state));
+	unsigned int blocks = padded_blocks(len);
+	for (unsigned int b=0;b<blocks;b++)
+	{
+		if ((b + 1) * 64 <= len)
+		{
+			compress_shani(state,data+b*64);
+		}
+		else
+		{
+			get_block(block,data,len,b);
+			compress_shani(state,block);
+		}
+	}
+	store_digest(digest,state);
+}
+
+// avx2, lane l of every register belongs to message l
+
+#define ROTR8(x,n) _mm256_or_si256(_mm256_srli_epi32(x,n),_mm256_slli_epi32(x,32-(n)))
+
+__attribute__((target("avx2")))
+static void compress_avx2(__m256i *state, const unsigned char *const *blocks)
+{
+	__m256i w[64];
+	for (int t=0;t<16;t++)
+	{
+		w[t] = _mm256_setr_epi32(load_be32(blocks[0]+4*t),load_be32(blocks[1]+4*t),load_be32(blocks[2]+4*t),load_be32(blocks[3]+4*t),
+			load_be32(blocks[4]+4*t),load_be32(blocks[5]+4*t),load_be32(blocks[6]+4*t),load_be32(blocks[7]+4*t));
+	}
+	for (int t=16;t<64;t++)
+	{
+		__m256i s0 = _mm256_xor_si256(_mm256_xor_si256(ROTR8(w[t-15],7),ROTR8(w[t-15],18)),_mm256_srli_epi32(w[t-15],3));
+		__m256i s1 = _mm256_xor_si256(_mm256_xor_si256(ROTR8(w[t-2],17),ROTR8(w[t-2],19)),_mm256_srli_epi32(w[t-2],10));
+		w[t] = _mm256_add_epi32(_mm256_add_epi32(w[t-16],s0),_mm256_add_epi32(w[t-7],s1));
+	}
+
+	__m256i a = state[0], b = state[1], c = state[2], d = state[3];
+	__m256i e = state[4], f = state[5], g = state[6], h = state[7];
+	for (int t=0;t<64;t++)
+	{
+		__m256i S1 = _mm256_xor_si256(_mm256_xor_si256(ROTR8(e,6),ROTR8(e,11)),ROTR8(e,25));
+		__m256i ch = _mm256_xor_si256(_mm256_and_si256(e,f),_mm256_andnot_si256(e,g));
+		__m256i t1 = _mm256_add_epi32(_mm256_add_epi32(h,S1),_mm256_add_epi32(ch,_mm256_add_epi32(_mm256_set1_epi32(K[t]),w[t])));
+		__m256i S0 = _mm256_xor_si256(_mm256_xor_si256(ROTR8(a,2),ROTR8(a,13)),ROTR8(a,22));
+		__m256i maj = _mm256_xor_si256(_mm256_xor_si256(_mm256_and_si256(a,b),_mm256_and_si256(a,c)),_mm256_and_si256(b,c));
+		__m256i t2 = _mm256_add_epi32(S0,maj);
+		h = g;
+		g = f;
+		f = e;
+		e = _mm256_add_epi32(d,t1);
+		d = c;
+		c = b;
+		b = a;
+		a = _mm256_add_epi32(t1,t2);
+	}
+	state[0] = _mm256_add_epi32(state[0],a); state[1] = _mm256_add_epi32(state[1],b);
+	state[2] = _mm256_add_epi32(state[2],c); state[3] = _mm256_add_epi32(state[3],d);
+	state[4] = _mm256_add_epi32(state[4],e); state[5] = _mm256_add_epi32(state[5],f);
+	state[6] = _mm256_add_epi32(state[6],g); state[7] = _mm256_add_epi32(state[7],h);
+}
+
+#undef ROTR8
+
+// up to 8 messages, the missing lanes repeat the last one and are thrown away
+__attribute__((target("avx2")))
+static void sha256_lanes_avx2(unsigned char *digests, const unsigned char *const *data, unsigned int len, unsigned int n)
+{
+	__m256i state[8];
+	for (int i=0;i<8;i++)
+	{
+		state[i] = _mm256_set1_epi32(initial_state[i]);
+	}
+
+	unsigned char padded[avx2_lanes][64];
+	const unsigned char *blocks[avx2_lanes];
+	unsigned int count = padded_blocks(len);
+	for (unsigned int b=0;b<count;b++)
+	{
+		for (int l=0;l<avx2_lanes;l++)
+		{
+			const unsigned char *msg = data[l < n ? l : n-1];
+			if ((b + 1) * 64 <= len)
+			{
+				blocks[l] = msg + b*64;
+			}
+			else
+			{
+				get_block(padded[l],msg,len,b);
+				blocks[l] = padded[l];
+			}
+		}
+		compress_avx2(state,blocks);
+	}
+
+	uint32_t lanes[8][avx2_lanes];
+	for (int i=0;i<8;i++)
+	{
+		_mm256_storeu_si256((__m256i*)lanes[i],state[i]);
+	}
+	for (int l=0;l<n;l++)
+	{
+		for (int i=0;i<8;i++)
+		{
+			store_be32(digests+sha256_digest_size*l+4*i,lanes[i][l]);
+		}
+	}
+}
+
+static bool cpu_has(sha256_impl impl)
+{
+	unsigned int eax, ebx, ecx, edx;
+	if (!__get_cpuid(1,&eax,&ebx,&ecx,&edx))
+	{
+		return false;
+	}
+	bool sse41 = ecx & bit_SSE4_1;
+	// avx needs the os to save the ymm registers
+	bool avx = (ecx & bit_AVX) && (ecx & bit_OSXSAVE);
+	if (avx)
+	{
+		unsigned int xcr0_lo, xcr0_hi;
+		__asm__("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+		avx = (xcr0_lo & 6) == 6;
+	}
+	if (!__get_cpuid_count(7,0,&eax,&ebx,&ecx,&edx))
+	{
+		return false;
+	}
+	switch (impl)
+	{
+	case sha256_avx2:
+		return avx && (ebx & bit_AVX2);
+	case sha256_shani:
+		return sse41 && (ebx & bit_SHA);
+	default:
+		return true;
+	}
+}
+
+#endif
+
+// bit k set when impl k is supported, -1 until the first call probes the cpu.  cpuid
+// is serializing and traps under some hypervisors, so it only runs once
+static std::atomic<int> supported_impls(-1);
+
+bool sha256_supported(sha256_impl impl)
+{
+	if (impl == sha256_scalar)
+	{
+		return true;
+	}
+#ifdef PBPDP_SHA256_X86
+	int impls = supported_impls;
+	if (impls < 0)
+	{
+		impls = 1 << sha256_scalar;
+		for (int i=sha256_scalar+1;i<=sha256_shani;i++)
+		{
+			if (cpu_has((sha256_impl)i))
+			{
+				impls |= 1 << i;
+			}
+		}
+		supported_impls = impls;
+	}
+	return impls & (1 << impl);
+#else
+	return false;
+#endif
+}
+
+// for the short messages the scheme hashes, eight avx2 lanes outrun the sha extensions
+// hashing one message at a time
+static sha256_impl best_impl()
+{
+	if (sha256_supported(sha256_avx2))
+	{
+		return sha256_avx2;
+	}
+	if (sha256_supported(sha256_shani))
+	{
+		return sha256_shani;
+	}
+	return sha256_scalar;
+}
+
+// -1 until the first call picks one
+static std::atomic<int> current_impl(-1);
+
+sha256_impl sha256_get_impl()
+{
+	int impl = current_impl;
+	if (impl < 0)
+	{
+		impl = best_impl();
+		current_impl = impl;
+	}
+	return (sha256_impl)impl;
+}
+
+void sha256_set_impl(sha256_impl impl)
+{
+	if (!sha256_supported(impl))
+	{
+		throw std::runtime_error("sha256_set_impl: not supported by this cpu");
+	}
+	current_impl = impl;
+}
+
+void sha256(unsigned char *digest, const unsigned char *data, unsigned int len)
+{
+#ifdef PBPDP_SHA256_X86
+	// a single message gains nothing from the avx2 lanes, but the sha extensions still help
+	if (sha256_get_impl() != sha256_scalar && sha256_supported(sha256_shani))
+	{
+		sha256_one_shani(digest,data,len);
+		return;
+	}
+#endif
+	sha256_one_scalar(digest,data,len);
+}
+
+void sha256_batch(unsigned char *digests, const unsigned char *const *data, unsigned int len, unsigned int n)
+{
+#ifdef PBPDP_SHA256_X86
+	if (sha256_get_impl() == sha256_avx2)
+	{
+		for (unsigned int k=0;k<n;k+=avx2_lanes)
+		{
+			sha256_lanes_avx2(digests+sha256_digest_size*k,data+k,len,n - k < avx2_lanes ? n - k : avx2_lanes);
+		}
+		return;
+	}
+#endif
+	for (unsigned int k=0;k<n;k++)
+	{
+		sha256(digests+sha256_digest_size*k,data[k],len);
+	}
+}
+
+};
@@ -0,0 +1,31 @@
+#ifndef PBPDP_SHA256_H
+#define PBPDP_SHA256_H
+
+// sha-256 for the many short, equal length messages the scheme hashes (every W_i is the
+// file name plus a block id, one or two compression blocks).  a batch of messages is
+// hashed eight at a time in the lanes of avx2 registers, or one after another with the
+// sha extensions, and single messages use the sha extensions when there are any.  the
+// implementation is picked at run time from what the cpu supports.  every implementation
+// gives the standard digests.
+
+namespace pbpdp
+{
+	static const unsigned int sha256_digest_size = 32;
+
+	enum sha256_impl
+	{
+		sha256_scalar,
+		sha256_avx2,		// 8 messages at a time
+		sha256_shani		// x86 sha extensions
+	};
+
+	bool sha256_supported(sha256_impl impl);
+	sha256_impl sha256_get_impl();
+	void sha256_set_impl(sha256_impl impl); // for testing and benchmarking, throws if the cpu lacks it
+
+	void sha256(unsigned char *digest, const unsigned char *data, unsigned int len);
+	// digests[32*k] = sha256(data[k]) for k < n, each message len bytes
+	void sha256_batch(unsigned char *digests, const unsigned char *const *data, unsigned int len, unsigned int n);
+};
+
+#endif
@@ -0,0 +1,423 @@
+#include "core.h"
+#include "element.h"
+#include "serial.h"
+#include "sha256.h"
+#include "instrument.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <deque>
+#include <set>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+
+// streaming sig_gen.  one reader thread, one hashing thread and the exponentiation
+// workers pass ranges of chunks to the calling thread, which writes the tags and keeps
+// the checkpoint.  ranges come from a fixed pool, so memory stays bounded however large
+// the file is.  a checkpoint records the length of the prefix of the file whose tags are
+// all written and synced:
+//
+//   'P','D','C','P' | version u32 | count u32 | done u32 | name_len u32 | name | sha256(public parameters)
+
+namespace pbpdp
+{
+
+static const unsigned int checkpoint_version = 1;
+
+// a range of chunks on its way through the pipeline
+struct stream_range
+{
+	unsigned int					first;
+	unsigned int					count;
+	std::vector<unsigned int>		positions;
+	mpz_block						chunks;
+	element_block<group_G1>			HW;
+	element_block<group_G1>			tags;
+};
+
+// the queue between two stages.  push blocks while it is full and pop while it is
+// empty, and both give up once it is closed
+class range_queue
+{
+public:
+	range_queue(unsigned int capacity) : _capacity(capacity), _closed(false) {}
+
+	bool push(stream_range *r)
+	{
+		std::unique_lock<std::mutex> lock(_lock);
+		_not_full.wait(lock,[this]() { return _ranges.size() < _capacity || _closed; });
+		if (_closed)
+		{
+			return false;
+		}
+		_ranges.push_back(r);
+		_not_empty.notify_one();
+		return true;
+	}
+
+	// false once closed and drained
+	bool pop(stream_range *&r)
+	{
+		std::unique_lock<std::mutex> lock(_lock);
+		_not_empty.wait(lock,[this]() { return !_ranges.empty() || _closed; });
+		if (_ranges.empty())
+		{
+			return false;
+		}
+		r = _ranges.front();
+		_ranges.pop_front();
+		_not_full.notify_one();
+		return true;
+	}
+
+	void close()
+	{
+		std::lock_guard<std::mutex> lock(_lock);
+		_closed = true;
+		_not_full.notify_all();
+		_not_empty.notify_all();
+	}
+
+private:
+	unsigned int					_capacity;
+	bool							_closed;
+	std::deque<stream_range*>		_ranges;
+	std::mutex						_lock;
+	std::condition_variable			_not_full;
+	std::condition_variable			_not_empty;
+};
+
+static void public_digest(unsigned char *digest, public_parameters &p)
+{
+	std::vector<unsigned char> data(p.get_serialized_size());
+	p.serialize(&data[0],data.size());
+	sha256(digest,&data[0],data.size());
+}
+
+// the prefix done for this file and keys, 0 (and no name) without a usable checkpoint
+static unsigned int read_checkpoint(const char *path, unsigned int count, const unsigned char *keys, std::vector<unsigned char> &name)
+{
+	FILE *f = fopen(path,"rb");
+	if (!f)
+	{
+		return 0;
+	}
+	std::vector<unsigned char> data;
+	unsigned char buf[256];
+	size_t n;
+	while ((n = fread(buf,1,sizeof(buf),f)) > 0)
+	{
+		data.insert(data.end(),buf,buf+n);
+	}
+	fclose(f);
+
+	if (data.size() < 8)
+	{
+		throw std::runtime_error(std::string("sig_gen_stream: ") + path + " is not a checkpoint");
+	}
+	serial_reader r(&data[0],data.size());
+	if (memcmp(r.get_bytes(4),"PDCP",4) || r.get_u32() != checkpoint_version)
+	{
+		throw std::runtime_error(std::string("sig_gen_stream: ") + path + " is not a checkpoint");
+	}
+	unsigned int checkpoint_count = r.get_u32();
+	unsigned int done = r.get_u32();
+	unsigned int name_len = r.get_u32();
+	const unsigned char *checkpoint_name = r.get_bytes(name_len);
+	if (checkpoint_count != count || done > count || memcmp(r.get_bytes(sha256_digest_size),keys,sha256_digest_size))
+	{
+		throw std::runtime_error(std::string("sig_gen_stream: ") + path + " belongs to another file or key");
+	}
+	name.assign(checkpoint_name,checkpoint_name+name_len);
+	return done;
+}
+
+// written aside and renamed, so a crash leaves the old checkpoint or the new one
+static void write_checkpoint(const char *path, unsigned int count, unsigned int done, const unsigned char *name, unsigned int name_len, const unsigned char *keys)
+{
+	std::vector<unsigned char> data(4 + 4*sizeof(unsigned int) + name_len + sha256_digest_size);
+	serial_writer w(&data[0],data.size());
+	w.put_bytes((const unsigned char*)"PDCP",4);
+	w.put_u32(checkpoint_version);
+	w.put_u32(count);
+	w.put_u32(done);
+	w.put_u32(name_len);
+	w.put_bytes(name,name_len);
+	w.put_bytes(keys,sha256_digest_size);
+
+	std::string tmp = std::string(path) + ".tmp";
+	int fd = ::open(tmp.c_str(),O_WRONLY | O_CREAT | O_TRUNC,0644);
+	if (fd < 0)
+	{
+		throw std::runtime_error("sig_gen_stream: unable to create " + tmp + ": " + strerror(errno));
+	}
+	unsigned int written = 0;
+	while (written < data.size())
+	{
+		ssize_t n = ::write(fd,&data[written],data.size()-written);
+		if (n < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			break;
+		}
+		written += n;
+	}
+	bool ok = written == data.size() && fsync(fd) == 0;
+	std::string err = strerror(errno);
+	::close(fd);
+	if (!ok || rename(tmp.c_str(),path) != 0)
+	{
+		unlink(tmp.c_str());
+		throw std::runtime_error(std::string("sig_gen_stream: unable to write ") + path + ": " + err);
+	}
+}
+
+void verification_metadata::init_streaming(secret_parameters &s, public_parameters &p, scheme_parameters &scheme, file &f, tag_sink &out, const stream_options &options)
+{
+	PBPDP_PHASE(phase_sig_gen);
+	PBPDP_TRACE("Streaming verification_metadata...");
+
+	cleanup();
+	_scheme = &scheme;
+	_hasher.init(scheme);
+
+	unsigned int count = f.get_chunk_count();
+	unsigned int range_size = options.range_size > 0 ? options.range_size : 1;
+	unsigned int depth = options.queue_depth > 0 ? options.queue_depth : 1;
+	unsigned int threads = options.threads > 0 ? options.threads : std::thread::hardware_concurrency();
+	if (threads == 0)
+	{
+		threads = 1;
+	}
+
+	// a checkpoint for this file and these keys gives the name its tags were made with
+	unsigned char keys[sha256_digest_size];
+	public_digest(keys,p);
+	std::vector<unsigned char> name;
+	unsigned int done = 0;
+	if (options.checkpoint_path)
+	{
+		done = read_checkpoint(options.checkpoint_path,count,keys,name);
+		if (done > 0 || !name.empty())
+		{
+			PBPDP_TRACE("Resuming after " << done << " of " << count << " chunks.");
+		}
+	}
+	if (!name.empty() && name.size() != scheme.get_name_len())
+	{
+		throw std::runtime_error("sig_gen_stream: checkpoint name doesn't fit the scheme");
+	}
+	_dynamic = false;
+	_ids.clear();
+	_next_id = count;
+	_count = count;
+	init_name(scheme,name.empty() ? 0 : &name[0]);
+
+	// enough ranges for every stage to be busy with the queues between them full
+	std::vector<stream_range> pool(3*depth + threads + 2);
+	range_queue free_ranges(pool.size());
+	range_queue read(depth);
+	range_queue hashed(depth);
+	range_queue tagged(depth);
+	for (int i=0;i<pool.size();i++)
+	{
+		pool[i].positions.resize(range_size);
+		pool[i].chunks.reserve(range_size);
+		pool[i].HW.reserve(scheme.get_pairing(),range_size);
+		pool[i].tags.reserve(scheme.get_pairing(),range_size);
+		free_ranges.push(&pool[i]);
+	}
+
+	std::exception_ptr error;
+	std::mutex error_lock;
+	auto fail = [&]()
+	{
+		std::lock_guard<std::mutex> lock(error_lock);
+		if (!error)
+		{
+			error = std::current_exception();
+		}
+		free_ranges.close();
+		read.close();
+		hashed.close();
+		tagged.close();
+	};
+
+	std::vector<std::thread> stages;
+
+	f.set_access_hint(access_sequential);
+	stages.push_back(std::thread([&]()
+	{
+		try
+		{
+			for (unsigned int first=done;first<count;first+=range_size)
+			{
+				stream_range *r;
+				if (!free_ranges.pop(r))
+				{
+					return;
+				}
+				r->first = first;
+				r->count = count - first < range_size ? count - first : range_size;
+				f.prefetch_chunks(r->first,r->count);
+				for (int k=0;k<r->count;k++)
+				{
+					r->positions[k] = r->first + k;
+					f.get_chunk(r->chunks[k],r->first + k);
+				}
+				PBPDP_COUNT(counter_chunks_read,r->count);
+				if (!read.push(r))
+				{
+					return;
+				}
+			}
+			read.close();
+		}
+		catch (...)
+		{
+			fail();
+		}
+	}));
+
+	stages.push_back(std::thread([&]()
+	{
+		try
+		{
+			element_hash hasher;
+			hasher.init(scheme);
+			std::vector<unsigned char> W(range_size*get_W_size());
+			stream_range *r;
+			while (read.pop(r))
+			{
+				get_HWi_batch(r->HW.get(),&r->positions[0],r->count,hasher,&W[0]);
+				if (!hashed.push(r))
+				{
+					return;
+				}
+			}
+			hashed.close();
+		}
+		catch (...)
+		{
+			fail();
+		}
+	}));
+
+	// the last worker out closes the queue to the writer
+	std::atomic<unsigned int> workers_left(threads);
+	for (int i=0;i<threads;i++)
+	{
+		stages.push_back(std::thread([&]()
+		{
+			try
+			{
+				g1_element t1(scheme.get_pairing());
+				g1_element t2(scheme.get_pairing());
+				mpz_value z2;
+				std::vector<element_s*> tags(range_size);
+				stream_range *r;
+				// sigma_i = (H(W_i)*prod(u_j^m_ij))^x, raised to x together
+				while (hashed.pop(r))
+				{
+					for (int k=0;k<r->count;k++)
+					{
+						p.pow_u(t1,r->chunks[k],t2,z2);
+						tags[k] = r->tags[k];
+						element_mul(tags[k],r->HW[k],t1.get());
+					}
+					scheme.pow_G1_batch(&tags[0],&tags[0],s.get_x(),r->count);
+					PBPDP_COUNT(counter_g1_exps,r->count);
+					if (!tagged.push(r))
+					{
+						return;
+					}
+				}
+				if (--workers_left == 0)
+				{
+					tagged.close();
+				}
+			}
+			catch (...)
+			{
+				fail();
+			}
+		}));
+	}
+
+	// ranges finish out of order, the checkpoint only covers the prefix that is complete
+	try
+	{
+		std::set<unsigned int> finished;
+		unsigned int last_checkpoint = done;
+		stream_range *r;
+		while (tagged.pop(r))
+		{
+			for (int k=0;k<r->count;k++)
+			{
+				out.put_tag(r->first + k,r->tags[k]);
+			}
+			finished.insert(r->first);
+			while (!finished.empty() && *finished.begin() == done)
+			{
+				finished.erase(finished.begin());
+				done = done + range_size < count ? done + range_size : count;
+			}
+			if (!free_ranges.push(r))
+			{
+				break;
+			}
+
+			if (options.checkpoint_path && done - last_checkpoint >= options.checkpoint_interval)
+			{
+				out.sync();
+				write_checkpoint(options.checkpoint_path,count,done,_name,_name_len,keys);
+				last_checkpoint = done;
+				PBPDP_TRACE("Checkpoint at " << done << " of " << count << " chunks.");
+			}
+		}
+	}
+	catch (...)
+	{
+		fail();
+	}
+
+	for (int i=0;i<stages.size();i++)
+	{
+		stages[i].join();
+	}
+	if (error)
+	{
+		// the checkpoint on disk still matches what was synced, so a rerun picks up there
+		delete[] _name;
+		delete[] _W_buffer;
+		_name = 0;
+		_W_buffer = 0;
+		_hasher.cleanup();
+		std::rethrow_exception(error);
+	}
+
+	out.sync();
+	sign_name(s,scheme);
+	if (options.checkpoint_path)
+	{
+		std::remove(options.checkpoint_path);
+	}
+
+	// the tags only exist in out
+	_serialize_tags = false;
+	_initialized = true;
+	PBPDP_TRACE("Verification metadata streamed.");
+}
+
+};
@@ -0,0 +1,217 @@
+#include "tag_store.h"
+#include "instrument.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#include <cerrno>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace pbpdp
+{
+
+static const unsigned int tag_store_version = 1;
+static const unsigned int tag_store_header_size = 16;
+
+static void put_u32(unsigned char *p, unsigned int v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+static unsigned int get_u32(const unsigned char *p)
+{
+	return ((unsigned int)p[0] << 24) | ((unsigned int)p[1] << 16) | ((unsigned int)p[2] << 8) | p[3];
+}
+
+static void write_fully(int fd, const unsigned char *data, size_t len, uint64_t offset)
+{
+	while (len > 0)
+	{
+		ssize_t n = pwrite(fd,data,len,offset);
+		if (n < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			throw std::runtime_error(std::string("tag_store: write failed: ") + strerror(errno));
+		}
+		data += n;
+		len -= n;
+		offset += n;
+	}
+}
+
+void tag_store_writer::open(const char *path, scheme_parameters &scheme, unsigned int count)
+{
+	close();
+	
+	_stride = pairing_length_in_bytes_compressed_G1(scheme.get_pairing());
+	_count = count;
+	
+	_fd = ::open(path,O_RDWR | O_CREAT,0644);
+	if (_fd < 0)
+	{
+		throw std::runtime_error(std::string("tag_store: unable to open ") + path + ": " + strerror(errno));
+	}
+	
+	unsigned char header[tag_store_header_size];
+	header[0] = 'P';
+	header[1] = 'D';
+	header[2] = 'T';
+	header[3] = 'S';
+	put_u32(header+4,tag_store_version);
+	put_u32(header+8,_stride);
+	put_u32(header+12,_count);
+	write_fully(_fd,header,sizeof(header),0);
+	
+	// size the file up front so tags can be written in any order
+	if (ftruncate(_fd,tag_store_header_size + (uint64_t)_count*_stride) != 0)
+	{
+		std::string err = strerror(errno);
+		close();
+		throw std::runtime_error("tag_store: unable to size store: " + err);
+	}
+}
+
+void tag_store_writer::put_tag(unsigned int i, element_t e)
+{
+	if (i >= _count)
+	{
+		throw std::out_of_range("tag_store: tag index out of range");
+	}
+	std::vector<unsigned char> buf(_stride);
+	element_to_bytes_compressed(&buf[0],e);
+	write_fully(_fd,&buf[0],_stride,tag_store_header_size + (uint64_t)i*_stride);
+}
+
+void tag_store_writer::sync()
+{
+	if (_fd >= 0 && fsync(_fd) != 0)
+	{
+		throw std::runtime_error(std::string("tag_store: sync failed: ") + strerror(errno));
+	}
+}
+
+void tag_store_writer::close()
+{
+	if (_fd >= 0)
+	{
+		::close(_fd);
+		_fd = -1;
+	}
+}
+
+void tag_store::write(const char *path, verification_metadata &vm, scheme_parameters &scheme)
+{
+	tag_store_writer w;
+	element_t t;
+	
+	element_init_G1(t,scheme.get_pairing());
+	w.open(path,scheme,vm.get_count());
+	for (int i=0;i<vm.get_count();i++)
+	{
+		w.put_tag(i,vm.load_authenticator(i,t));
+	}
+	w.sync();
+	w.close();
+	element_clear(t);
+}
+
+void tag_store::open(const char *path, scheme_parameters &scheme)
+{
+	close();
+	
+	_fd = ::open(path,O_RDONLY);
+	if (_fd < 0)
+	{
+		throw std::runtime_error(std::string("tag_store: unable to open ") + path + ": " + strerror(errno));
+	}
+	
+	struct stat st;
+	if (fstat(_fd,&st) != 0 || st.st_size < tag_store_header_size)
+	{
+		close();
+		throw std::runtime_error(std::string("tag_store: ") + path + " is not a tag store");
+	}
+	_size = st.st_size;
+	
+	void *data = mmap(0,_size,PROT_READ,MAP_SHARED,_fd,0);
+	if (data == MAP_FAILED)
+	{
+		std::string err = strerror(errno);
+		close();
+		throw std::runtime_error(std::string("tag_store: unable to map ") + path + ": " + err);
+	}
+	_data = (unsigned char*)data;
+	
+	if (memcmp(_data,"PDTS",4) != 0 || get_u32(_data+4) != tag_store_version)
+	{
+		close();
+		throw std::runtime_error(std::string("tag_store: ") + path + " is not a tag store");
+	}
+	_stride = get_u32(_data+8);
+	_count = get_u32(_data+12);
+	if (_stride != pairing_length_in_bytes_compressed_G1(scheme.get_pairing()) || _size < tag_store_header_size + (uint64_t)_count*_stride)
+	{
+		close();
+		throw std::runtime_error(std::string("tag_store: ") + path + " doesn't match the scheme or is truncated");
+	}
+	
+	// audits touch a sparse sample of tags
+	madvise(_data,_size,MADV_RANDOM);
+}
+
+void tag_store::close()
+{
+	if (_data)
+	{
+		munmap(_data,_size);
+		_data = 0;
+	}
+	if (_fd >= 0)
+	{
+		::close(_fd);
+		_fd = -1;
+	}
+	_size = 0;
+	_count = 0;
+}
+
+void tag_store::get_tag(element_t e, unsigned int i) const
+{
+	if (i >= _count)
+	{
+		throw std::out_of_range("tag_store: tag index out of range");
+	}
+	PBPDP_COUNT(counter_bytes_read,_stride);
+	element_from_bytes_compressed(e,_data + tag_store_header_size + (uint64_t)i*_stride);
+}
+
+void tag_store::prefetch_tags(unsigned int first, unsigned int count) const
+{
+	if (!_data || first >= _count || count == 0)
+	{
+		return;
+	}
+	if (count > _count - first)
+	{
+		count = _count - first;
+	}
+	
+	uint64_t page = sysconf(_SC_PAGESIZE);
+	uint64_t start = tag_store_header_size + (uint64_t)first*_stride;
+	uint64_t end = tag_store_header_size + (uint64_t)(first+count)*_stride;
+	start -= start % page;
+	
+	madvise(_data+start,end-start,MADV_WILLNEED);
+}
+
+};
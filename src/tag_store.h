@@ -0,0 +1,64 @@
+#ifndef PBPDP_TAG_STORE_H
+#define PBPDP_TAG_STORE_H
+
+#include <stdint.h>
+
+#include "core.h"
+
+// an on-disk copy of a file's authenticators.  tags are stored compressed at a fixed
+// stride after a small header, so tag i lives at a known offset and a reader can map
+// the file and decode only the tags an audit touches:
+//
+//   'P','D','T','S' | version u32 | stride u32 | count u32 | count * stride bytes
+
+namespace pbpdp
+{
+	class tag_store_writer : public tag_sink
+	{
+	public:
+		tag_store_writer() : _fd(-1), _stride(0), _count(0) {}
+		~tag_store_writer() { close(); }
+		
+		// creates (or reopens, keeping existing tags) a store for count tags
+		void open(const char *path, scheme_parameters &scheme, unsigned int count);
+		void put_tag(unsigned int i, element_t e); // safe to call from several threads
+		void sync(); // flushes written tags to disk
+		void close();
+		
+	private:
+		tag_store_writer(const tag_store_writer&);
+		tag_store_writer& operator=(const tag_store_writer&);
+	
+		int					_fd;
+		unsigned int		_stride;
+		unsigned int		_count;
+	};
+	
+	class tag_store
+	{
+	public:
+		tag_store() : _fd(-1), _data(0), _size(0), _stride(0), _count(0) {}
+		~tag_store() { close(); }
+		
+		static void write(const char *path, verification_metadata &vm, scheme_parameters &scheme);
+		
+		void open(const char *path, scheme_parameters &scheme);
+		void close();
+		
+		unsigned int get_count() const { return _count; }
+		void get_tag(element_t e, unsigned int i) const; // decodes tag i, safe to call from several threads
+		void prefetch_tags(unsigned int first, unsigned int count) const;
+		
+	private:
+		tag_store(const tag_store&);
+		tag_store& operator=(const tag_store&);
+	
+		int					_fd;
+		unsigned char*		_data;
+		uint64_t			_size;
+		unsigned int		_stride;
+		unsigned int		_count;
+	};
+};
+
+#endif
@@ -1,14 +1,79 @@
 #include <config.h>
 #include <cryptopp/osrng.h>
+#include <cryptopp/sha.h>
 #include <iostream>
 #include <stdexcept>
 #include <chrono>
 #include <ctime>
 #include <string>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include <utility>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
 #include "core.h"
+#include "mmap_file.h"
+#include "tag_store.h"
+#include "auditor.h"
+#include "hw_cache.h"
+#include "mask_pool.h"
+#include "instrument.h"
+#include "keystore.h"
+#include "sha256.h"
+#include "fq.h"
+#include "type_a.h"
 
 using namespace pbpdp;
 
+// a file held as separate blocks, so blocks can be changed, inserted and removed
+class block_file : public file
+{
+public:
+	block_file(unsigned int count,unsigned int chunk_size) : _chunk_size(chunk_size)
+	{
+		for (int i=0;i<count;i++)
+		{
+			_blocks.push_back(random_block());
+		}
+	}
+
+	std::vector<unsigned char> random_block()
+	{
+		std::vector<unsigned char> block(_chunk_size);
+		CryptoPP::AutoSeededRandomPool rng;
+		rng.GenerateBlock(&block[0],_chunk_size);
+		return block;
+	}
+
+	void get_chunk(mpz_t e,unsigned int i)
+	{
+		mpz_import(e,_chunk_size,1,sizeof(unsigned char),0,0,&_blocks[i][0]);
+	}
+
+	void get_chunk(element_t e,unsigned int i)
+	{
+		element_from_bytes(e,&_blocks[i][0]);
+	}
+
+	unsigned int get_chunk_count()
+	{
+		return _blocks.size();
+	}
+
+	std::vector<std::vector<unsigned char> > _blocks;
+	unsigned int _chunk_size;
+};
+
+static void round_trip(const serializable &from,serializable &to)
+{
+	std::vector<unsigned char> data(from.get_serialized_size());
+	from.serialize(&data[0],data.size());
+	to.deserialize(&data[0],data.size());
+}
+
 class random_file : public file
 {
 public:
@@ -101,17 +166,69 @@ private:
 	unsigned char *_buf;
 };
 
+// a tag sink that stops part way, like a crashed sig_gen
+class crashing_sink : public tag_sink
+{
+public:
+	crashing_sink(tag_sink &out,unsigned int limit) : _out(out), _limit(limit), _count(0) {}
+
+	void put_tag(unsigned int i,element_t e)
+	{
+		if (_count++ == _limit)
+		{
+			throw std::runtime_error("simulated crash");
+		}
+		_out.put_tag(i,e);
+	}
+
+	void sync()
+	{
+		_out.sync();
+	}
+
+	tag_sink &_out;
+	unsigned int _limit;
+	unsigned int _count;
+};
+
+// counts the tags that reach a sink
+class counting_sink : public tag_sink
+{
+public:
+	counting_sink(tag_sink &out) : _out(out), _count(0) {}
+
+	void put_tag(unsigned int i,element_t e)
+	{
+		_count++;
+		_out.put_tag(i,e);
+	}
+
+	void sync()
+	{
+		_out.sync();
+	}
+
+	tag_sink &_out;
+	unsigned int _count;
+};
+
 int main(int argc,char *argv[])
 {
 	// simple test program that should test the process.
 	try {
 
-	// usage: [-ssize] [-bblock_size] [-pparam_file]
+	// usage: [-ssize] [-bblock_size] [-pparam_file | -ccurve] [-tthreads] [-fdata_file]
+	//        [-ddetection] [-rcorrupted_fraction]
 
 	unsigned int size = 10000;
 	unsigned int blk_size = 4000;
+	unsigned int threads = 1;
+	curve_type curve = curve_a;
 	char *param_file_name = 0;
+	char *data_file_name = 0;
 	char *params = 0;
+	double detection = 0.99;
+	double corrupted = 0.01;
 
 	for (int i=1;i<argc;i++)
 	{
@@ -127,6 +244,26 @@ int main(int argc,char *argv[])
 				blk_size = atoi(&argv[i][2]);
 				std::cout << "Using block size of " << blk_size << std::endl;
 				break;
+			case 't':
+				threads = atoi(&argv[i][2]);
+				std::cout << "Using " << threads << " sig_gen threads" << std::endl;
+				break;
+			case 'c':
+				curve = get_curve_type(&argv[i][2]);
+				std::cout << "Generating " << &argv[i][2] << " curve parameters" << std::endl;
+				break;
+			case 'f':
+				data_file_name = &argv[i][2];
+				std::cout << "Auditing data file " << data_file_name << std::endl;
+				break;
+			case 'd':
+				detection = atof(&argv[i][2]);
+				std::cout << "Planning challenges for " << detection << " detection" << std::endl;
+				break;
+			case 'r':
+				corrupted = atof(&argv[i][2]);
+				std::cout << "Planning challenges against " << corrupted << " corrupted" << std::endl;
+				break;
 			case 'p':
 				param_file_name = &argv[i][2];
 				std::cout << "Using parameter file " << param_file_name << std::endl;
@@ -166,23 +303,37 @@ int main(int argc,char *argv[])
 		}
 	}
 
+	memory_sink sink;
+	instrument::set_sink(&sink);
+
 	scheme_parameters scheme;
 	public_parameters p;
 	secret_parameters s;
 
 	std::cout << "Generating key..." << std::endl;
 
-	std::chrono::time_point<std::chrono::system_clock> start, end;
+	std::chrono::steady_clock::time_point start, end;
 
-	key_gen(scheme,s,p,params);
+	key_gen(scheme,s,p,params,blk_size,curve);
 
-	random_file f(size,blk_size);
+	random_file *rf = 0;
+	mmap_file mf;
+	if (data_file_name)
+	{
+		mf.open(data_file_name,blk_size);
+		size = mf.get_size();
+	}
+	else
+	{
+		rf = new random_file(size,blk_size);
+	}
+	file &f = rf ? *(file*)rf : mf;
 
 	verification_metadata vmd;
 
-	start = std::chrono::system_clock::now();
-	sig_gen(vmd,s,p,scheme,f);
-	end = std::chrono::system_clock::now();
+	start = std::chrono::steady_clock::now();
+	sig_gen(vmd,s,p,scheme,f,threads);
+	end = std::chrono::steady_clock::now();
 
 	std::chrono::duration<double> elapsed = end - start;
 
@@ -197,29 +348,307 @@ int main(int argc,char *argv[])
 		std::cout << "Signature failed." << std::endl;
 	}
 
+	// tagging with several threads gives the serial tags.  the file has enough chunks for
+	// every thread to claim ranges
+	random_file tag_file(blk_size*70,blk_size);
+	verification_metadata vmd_serial, vmd_parallel;
+	sig_gen(vmd_serial,s,p,scheme,tag_file,1);
+	std::vector<unsigned char> tag_name(vmd_serial.get_W_size());
+	vmd_serial.init_W(&tag_name[0]);
+	vmd_parallel.init(s,p,scheme,tag_file,4,&tag_name[0]);
+	if (vmd_parallel.get_count() != vmd_serial.get_count())
+	{
+		throw std::runtime_error("Parallel sig_gen tagged a different number of chunks");
+	}
+	for (int i=0;i<vmd_serial.get_count();i++)
+	{
+		if (element_cmp(vmd_parallel.get_authenticator(i),vmd_serial.get_authenticator(i)))
+		{
+			throw std::runtime_error("Parallel sig_gen disagrees with serial sig_gen");
+		}
+	}
+	std::cout << "Parallel sig_gen matches serial." << std::endl;
+
+	// every sha-256 the cpu has agrees with crypto++, for one and several blocks and
+	// batches that don't fill the avx2 lanes, so batched H(W_i) are the same points
+	CryptoPP::SHA256 reference;
+	const unsigned int hash_count = 11;
+	std::vector<unsigned char> messages(hash_count*130);
+	std::vector<const unsigned char*> message_ptrs(hash_count);
+	unsigned char digests[hash_count*sha256_digest_size];
+	unsigned char expected[sha256_digest_size];
+	for (int k=0;k<messages.size();k++)
+	{
+		messages[k] = k*7;
+	}
+	sha256_impl default_impl = sha256_get_impl();
+	for (int i=sha256_scalar;i<=sha256_shani;i++)
+	{
+		if (!sha256_supported((sha256_impl)i))
+		{
+			continue;
+		}
+		sha256_set_impl((sha256_impl)i);
+		for (unsigned int len=0;len<130;len++)
+		{
+			for (int k=0;k<hash_count;k++)
+			{
+				message_ptrs[k] = &messages[k*len];
+			}
+			sha256_batch(digests,&message_ptrs[0],len,hash_count);
+			for (int k=0;k<hash_count;k++)
+			{
+				reference.CalculateDigest(expected,message_ptrs[k],len);
+				if (memcmp(expected,digests+k*sha256_digest_size,sha256_digest_size))
+				{
+					throw std::runtime_error("sha256_batch disagrees with crypto++");
+				}
+			}
+		}
+		std::cout << "sha256 implementation " << i << " agrees with crypto++." << std::endl;
+	}
+	sha256_set_impl(default_impl);
+	
+	element_hash hasher;
+	hasher.init(scheme);
+	std::vector<element_s> batch_points(hash_count);
+	std::vector<element_s*> batch_point_ptrs(hash_count);
+	element_t point;
+	element_init_G1(point,scheme.get_pairing());
+	for (int k=0;k<hash_count;k++)
+	{
+		element_init_G1(&batch_points[k],scheme.get_pairing());
+		batch_point_ptrs[k] = &batch_points[k];
+		message_ptrs[k] = &messages[k*24];
+	}
+	hasher.hash_data_to_elements(&batch_point_ptrs[0],&message_ptrs[0],24,hash_count);
+	for (int k=0;k<hash_count;k++)
+	{
+		hasher.hash_data_to_element(point,&messages[k*24],24);
+		if (element_cmp(point,&batch_points[k]))
+		{
+			throw std::runtime_error("Batched hash to G1 gives different points");
+		}
+		element_clear(&batch_points[k]);
+	}
+	element_clear(point);
+	hasher.cleanup();
+	std::cout << "Batched hash to G1 matches." << std::endl;
+
+	// every fixed width field the cpu has agrees with gmp, single elements and lanes.
+	// moduli are the type a q G1 runs over, when the curve is type a, and the largest
+	// prime below 2^512, which fills every limb
+	fq_impl default_fq = fq_get_impl();
+	mpz_t fa, fb, fr, fe;
+	mpz_init(fa);
+	mpz_init(fb);
+	mpz_init(fr);
+	mpz_init(fe);
+	std::vector<__mpz_struct> moduli(2);
+	unsigned int modulus_count = 0;
+	if (scheme.get_fast_G1())
+	{
+		mpz_init_set(&moduli[modulus_count++],scheme.get_type_a_G1()->get_field().get_q());
+	}
+	mpz_init(&moduli[modulus_count]);
+	mpz_setbit(&moduli[modulus_count],512);
+	do
+	{
+		mpz_sub_ui(&moduli[modulus_count],&moduli[modulus_count],1);
+	}
+	while (!mpz_probab_prime_p(&moduli[modulus_count],30));
+	modulus_count++;
+	for (int m=0;m<modulus_count;m++)
+	{
+		for (int i=fq_portable;i<=fq_ifma;i++)
+		{
+			if (!fq_supported((fq_impl)i))
+			{
+				continue;
+			}
+			fq_set_impl((fq_impl)i);
+			fq_field field;
+			__mpz_struct *modulus = &moduli[m];
+			field.init(modulus);
+			fq_element x, y, z;
+			fq_vector xs, ys, zs;
+			for (int k=0;k<200;k++)
+			{
+				pbc_mpz_random(fa,modulus);
+				pbc_mpz_random(fb,modulus);
+				if (k == 0)
+				{
+					mpz_sub_ui(fa,modulus,1);
+					mpz_sub_ui(fb,modulus,1);
+				}
+				field.set_mpz(x,fa);
+				field.set_mpz(y,fb);
+				for (int op=0;op<4;op++)
+				{
+					switch (op)
+					{
+					case 0: field.add(z,x,y); mpz_add(fe,fa,fb); break;
+					case 1: field.sub(z,x,y); mpz_sub(fe,fa,fb); break;
+					case 2: field.mul(z,x,y); mpz_mul(fe,fa,fb); break;
+					default: field.inv(z,x); mpz_invert(fe,fa,modulus); break;
+					}
+					mpz_mod(fe,fe,modulus);
+					field.get_mpz(fr,z);
+					if (mpz_cmp(fr,fe))
+					{
+						throw std::runtime_error("fq_field disagrees with gmp");
+					}
+				}
+				if (!field.has_lanes())
+				{
+					continue;
+				}
+				unsigned int lane = k % fq_lanes;
+				field.set_lane_mpz(xs,lane,fa);
+				field.set_lane_mpz(ys,lane,fb);
+				if (lane < fq_lanes - 1)
+				{
+					continue;
+				}
+				for (int op=0;op<4;op++)
+				{
+					switch (op)
+					{
+					case 0: field.add_lanes(zs,xs,ys); break;
+					case 1: field.sub_lanes(zs,xs,ys); break;
+					case 2: field.mul_lanes(zs,xs,ys); break;
+					default: field.inv_lanes(zs,xs); break;
+					}
+					for (int l=0;l<fq_lanes;l++)
+					{
+						field.get_lane_mpz(fa,xs,l);
+						field.get_lane_mpz(fb,ys,l);
+						switch (op)
+						{
+						case 0: mpz_add(fe,fa,fb); break;
+						case 1: mpz_sub(fe,fa,fb); break;
+						case 2: mpz_mul(fe,fa,fb); break;
+						default: mpz_invert(fe,fa,modulus); break;
+						}
+						mpz_mod(fe,fe,modulus);
+						field.get_lane_mpz(fr,zs,l);
+						if (mpz_cmp(fr,fe))
+						{
+							throw std::runtime_error("fq_field lanes disagree with gmp");
+						}
+					}
+				}
+			}
+			std::cout << "fq implementation " << i << " agrees with gmp modulo a " << mpz_sizeinbase(modulus,2) << " bit prime." << std::endl;
+		}
+	}
+	for (int m=0;m<modulus_count;m++)
+	{
+		mpz_clear(&moduli[m]);
+	}
+	mpz_clear(fe);
+	mpz_clear(fr);
+	mpz_clear(fb);
+	mpz_clear(fa);
+	
+	// and G1 exponentiations on it are pbc's points, including the identity, a zero
+	// exponent and a partly filled batch
+	if (scheme.get_fast_G1())
+	{
+		const unsigned int point_count = 11;
+		std::vector<element_s> bases(point_count), powers(point_count);
+		std::vector<element_s*> base_ptrs(point_count), power_ptrs(point_count);
+		element_t exponent, expected_point;
+		element_init_Zr(exponent,scheme.get_pairing());
+		element_init_G1(expected_point,scheme.get_pairing());
+		for (int k=0;k<point_count;k++)
+		{
+			element_init_G1(&bases[k],scheme.get_pairing());
+			element_init_G1(&powers[k],scheme.get_pairing());
+			element_random(&bases[k]);
+			base_ptrs[k] = &bases[k];
+			power_ptrs[k] = &powers[k];
+		}
+		element_set1(&bases[3]);
+		for (int i=fq_portable;i<=fq_ifma;i++)
+		{
+			if (!fq_supported((fq_impl)i))
+			{
+				continue;
+			}
+			fq_set_impl((fq_impl)i);
+			scheme.set_fast_G1(true);
+			for (int round=0;round<3;round++)
+			{
+				element_random(exponent);
+				if (round == 2)
+				{
+					element_set0(exponent);
+				}
+				scheme.pow_G1_batch(&power_ptrs[0],&base_ptrs[0],exponent,point_count);
+				for (int k=0;k<point_count;k++)
+				{
+					element_pow_zn(expected_point,&bases[k],exponent);
+					if (element_cmp(expected_point,&powers[k]))
+					{
+						throw std::runtime_error("Fixed width G1 exponentiation disagrees with pbc");
+					}
+					scheme.pow_G1(&powers[k],&bases[k],exponent);
+					if (element_cmp(expected_point,&powers[k]))
+					{
+						throw std::runtime_error("Fixed width G1 exponentiation disagrees with pbc");
+					}
+				}
+			}
+			std::cout << "G1 exponentiation on fq implementation " << i << " agrees with pbc." << std::endl;
+		}
+		for (int k=0;k<point_count;k++)
+		{
+			element_clear(&powers[k]);
+			element_clear(&bases[k]);
+		}
+		element_clear(expected_point);
+		element_clear(exponent);
+	}
+	fq_set_impl(default_fq);
+	scheme.set_fast_G1(true);
+
+	// the challenge size comes from the detection target, not the file size
+	challenge_plan plan = plan_challenge(f.get_chunk_count(),detection,corrupted,calibrate_challenge_costs(vmd,p,scheme,f));
+	if (plan.c > f.get_chunk_count() || (plan.c < f.get_chunk_count() && plan.detection < detection))
+	{
+		throw std::runtime_error("Challenge plan misses its target");
+	}
+	if (plan_challenge_size(100000000,0.99,0.01) != plan_challenge_size(1000000,0.99,0.01))
+	{
+		throw std::runtime_error("Challenge plan grows with the file");
+	}
+	std::cout << "Challenging " << plan.c << " of " << f.get_chunk_count() << " chunks for " << plan.detection << " detection, estimated "
+		<< plan.prover_seconds << "s to prove and " << plan.verifier_seconds << "s to verify." << std::endl;
+
 	challenge chal;
 
 
-	start = std::chrono::system_clock::now();
-	gen_challenge(chal,scheme,f.get_chunk_count()*0.8,f.get_chunk_count());
-	end = std::chrono::system_clock::now();
+	start = std::chrono::steady_clock::now();
+	gen_challenge(chal,scheme,plan.c,f.get_chunk_count());
+	end = std::chrono::steady_clock::now();
 
 	elapsed = end - start;
 
-	std::cout << "gen_challenge (bytes/s): " << size / elapsed.count() << std::endl;
+	std::cout << "gen_challenge (pairs/s): " << chal.get_count() / elapsed.count() << std::endl;
 
 	response_proof rp;
 
 
-	start = std::chrono::system_clock::now();
+	start = std::chrono::steady_clock::now();
 	gen_proof(rp,chal,vmd,p,scheme,f);
-	end = std::chrono::system_clock::now();
+	end = std::chrono::steady_clock::now();
 
 	elapsed = end - start;
 
-	std::cout << "gen_proof (bytes/s): " << size / elapsed.count() << std::endl;
+	std::cout << "gen_proof (pairs/s): " << chal.get_count() / elapsed.count() << std::endl;
 
-	start  = std::chrono::system_clock::now();
+	start  = std::chrono::steady_clock::now();
 	if (verify_proof(rp,chal,vmd,p,scheme))
 	{
 		std::cout << "Proof verified." << std::endl;
@@ -229,11 +658,676 @@ int main(int argc,char *argv[])
 		std::cout << "Proof invalid." << std::endl;
 		throw std::runtime_error("Invalid proof");
 	}
-	end = std::chrono::system_clock::now();
+	end = std::chrono::steady_clock::now();
 
 	elapsed = end - start;
 
-	std::cout << "verify_proof (bytes/s): " << size / elapsed.count() << std::endl;
+	std::cout << "verify_proof (pairs/s): " << chal.get_count() / elapsed.count() << std::endl;
+
+	// batch verification should pass the good proofs and pick out a corrupted one
+	response_proof rp_good,rp_bad;
+	gen_proof(rp_good,chal,vmd,p,scheme,f);
+	gen_proof(rp_bad,chal,vmd,p,scheme,f);
+	element_random(rp_bad.get_sigma());
+
+	std::vector<batch_entry> batch;
+	response_proof *proofs[] = { &rp, &rp_good, &rp_bad };
+	for (int i=0;i<3;i++)
+	{
+		batch_entry entry = { proofs[i], &chal, &vmd, &p };
+		batch.push_back(entry);
+	}
+
+	std::vector<bool> valid;
+	if (verify_proof_batch(batch,scheme,&valid) || !valid[0] || !valid[1] || valid[2])
+	{
+		throw std::runtime_error("Batch verification did not isolate the invalid proof");
+	}
+	std::cout << "Batch verification isolated the invalid proof." << std::endl;
+
+	// repeated audits take H(W_i) from the cache, a small memory budget forces some to disk
+	hw_cache hwc;
+	hw_cache_options cache_options;
+	cache_options.memory_bytes = 16*1024;
+	cache_options.disk_bytes = 1 << 20;
+	cache_options.spill_path = "test_hw.tmp";
+	hwc.init(scheme,cache_options);
+	vmd.attach_hw_cache(&hwc);
+	for (int i=0;i<2;i++)
+	{
+		if (!verify_proof(rp,chal,vmd,p,scheme))
+		{
+			throw std::runtime_error("Proof invalid with H(W_i) cache");
+		}
+	}
+	vmd.attach_hw_cache(0);
+	hw_cache_stats cache_stats = hwc.get_stats();
+	if (cache_stats.hits + cache_stats.disk_hits == 0)
+	{
+		throw std::runtime_error("H(W_i) cache never hit");
+	}
+	std::cout << "H(W_i) cache: " << cache_stats.hits << " hits, " << cache_stats.disk_hits << " from disk, " << cache_stats.misses << " misses." << std::endl;
+	hwc.cleanup();
+
+	// proofs take their masks from a pool filled in the background
+	mask_pool masks;
+	masks.init(p,scheme,4);
+	masks.fill();
+	response_proof rp_masked;
+	gen_proof(rp_masked,chal,vmd,p,scheme,f,&masks);
+	if (!verify_proof(rp_masked,chal,vmd,p,scheme))
+	{
+		throw std::runtime_error("Proof with a pooled mask invalid");
+	}
+	if (masks.get_stats().taken != 1)
+	{
+		throw std::runtime_error("Proof didn't use the mask pool");
+	}
+	// masks for other parameters are refused, the proof then makes its own
+	public_parameters p_wide;
+	p_wide.init(scheme,s,p.get_sector_count()+1);
+	std::vector<element_s> r_wide(p_wide.get_sector_count());
+	for (int j=0;j<r_wide.size();j++)
+	{
+		element_init_Zr(&r_wide[j],scheme.get_pairing());
+	}
+	element_t R_wide;
+	element_init_GT(R_wide,scheme.get_pairing());
+	bool took_wide = masks.take(p_wide,&r_wide[0],R_wide);
+	element_clear(R_wide);
+	for (int j=0;j<r_wide.size();j++)
+	{
+		element_clear(&r_wide[j]);
+	}
+	if (took_wide || masks.get_stats().mismatched != 1)
+	{
+		throw std::runtime_error("Mask pool handed out a mask for other parameters");
+	}
+	masks.cleanup();
+	std::cout << "Proof with a pooled mask verified." << std::endl;
+
+	// proofs and challenges can be kept in containers, moving one keeps what it holds.
+	// each of these runs in the same thread scratch as the audits above
+	std::vector<challenge> held_chals;
+	std::vector<response_proof> held_proofs;
+	for (int i=0;i<3;i++)
+	{
+		challenge fresh_chal;
+		response_proof fresh_proof;
+		gen_seeded_challenge(fresh_chal,scheme,chal.get_count(),f.get_chunk_count());
+		gen_proof(fresh_proof,fresh_chal,vmd,p,scheme,f);
+		held_chals.push_back(std::move(fresh_chal));
+		held_proofs.push_back(std::move(fresh_proof));
+	}
+	for (int i=0;i<3;i++)
+	{
+		if (!verify_proof(held_proofs[i],held_chals[i],vmd,p,scheme))
+		{
+			throw std::runtime_error("Proof invalid after moving it");
+		}
+	}
+	std::cout << "Moved proofs verified." << std::endl;
+
+	// a verifier that only has the serialized objects should reach the same result
+	scheme_parameters scheme2;
+	public_parameters p2;
+	verification_metadata vmd2;
+	challenge chal2;
+	response_proof rp2;
+
+	round_trip(scheme,scheme2);
+	p2.set_scheme(scheme2);
+	vmd2.set_scheme(scheme2);
+	chal2.set_scheme(scheme2);
+	rp2.set_scheme(scheme2);
+	round_trip(p,p2);
+	round_trip(vmd,vmd2);
+	round_trip(chal,chal2);
+	round_trip(rp,rp2);
+
+	if (!check_sig(vmd2,p2,scheme2) || !verify_proof(rp2,chal2,vmd2,p2,scheme2))
+	{
+		throw std::runtime_error("Deserialized proof invalid");
+	}
+	std::cout << "Deserialized proof verified." << std::endl;
+
+	// an H(W_i) cache only serves the scheme it was made for
+	hw_cache hwc2;
+	hwc2.init(scheme2);
+	bool cache_rejected = false;
+	try
+	{
+		vmd.attach_hw_cache(&hwc2);
+	}
+	catch (std::runtime_error &e)
+	{
+		cache_rejected = true;
+	}
+	if (!cache_rejected)
+	{
+		throw std::runtime_error("H(W_i) cache attached under another scheme");
+	}
+	vmd2.attach_hw_cache(&hwc2);
+	vmd2.attach_hw_cache(0);
+	hwc2.cleanup();
+
+	// a challenge for more chunks than the metadata has is refused by both sides
+	challenge chal_wide;
+	gen_seeded_challenge(chal_wide,scheme,1,vmd.get_count()+1);
+	bool wide_rejected = false;
+	try
+	{
+		response_proof rp_wide;
+		gen_proof(rp_wide,chal_wide,vmd,p,scheme,f);
+	}
+	catch (std::out_of_range &e)
+	{
+		wide_rejected = true;
+	}
+	if (!wide_rejected || verify_proof(rp,chal_wide,vmd,p,scheme))
+	{
+		throw std::runtime_error("Challenge beyond the metadata accepted");
+	}
+	bool position_rejected = false;
+	try
+	{
+		element_t scratch_tag;
+		vmd.load_authenticator(vmd.get_count(),scratch_tag);
+	}
+	catch (std::out_of_range &e)
+	{
+		position_rejected = true;
+	}
+	if (!position_rejected)
+	{
+		throw std::runtime_error("Tag past the end of the metadata loaded");
+	}
+	
+	// a truncated proof is rejected and leaves the one already decoded untouched
+	std::vector<unsigned char> proof_data(rp.get_serialized_size());
+	rp.serialize(&proof_data[0],proof_data.size());
+	bool truncated_rejected = false;
+	try
+	{
+		rp2.deserialize(&proof_data[0],proof_data.size()/2);
+	}
+	catch (std::runtime_error &e)
+	{
+		truncated_rejected = true;
+	}
+	if (!truncated_rejected || !verify_proof(rp2,chal2,vmd2,p2,scheme2))
+	{
+		throw std::runtime_error("Truncated proof changed the decoded one");
+	}
+	// and a whole one is decoded into the elements it already has
+	__mpz_struct *decoded_mu = rp2.get_mu();
+	rp2.deserialize(&proof_data[0],proof_data.size());
+	if (rp2.get_mu() != decoded_mu || !verify_proof(rp2,chal2,vmd2,p2,scheme2))
+	{
+		throw std::runtime_error("Proof wasn't decoded in place");
+	}
+
+	// storage nodes each hold a stripe of the file.  child processes stand in for them,
+	// each proving its shard and sending the partial back over a pipe to be combined
+	const unsigned int shard_count = 3;
+	std::vector<partial_proof> shard_proofs(shard_count);
+	for (int i=0;i<shard_count;i++)
+	{
+		int fds[2];
+		if (pipe(fds) != 0)
+		{
+			throw std::runtime_error("Unable to create pipe");
+		}
+		pid_t pid = fork();
+		if (pid < 0)
+		{
+			throw std::runtime_error("Unable to fork shard");
+		}
+		if (pid == 0)
+		{
+			close(fds[0]);
+			int status = 1;
+			try
+			{
+				partial_proof pp;
+				gen_partial_proof(pp,chal,vmd,p,scheme,f,shard_spec(i,shard_count,2));
+				std::vector<unsigned char> data(pp.get_serialized_size());
+				pp.serialize(&data[0],data.size());
+				if (write(fds[1],&data[0],data.size()) == (ssize_t)data.size())
+				{
+					status = 0;
+				}
+			}
+			catch (...)
+			{
+			}
+			close(fds[1]);
+			_exit(status);
+		}
+		
+		close(fds[1]);
+		std::vector<unsigned char> data;
+		unsigned char buf[4096];
+		ssize_t n;
+		while ((n = read(fds[0],buf,sizeof(buf))) > 0)
+		{
+			data.insert(data.end(),buf,buf+n);
+		}
+		close(fds[0]);
+		int status;
+		if (waitpid(pid,&status,0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0 || data.empty())
+		{
+			throw std::runtime_error("Shard failed to prove");
+		}
+		shard_proofs[i].set_scheme(scheme);
+		shard_proofs[i].deserialize(&data[0],data.size());
+	}
+	
+	std::vector<partial_proof*> parts;
+	for (int i=0;i<shard_count;i++)
+	{
+		parts.push_back(&shard_proofs[i]);
+	}
+	std::vector<unsigned char> partial_data(shard_proofs[0].get_serialized_size());
+	shard_proofs[0].serialize(&partial_data[0],partial_data.size());
+	bool short_partial_rejected = false;
+	try
+	{
+		shard_proofs[0].deserialize(&partial_data[0],partial_data.size()-1);
+	}
+	catch (std::runtime_error &e)
+	{
+		short_partial_rejected = true;
+	}
+	if (!short_partial_rejected || shard_proofs[0].get_mu_count() != p.get_sector_count())
+	{
+		throw std::runtime_error("Truncated partial proof changed the decoded one");
+	}
+	
+	response_proof rp_combined;
+	combine_proofs(rp_combined,parts,p,scheme);
+	if (!verify_proof(rp_combined,chal,vmd,p,scheme))
+	{
+		throw std::runtime_error("Combined proof invalid");
+	}
+	parts.pop_back();
+	bool missing_rejected = false;
+	try
+	{
+		response_proof rp_missing;
+		combine_proofs(rp_missing,parts,p,scheme);
+	}
+	catch (std::runtime_error &e)
+	{
+		missing_rejected = true;
+	}
+	if (!missing_rejected)
+	{
+		throw std::runtime_error("Combined a proof with a shard missing");
+	}
+	bool bad_shard_rejected = false;
+	try
+	{
+		partial_proof pp_bad;
+		gen_partial_proof(pp_bad,chal,vmd,p,scheme,f,shard_spec(0,1,0));
+	}
+	catch (std::runtime_error &e)
+	{
+		bad_shard_rejected = true;
+	}
+	if (!bad_shard_rejected)
+	{
+		throw std::runtime_error("Proved a shard with a stripe of 0");
+	}
+	std::cout << "Proof combined from " << shard_count << " shard processes verified." << std::endl;
+
+	// one proof for a round over several files of the same owner.  swapping two files'
+	// challenges must break it, the chunks were answered for the original ones
+	const unsigned int audit_count = 3;
+	std::vector<random_file*> audit_data(audit_count);
+	std::vector<verification_metadata> audit_vmd(audit_count);
+	std::vector<challenge> audit_chal(audit_count);
+	std::vector<audit_file> audit_files(audit_count);
+	for (int i=0;i<audit_count;i++)
+	{
+		audit_data[i] = new random_file(blk_size*(2+3*i),blk_size);
+		sig_gen(audit_vmd[i],s,p,scheme,*audit_data[i]);
+		gen_challenge(audit_chal[i],scheme,2+i,audit_data[i]->get_chunk_count());
+		audit_files[i] = audit_file(&audit_chal[i],&audit_vmd[i],audit_data[i]);
+	}
+	response_proof rp_multi;
+	gen_multi_file_proof(rp_multi,audit_files,p,scheme);
+	if (!verify_multi_file_proof(rp_multi,audit_files,p,scheme))
+	{
+		throw std::runtime_error("Multi-file proof invalid");
+	}
+	std::swap(audit_files[0].c,audit_files[1].c);
+	if (verify_multi_file_proof(rp_multi,audit_files,p,scheme))
+	{
+		throw std::runtime_error("Multi-file proof verified against swapped challenges");
+	}
+	std::swap(audit_files[0].c,audit_files[1].c);
+	audit_files.pop_back();
+	if (verify_multi_file_proof(rp_multi,audit_files,p,scheme))
+	{
+		throw std::runtime_error("Multi-file proof verified without one of its files");
+	}
+	for (int i=0;i<audit_count;i++)
+	{
+		delete audit_data[i];
+	}
+	std::cout << "Proof over " << audit_count << " files verified." << std::endl;
+
+	// files on disk go through mmap_file, one a whole number of chunks long and one with
+	// a partial last chunk that has to read as zero padded
+	const char *mmap_path = "test_mmap.tmp";
+	for (int extra=0;extra<2;extra++)
+	{
+		unsigned int mmap_size = 5*blk_size + extra*(blk_size/3);
+		std::vector<unsigned char> mmap_data(mmap_size);
+		for (int k=0;k<mmap_size;k++)
+		{
+			mmap_data[k] = (k*131 + 7) ^ (k >> 8);
+		}
+		FILE *out = fopen(mmap_path,"wb");
+		if (!out || fwrite(&mmap_data[0],1,mmap_size,out) != mmap_size)
+		{
+			throw std::runtime_error("Unable to write mmap test file");
+		}
+		fclose(out);
+		
+		mmap_file disk_file;
+		disk_file.open(mmap_path,blk_size);
+		if (disk_file.get_size() != mmap_size || disk_file.get_chunk_count() != 5 + extra)
+		{
+			throw std::runtime_error("mmap_file has the wrong size or chunk count");
+		}
+		const unsigned char *last = disk_file.get_chunk_data(disk_file.get_chunk_count()-1);
+		unsigned int last_len = mmap_size - (disk_file.get_chunk_count()-1)*blk_size;
+		if (memcmp(last,&mmap_data[mmap_size-last_len],last_len))
+		{
+			throw std::runtime_error("mmap_file last chunk doesn't match the file");
+		}
+		for (int k=last_len;k<blk_size;k++)
+		{
+			if (last[k])
+			{
+				throw std::runtime_error("mmap_file last chunk isn't zero padded");
+			}
+		}
+		
+		verification_metadata vmd_mmap;
+		sig_gen(vmd_mmap,s,p,scheme,disk_file,threads);
+		challenge chal_mmap;
+		gen_challenge(chal_mmap,scheme,3*disk_file.get_chunk_count(),disk_file.get_chunk_count());
+		response_proof rp_mmap;
+		gen_proof(rp_mmap,chal_mmap,vmd_mmap,p,scheme,disk_file);
+		if (!verify_proof(rp_mmap,chal_mmap,vmd_mmap,p,scheme))
+		{
+			throw std::runtime_error("Proof over an mmap_file invalid");
+		}
+		disk_file.close();
+		std::remove(mmap_path);
+	}
+	std::cout << "Proofs over mmap_file verified." << std::endl;
+
+	// a restarted process loads the same keys from a key store and verifies old proofs
+	// a world readable leftover from an earlier run mustn't pass its mode on to the secret key
+	const char *key_path = "test_keys.tmp";
+	std::string key_tmp = std::string(key_path) + ".tmp";
+	FILE *leftover = fopen(key_tmp.c_str(),"wb");
+	if (leftover)
+	{
+		fclose(leftover);
+		chmod(key_tmp.c_str(),0644);
+	}
+	keystore::write(key_path,scheme,p,&s);
+	struct stat key_stat;
+	if (stat(key_path,&key_stat) != 0 || (key_stat.st_mode & 077))
+	{
+		throw std::runtime_error("Key store with a secret key is readable by others");
+	}
+	scheme_parameters scheme3;
+	public_parameters p3;
+	secret_parameters s3;
+	keystore keys;
+	keys.open(key_path);
+	keys.load(scheme3,p3,&s3);
+	keys.close();
+	std::remove(key_path);
+
+	verification_metadata vmd3;
+	challenge chal3;
+	response_proof rp3;
+	vmd3.set_scheme(scheme3);
+	chal3.set_scheme(scheme3);
+	rp3.set_scheme(scheme3);
+	round_trip(vmd,vmd3);
+	round_trip(chal,chal3);
+	round_trip(rp,rp3);
+	std::vector<unsigned char> secret(s.get_serialized_size()),secret3(s3.get_serialized_size());
+	s.serialize(&secret[0],secret.size());
+	s3.serialize(&secret3[0],secret3.size());
+	if (secret != secret3 || !check_sig(vmd3,p3,scheme3) || !verify_proof(rp3,chal3,vmd3,p3,scheme3))
+	{
+		throw std::runtime_error("Keys loaded from the key store don't match");
+	}
+	std::cout << "Key store reloaded." << std::endl;
+
+	// a seeded challenge expands to the same pairs on both sides of the wire
+	challenge seeded,seeded2;
+	response_proof rp_seeded;
+	gen_seeded_challenge(seeded,scheme,f.get_chunk_count()*0.8,f.get_chunk_count());
+	seeded2.set_scheme(scheme);
+	round_trip(seeded,seeded2);
+	std::cout << "Seeded challenge is " << seeded.get_serialized_size() << " bytes." << std::endl;
+
+	gen_proof(rp_seeded,seeded2,vmd,p,scheme,f);
+	if (!verify_proof(rp_seeded,seeded,vmd,p,scheme))
+	{
+		throw std::runtime_error("Seeded challenge proof invalid");
+	}
+	std::cout << "Seeded challenge proof verified." << std::endl;
+
+	// a prover holding only the metadata and an on-disk tag store
+	const char *tag_path = "test_tags.tmp";
+	vmd.save_tags(tag_path);
+	tag_store store;
+	store.open(tag_path,scheme);
+
+	verification_metadata vmd_disk;
+	vmd_disk.set_scheme(scheme);
+	vmd.set_serialize_tags(false);
+	round_trip(vmd,vmd_disk);
+	vmd.set_serialize_tags(true);
+	
+	// no tags and no store: proving has to throw, even while the reader thread is still
+	// fetching the next batch, rather than abort the process
+	challenge long_chal;
+	gen_challenge(long_chal,scheme,4097,f.get_chunk_count());
+	bool no_tags_rejected = false;
+	try
+	{
+		response_proof rp_no_tags;
+		gen_proof(rp_no_tags,long_chal,vmd_disk,p,scheme,f);
+	}
+	catch (std::runtime_error &e)
+	{
+		no_tags_rejected = true;
+	}
+	if (!no_tags_rejected)
+	{
+		throw std::runtime_error("Proved without any tags");
+	}
+	std::cout << "Proving without tags throws." << std::endl;
+	
+	vmd_disk.attach_tag_store(store);
+
+	response_proof rp_disk;
+	gen_proof(rp_disk,seeded,vmd_disk,p,scheme,f);
+	store.close();
+	std::remove(tag_path);
+	if (!verify_proof(rp_disk,seeded,vmd,p,scheme))
+	{
+		throw std::runtime_error("Proof from tag store invalid");
+	}
+	std::cout << "Proof from tag store verified." << std::endl;
+
+	// streamed tags survive a crash part way, the rerun only tags what wasn't checkpointed
+	const char *stream_path = "test_stream_tags.tmp";
+	const char *checkpoint_path = "test_stream.ckpt";
+	block_file sf(40,blk_size);
+	stream_options stream;
+	stream.threads = 1;				// ranges finish in order, so the checkpoint is predictable
+	stream.range_size = 4;
+	stream.queue_depth = 2;
+	stream.checkpoint_path = checkpoint_path;
+	stream.checkpoint_interval = 8;
+	std::remove(checkpoint_path);
+	verification_metadata vmd_stream;
+	tag_store_writer stream_writer;
+	stream_writer.open(stream_path,scheme,sf.get_chunk_count());
+	crashing_sink crashing(stream_writer,20);
+	try
+	{
+		sig_gen_stream(vmd_stream,s,p,scheme,sf,crashing,stream);
+		throw std::logic_error("Streamed sig_gen didn't crash");
+	}
+	catch (std::runtime_error &e)
+	{
+	}
+	counting_sink counting(stream_writer);
+	sig_gen_stream(vmd_stream,s,p,scheme,sf,counting,stream);
+	stream_writer.close();
+	if (counting._count >= sf.get_chunk_count())
+	{
+		throw std::runtime_error("Streamed sig_gen didn't resume from its checkpoint");
+	}
+
+	tag_store stream_store;
+	stream_store.open(stream_path,scheme);
+	vmd_stream.attach_tag_store(stream_store);
+	challenge chal_stream;
+	response_proof rp_stream;
+	gen_seeded_challenge(chal_stream,scheme,sf.get_chunk_count(),sf.get_chunk_count());
+	gen_proof(rp_stream,chal_stream,vmd_stream,p,scheme,sf);
+	stream_store.close();
+	std::remove(stream_path);
+	if (!check_sig(vmd_stream,p,scheme) || !verify_proof(rp_stream,chal_stream,vmd_stream,p,scheme))
+	{
+		throw std::runtime_error("Proof over streamed tags invalid");
+	}
+	std::cout << "Streamed sig_gen resumed after " << sf.get_chunk_count() - counting._count << " chunks and verified." << std::endl;
+
+	// dynamic operations only tag the blocks they touch
+	block_file bf(6,blk_size);
+	verification_metadata vmd_dyn;
+	sig_gen(vmd_dyn,s,p,scheme,bf);
+
+	mpz_t m;
+	mpz_init(m);
+	bf._blocks[2] = bf.random_block();
+	bf.get_chunk(m,2);
+	vmd_dyn.update_block(2,m,s,p);
+	bf._blocks.insert(bf._blocks.begin(),bf.random_block());
+	bf.get_chunk(m,0);
+	vmd_dyn.insert_block(0,m,s,p);
+	bf._blocks.erase(bf._blocks.begin()+4);
+	vmd_dyn.delete_block(4);
+	bf._blocks.push_back(bf.random_block());
+	bf.get_chunk(m,bf.get_chunk_count()-1);
+	vmd_dyn.append_block(m,s,p);
+	mpz_clear(m);
+
+	// the verifier only needs the metadata, including the new block ids
+	verification_metadata vmd_dyn2;
+	vmd_dyn2.set_scheme(scheme);
+	vmd_dyn.set_serialize_tags(false);
+	round_trip(vmd_dyn,vmd_dyn2);
+
+	challenge chal_dyn;
+	response_proof rp_dyn;
+	gen_seeded_challenge(chal_dyn,scheme,bf.get_chunk_count(),bf.get_chunk_count());
+	gen_proof(rp_dyn,chal_dyn,vmd_dyn,p,scheme,bf);
+	if (!verify_proof(rp_dyn,chal_dyn,vmd_dyn2,p,scheme))
+	{
+		throw std::runtime_error("Proof after dynamic operations invalid");
+	}
+
+	// the stale block at a position no longer verifies
+	bf._blocks[3] = bf.random_block();
+	response_proof rp_stale;
+	gen_proof(rp_stale,chal_dyn,vmd_dyn,p,scheme,bf);
+	if (verify_proof(rp_stale,chal_dyn,vmd_dyn2,p,scheme))
+	{
+		throw std::runtime_error("Proof over a modified block verified");
+	}
+	std::cout << "Dynamic operations verified." << std::endl;
+
+	// deleting every block mustn't let a reloaded metadata hand out old ids again
+	block_file bf_del(3,blk_size);
+	verification_metadata vmd_del;
+	sig_gen(vmd_del,s,p,scheme,bf_del);
+	for (int i=0;i<3;i++)
+	{
+		vmd_del.delete_block(0);
+	}
+	verification_metadata vmd_del2;
+	vmd_del2.set_scheme(scheme);
+	round_trip(vmd_del,vmd_del2);
+	bf_del._blocks.clear();
+	bf_del._blocks.push_back(bf_del.random_block());
+	mpz_init(m);
+	bf_del.get_chunk(m,0);
+	vmd_del2.append_block(m,s,p);
+	mpz_clear(m);
+	if (vmd_del2.get_count() != 1 || vmd_del2.get_block_id(0) < 3)
+	{
+		throw std::runtime_error("Block id reused after deleting every block");
+	}
+
+	// the auditor keeps challenging both files and catches the one with the stale block
+	local_prover prover(p,scheme);
+	auditor_options options;
+	options.interval = 0.01;
+	options.batch_threshold = 2;
+	auditor tpa(scheme,options);
+	tpa.register_file(vmd,p,prover,prover.add_file(vmd,f));
+	unsigned int bad_file = tpa.register_file(vmd_dyn2,p,prover,prover.add_file(vmd_dyn,bf));
+	tpa.start();
+	std::chrono::steady_clock::time_point audit_start = std::chrono::steady_clock::now();
+	while (tpa.get_stats().audits < 20 && std::chrono::steady_clock::now() - audit_start < std::chrono::seconds(60))
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+	tpa.stop();
+	auditor_stats stats = tpa.get_stats();
+	std::vector<unsigned int> failed = tpa.get_failed_files();
+	if (stats.audits < 20 || failed.size() != 1 || failed[0] != bad_file || stats.failures == 0)
+	{
+		throw std::runtime_error("Auditor didn't single out the modified file");
+	}
+	std::cout << "Auditor ran " << stats.audits << " audits (" << stats.batches << " batches), " << stats.failures << " failed, p50 latency " << stats.latency_p50 << " s." << std::endl;
+
+	delete rf;
+
+#ifdef PBPDP_INSTRUMENT
+	instrument::publish();
+	instrument_snapshot snapshot = sink.get_snapshot();
+	if (snapshot.counters[counter_pairings] == 0 || snapshot.phase_calls[phase_verify] == 0 || sink.get_traces().empty())
+	{
+		throw std::runtime_error("Instrumentation recorded nothing");
+	}
+	for (int i=0;i<counter_count;i++)
+	{
+		std::cout << get_counter_name((instrument_counter)i) << ": " << snapshot.counters[i] << std::endl;
+	}
+	for (int i=0;i<phase_count;i++)
+	{
+		std::cout << get_phase_name((instrument_phase)i) << ": " << snapshot.phase_calls[i] << " calls, " << snapshot.phase_seconds[i] << " s" << std::endl;
+	}
+#endif
+	instrument::set_sink(0);
 
 	} catch (const std::exception &e)
 	{
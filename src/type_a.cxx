@@ -0,0 +1,435 @@
+#include "type_a.h"
+
+#include <cstring>
+#include <sstream>
+#include <string>
+
+namespace pbpdp
+{
+
+static const unsigned int window_bits = 4;
+static const unsigned int window_size = 1 << window_bits;
+
+// the curve formulas are written once, for single elements and for lanes
+struct single_ops
+{
+	typedef fq_element value;
+
+	single_ops(const fq_field &f) : f(f) {}
+	void add(value &r, const value &a, const value &b) const { f.add(r,a,b); }
+	void sub(value &r, const value &a, const value &b) const { f.sub(r,a,b); }
+	void mul(value &r, const value &a, const value &b) const { f.mul(r,a,b); }
+	void sqr(value &r, const value &a) const { f.sqr(r,a); }
+	unsigned int zero(const value &a) const { return f.is_zero(a); }
+
+	const fq_field &f;
+};
+
+struct lane_ops
+{
+	typedef fq_vector value;
+
+	lane_ops(const fq_field &f) : f(f) {}
+	void add(value &r, const value &a, const value &b) const { f.add_lanes(r,a,b); }
+	void sub(value &r, const value &a, const value &b) const { f.sub_lanes(r,a,b); }
+	void mul(value &r, const value &a, const value &b) const { f.mul_lanes(r,a,b); }
+	void sqr(value &r, const value &a) const { f.sqr_lanes(r,a); }
+	unsigned int zero(const value &a) const { return f.lanes_zero(a); }
+
+	const fq_field &f;
+};
+
+// (X/Z^2,Y/Z^3), Z = 0 at infinity
+template <class ops> struct jacobian
+{
+	typename ops::value		X;
+	typename ops::value		Y;
+	typename ops::value		Z;
+};
+
+// dbl-2007-bl with a = 1.  r may be p
+template <class ops> static void dbl(const ops &f, jacobian<ops> &r, const jacobian<ops> &p)
+{
+	typename ops::value XX, YY, YYYY, ZZ, S, M, T, t;
+	f.sqr(XX,p.X);
+	f.sqr(YY,p.Y);
+	f.sqr(YYYY,YY);
+	f.sqr(ZZ,p.Z);
+	// S = 2*((X+YY)^2-XX-YYYY)
+	f.add(t,p.X,YY);
+	f.sqr(S,t);
+	f.sub(S,S,XX);
+	f.sub(S,S,YYYY);
+	f.add(S,S,S);
+	// M = 3*XX+a*ZZ^2
+	f.add(M,XX,XX);
+	f.add(M,M,XX);
+	f.sqr(t,ZZ);
+	f.add(M,M,t);
+	// T = M^2-2*S
+	f.sqr(T,M);
+	f.sub(T,T,S);
+	f.sub(T,T,S);
+	// Z3 = (Y+Z)^2-YY-ZZ, the last use of p
+	f.add(t,p.Y,p.Z);
+	f.sqr(r.Z,t);
+	f.sub(r.Z,r.Z,YY);
+	f.sub(r.Z,r.Z,ZZ);
+	// Y3 = M*(S-T)-8*YYYY
+	f.sub(t,S,T);
+	f.mul(r.Y,M,t);
+	f.add(YYYY,YYYY,YYYY);
+	f.add(YYYY,YYYY,YYYY);
+	f.add(YYYY,YYYY,YYYY);
+	f.sub(r.Y,r.Y,YYYY);
+	r.X = T;
+}
+
+// add-2007-bl.  returns where it doesn't apply: p or q at infinity, or the same x
+// (then same is where they are the same point).  r may be p or q
+template <class ops> static unsigned int add(const ops &f, jacobian<ops> &r, const jacobian<ops> &p, const jacobian<ops> &q, unsigned int &same)
+{
+	typename ops::value Z1Z1, Z2Z2, U1, U2, S1, S2, H, I, J, R, V, t;
+	jacobian<ops> out;
+	f.sqr(Z1Z1,p.Z);
+	f.sqr(Z2Z2,q.Z);
+	f.mul(U1,p.X,Z2Z2);
+	f.mul(U2,q.X,Z1Z1);
+	f.mul(t,q.Z,Z2Z2);
+	f.mul(S1,p.Y,t);
+	f.mul(t,p.Z,Z1Z1);
+	f.mul(S2,q.Y,t);
+	f.sub(H,U2,U1);
+	f.sub(R,S2,S1);
+	unsigned int exceptions = f.zero(H) | f.zero(p.Z) | f.zero(q.Z);
+	same = f.zero(R);
+	// I = (2*H)^2, J = H*I, R = 2*(S2-S1), V = U1*I
+	f.add(t,H,H);
+	f.sqr(I,t);
+	f.mul(J,H,I);
+	f.add(R,R,R);
+	f.mul(V,U1,I);
+	// X3 = R^2-J-2*V
+	f.sqr(out.X,R);
+	f.sub(out.X,out.X,J);
+	f.sub(out.X,out.X,V);
+	f.sub(out.X,out.X,V);
+	// Y3 = R*(V-X3)-2*S1*J
+	f.sub(t,V,out.X);
+	f.mul(out.Y,R,t);
+	f.mul(t,S1,J);
+	f.add(t,t,t);
+	f.sub(out.Y,out.Y,t);
+	// Z3 = ((Z1+Z2)^2-Z1Z1-Z2Z2)*H
+	f.add(t,p.Z,q.Z);
+	f.sqr(t,t);
+	f.sub(t,t,Z1Z1);
+	f.sub(t,t,Z2Z2);
+	f.mul(out.Z,t,H);
+	r = out;
+	return exceptions;
+}
+
+// single points take care of the cases add doesn't cover
+static unsigned int add_point(const single_ops &f, jacobian<single_ops> &r, const jacobian<single_ops> &p, const jacobian<single_ops> &q)
+{
+	if (f.zero(p.Z))
+	{
+		r = q;
+		return 0;
+	}
+	if (f.zero(q.Z))
+	{
+		r = p;
+		return 0;
+	}
+	jacobian<single_ops> p_copy = p;
+	unsigned int same;
+	if (add(f,r,p,q,same))
+	{
+		if (same)
+		{
+			dbl(f,r,p_copy);
+		}
+		else
+		{
+			r.X = r.Y = f.f.one();
+			memset(&r.Z,0,sizeof(r.Z));
+		}
+	}
+	return 0;
+}
+
+// lanes only report them, they are redone one at a time
+static unsigned int add_point(const lane_ops &f, jacobian<lane_ops> &r, const jacobian<lane_ops> &p, const jacobian<lane_ops> &q)
+{
+	unsigned int same;
+	return add(f,r,p,q,same);
+}
+
+static unsigned int nibble(const __mpz_struct *e, unsigned int i)
+{
+	unsigned int d = 0;
+	for (int b=window_bits-1;b>=0;b--)
+	{
+		d = (d << 1) | mpz_tstbit(e,window_bits*i+b);
+	}
+	return d;
+}
+
+// acc = p^e for 0 < e, with a table of p^1 .. p^15.  returns what add_point reported
+template <class ops> static unsigned int window_pow(const ops &f, jacobian<ops> &acc, const jacobian<ops> &p, const __mpz_struct *e)
+{
+	jacobian<ops> table[window_size];
+	unsigned int exceptions = 0;
+	table[1] = p;
+	dbl(f,table[2],p);
+	for (int k=3;k<window_size;k++)
+	{
+		exceptions |= add_point(f,table[k],table[k-1],p);
+	}
+
+	int top = (mpz_sizeinbase(e,2) + window_bits - 1) / window_bits - 1;
+	acc = table[nibble(e,top)];
+	for (int i=top-1;i>=0;i--)
+	{
+		for (int b=0;b<window_bits;b++)
+		{
+			dbl(f,acc,acc);
+		}
+		unsigned int d = nibble(e,i);
+		if (d)
+		{
+			exceptions |= add_point(f,acc,acc,table[d]);
+		}
+	}
+	return exceptions;
+}
+
+// pbc writes a point as x then y, each big endian in coord_len bytes
+static void get_coord(__mpz_struct *z, const unsigned char *data, unsigned int len)
+{
+	mpz_import(z,len,1,1,1,0,data);
+}
+
+static void put_coord(unsigned char *data, unsigned int len, const __mpz_struct *z)
+{
+	size_t n = mpz_sgn(z) ? (mpz_sizeinbase(z,2) + 7) / 8 : 0;
+	memset(data,0,len-n);
+	size_t count;
+	mpz_export(data+len-n,&count,1,1,1,0,z);
+}
+
+static bool parse_type_a(const char *params, __mpz_struct *q)
+{
+	std::istringstream in(params);
+	std::string line;
+	bool type_a = false;
+	bool have_q = false;
+	while (std::getline(in,line))
+	{
+		std::istringstream fields(line);
+		std::string key, value;
+		fields >> key >> value;
+		if (key == "type")
+		{
+			type_a = value == "a";
+		}
+		else if (key == "q")
+		{
+			have_q = !mpz_set_str(q,value.c_str(),10);
+		}
+	}
+	return type_a && have_q;
+}
+
+bool type_a_g1::init(const char *params, pairing_s *pairing)
+{
+	cleanup();
+
+	mpz_t q;
+	mpz_init(q);
+	unsigned int coord_len = pairing_length_in_bytes_x_only_G1(pairing);
+	bool usable = params && parse_type_a(params,q) && mpz_odd_p(q) && mpz_cmp_ui(q,3) >= 0 && mpz_sizeinbase(q,2) <= 64*fq_limbs &&
+		coord_len <= 8*fq_limbs && pairing_length_in_bytes_G1(pairing) == 2*coord_len;
+	if (usable)
+	{
+		_fq.init(q);
+		mpz_init_set(_r,pairing->r);
+		_coord_len = coord_len;
+		_initialized = true;
+	}
+	mpz_clear(q);
+	return usable;
+}
+
+void type_a_g1::cleanup()
+{
+	if (_initialized)
+	{
+		mpz_clear(_r);
+		_fq.cleanup();
+		_initialized = false;
+	}
+}
+
+void type_a_g1::pow(element_t out, element_t in, const __mpz_struct *e) const
+{
+	mpz_t k;
+	mpz_init(k);
+	mpz_mod(k,e,_r);
+	if (element_is1(in) || !mpz_sgn(k))
+	{
+		element_set1(out);
+		mpz_clear(k);
+		return;
+	}
+
+	single_ops f(_fq);
+	unsigned char data[16*fq_limbs];
+	mpz_t x, y;
+	mpz_init(x);
+	mpz_init(y);
+	element_to_bytes(data,in);
+	get_coord(x,data,_coord_len);
+	get_coord(y,data+_coord_len,_coord_len);
+
+	jacobian<single_ops> p, acc;
+	_fq.set_mpz(p.X,x);
+	_fq.set_mpz(p.Y,y);
+	p.Z = _fq.one();
+	window_pow(f,acc,p,k);
+
+	if (f.zero(acc.Z))
+	{
+		element_set1(out);
+	}
+	else
+	{
+		// x = X/Z^2, y = Y/Z^3
+		fq_element zi, zi2;
+		_fq.inv(zi,acc.Z);
+		_fq.sqr(zi2,zi);
+		_fq.mul(acc.X,acc.X,zi2);
+		_fq.mul(zi2,zi2,zi);
+		_fq.mul(acc.Y,acc.Y,zi2);
+		_fq.get_mpz(x,acc.X);
+		_fq.get_mpz(y,acc.Y);
+		put_coord(data,_coord_len,x);
+		put_coord(data+_coord_len,_coord_len,y);
+		element_from_bytes(out,data);
+	}
+
+	mpz_clear(y);
+	mpz_clear(x);
+	mpz_clear(k);
+}
+
+void type_a_g1::pow_batch(element_s *const *out, element_s *const *in, const __mpz_struct *e, unsigned int n) const
+{
+	if (!_fq.has_lanes())
+	{
+		for (int k=0;k<n;k++)
+		{
+			pow(out[k],in[k],e);
+		}
+		return;
+	}
+	for (unsigned int start=0;start<n;start+=fq_lanes)
+	{
+		pow_lanes(out+start,in+start,e,n - start < fq_lanes ? n - start : fq_lanes);
+	}
+}
+
+// up to eight points at once.  any lane the formulas don't cover (a point at infinity,
+// or one whose order isn't r) is redone with pow
+void type_a_g1::pow_lanes(element_s *const *out, element_s *const *in, const __mpz_struct *e, unsigned int n) const
+{
+	mpz_t k;
+	mpz_init(k);
+	mpz_mod(k,e,_r);
+	if (!mpz_sgn(k))
+	{
+		for (int l=0;l<n;l++)
+		{
+			element_set1(out[l]);
+		}
+		mpz_clear(k);
+		return;
+	}
+
+	lane_ops f(_fq);
+	unsigned char data[16*fq_limbs];
+	mpz_t x, y;
+	mpz_init(x);
+	mpz_init(y);
+
+	// lanes without a point of their own repeat the first finite one
+	jacobian<lane_ops> p, acc;
+	unsigned int redo = 0;
+	int first = -1;
+	for (int l=0;l<n && first < 0;l++)
+	{
+		if (!element_is1(in[l]))
+		{
+			first = l;
+		}
+	}
+	for (int l=0;l<fq_lanes && first >= 0;l++)
+	{
+		bool own = l < n && !element_is1(in[l]);
+		if (!own)
+		{
+			redo |= 1 << l;
+		}
+		element_to_bytes(data,in[own ? l : first]);
+		get_coord(x,data,_coord_len);
+		get_coord(y,data+_coord_len,_coord_len);
+		_fq.set_lane_mpz(p.X,l,x);
+		_fq.set_lane_mpz(p.Y,l,y);
+	}
+
+	if (first < 0)
+	{
+		redo = (1 << n) - 1;
+	}
+	else
+	{
+		p.Z = _fq.lanes_one();
+		redo |= window_pow(f,acc,p,k);
+		redo |= f.zero(acc.Z);
+
+		fq_vector zi, zi2;
+		_fq.inv_lanes(zi,acc.Z);
+		_fq.sqr_lanes(zi2,zi);
+		_fq.mul_lanes(acc.X,acc.X,zi2);
+		_fq.mul_lanes(zi2,zi2,zi);
+		_fq.mul_lanes(acc.Y,acc.Y,zi2);
+		for (int l=0;l<n;l++)
+		{
+			if (redo & (1 << l))
+			{
+				continue;
+			}
+			_fq.get_lane_mpz(x,acc.X,l);
+			_fq.get_lane_mpz(y,acc.Y,l);
+			put_coord(data,_coord_len,x);
+			put_coord(data+_coord_len,_coord_len,y);
+			element_from_bytes(out[l],data);
+		}
+	}
+
+	mpz_clear(y);
+	mpz_clear(x);
+	mpz_clear(k);
+
+	for (int l=0;l<n;l++)
+	{
+		if (redo & (1 << l))
+		{
+			pow(out[l],in[l],e);
+		}
+	}
+}
+
+};
@@ -0,0 +1,45 @@
+#ifndef PBPDP_TYPE_A_H
+#define PBPDP_TYPE_A_H
+
+#include <pbc/pbc.h>
+
+#include "fq.h"
+
+// G1 of pbc's type a curves, y^2 = x^3 + x over fq, on the fixed width field in fq.h.
+// pbc adds points in affine coordinates, an inversion each time; these exponentiations
+// stay in jacobian coordinates with a 4 bit window and invert once at the end.  a batch
+// sharing one exponent, as when every tag is raised to x, runs eight points at a time in
+// the field's lanes when it has them.  points go in and come out as pbc elements and are
+// the same points pbc computes.
+
+namespace pbpdp
+{
+	class type_a_g1
+	{
+	public:
+		type_a_g1() : _initialized(false) {}
+		~type_a_g1() { cleanup(); }
+		// false, and nothing to clean up, unless params are type a with q of at most 512 bits
+		bool init(const char *params, pairing_s *pairing);
+		void cleanup();
+
+		const fq_field& get_field() const { return _fq; }
+
+		void pow(element_t out, element_t in, const __mpz_struct *e) const;
+		// out[k] = in[k]^e, out[k] may be in[k]
+		void pow_batch(element_s *const *out, element_s *const *in, const __mpz_struct *e, unsigned int n) const;
+
+	private:
+		type_a_g1(const type_a_g1&);
+		type_a_g1& operator=(const type_a_g1&);
+
+		void pow_lanes(element_s *const *out, element_s *const *in, const __mpz_struct *e, unsigned int n) const;
+
+		bool				_initialized;
+		fq_field			_fq;
+		mpz_t				_r;					// order of G1, exponents are reduced by it
+		unsigned int		_coord_len;			// bytes in each coordinate of pbc's encoding
+	};
+};
+
+#endif